@@ -0,0 +1,41 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <resampler.h>
+
+using namespace gbemulator;
+
+// Measures output frames per second for each supported kernel on a stereo
+// tone, for the rates the APU pipeline uses.
+int main() {
+	const char *names[] = {"scalar", "sse2", "avx2"};
+	const double rates[][2] = {{65536, 48000}, {65536, 44100}, {262144, 48000}};
+	const int inputFrames = 1 << 20;
+	std::vector<int16_t> input(inputFrames * 2);
+	for(int i = 0; i < inputFrames; i++) {
+		input[i * 2] = static_cast<int16_t>(16000 * std::sin(i * 0.05));
+		input[i * 2 + 1] = static_cast<int16_t>(16000 * std::cos(i * 0.03));
+	}
+	std::vector<int16_t> output(inputFrames * 2);
+	for(const double *rate : rates) {
+		for(int k = KERNEL_SCALAR; k <= KERNEL_AVX2; k++) {
+			if(!Resampler::isSupported(static_cast<ResamplerKernel>(k))) {
+				continue;
+			}
+			Resampler resampler(rate[0], rate[1]);
+			resampler.setKernel(static_cast<ResamplerKernel>(k));
+			auto start = std::chrono::steady_clock::now();
+			long produced = 0;
+			for(int i = 0; i < inputFrames; i += 4096) {
+				resampler.push(&input[i * 2], 4096);
+				produced += resampler.pull(output.data(), inputFrames);
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			printf("%7.0f -> %5.0f Hz  %-6s  %2d taps  %8.2f M frames/s\n", rate[0], rate[1], names[k],
+					resampler.getTaps(), produced / elapsed.count() / 1e6);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <gameboy.h>
+#include <rewind.h>
+
+using namespace gbemulator;
+
+static double microsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A scene with a moving sprite and a few WRAM writes per frame, so states
+// change the way a game's do.
+static void runSceneFrame(FastGameboy &gameboy, int frame) {
+	MemoryMap *memory = gameboy.getMemory();
+	memory->write8(0xFE01, frame & 0xFF);
+	memory->write8(0xC000 + (frame * 97) % 0x2000, frame);
+	gameboy.runFrame();
+}
+
+static void benchRewind(FastGameboy &gameboy, int frames) {
+	std::vector<uint8_t> state(gameboy.stateSize());
+	Rewind rewind;
+	double push = 0;
+	for(int i = 0; i < frames; i++) {
+		runSceneFrame(gameboy, i);
+		gameboy.saveState(state.data(), state.size());
+		auto start = std::chrono::steady_clock::now();
+		rewind.push(state.data(), state.size());
+		push += microsSince(start);
+	}
+	RewindStats stats = rewind.getStats();
+	printf("rewind: %d frames, %zu KB deltas (%.0f bytes/frame), %zu KB total memory\n", stats.frames,
+			stats.deltaBytes >> 10, stats.averageDeltaBytes, stats.memory >> 10);
+	printf("rewind: push %.2f us/frame\n", push / frames);
+	double step = 0;
+	int steps = 0;
+	auto start = std::chrono::steady_clock::now();
+	while(const uint8_t *previous = rewind.stepBack()) {
+		gameboy.loadState(previous, state.size());
+		steps++;
+	}
+	step = microsSince(start);
+	printf("rewind: step back and load %.2f us/frame over %d frames\n", step / steps, steps);
+}
+
+// Incremental hashing per frame, against hashing a whole save state.
+static void benchHash(FastGameboy &gameboy, int frames) {
+	std::vector<uint8_t> state(gameboy.stateSize());
+	double incremental = 0;
+	double full = 0;
+	int rehashed = 0;
+	for(int i = 0; i < frames; i++) {
+		runSceneFrame(gameboy, i);
+		auto start = std::chrono::steady_clock::now();
+		gameboy.stateHash();
+		incremental += microsSince(start);
+		rehashed += gameboy.getHasher().getRehashed();
+		start = std::chrono::steady_clock::now();
+		gameboy.saveState(state.data(), state.size());
+		hashBytes(state.data(), state.size());
+		full += microsSince(start);
+	}
+	printf("hash: incremental %.2f us/frame (%.1f blocks), full state %.2f us/frame\n", incremental / frames,
+			static_cast<double>(rehashed) / frames, full / frames);
+}
+
+// Expanding search nodes: fork a state into children and step each one.
+static void benchFork(FastGameboy &gameboy, int rounds) {
+	const int width = 8;
+	std::unique_ptr<FastGameboy> children[width];
+	FastGameboy *pointers[width];
+	for(int i = 0; i < width; i++) {
+		children[i].reset(new FastGameboy());
+		pointers[i] = children[i].get();
+	}
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < rounds; i++) {
+		gameboy.fork(pointers, width);
+	}
+	double fork = microsSince(start) / (rounds * width);
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < rounds; i++) {
+		gameboy.fork(pointers, width);
+		for(int j = 0; j < width; j++) {
+			children[j]->runFrame();
+		}
+	}
+	double expand = microsSince(start) / (rounds * width);
+	printf("fork: %.2f us/child (%.0f/s), fork and run a frame %.1f us/child (%.0f nodes/s)\n", fork, 1e6 / fork,
+			expand, 1e6 / expand);
+}
+
+// Episodes of a few frames from a fixed start, as in RL training: reset
+// to a checkpoint against a full loadState, and the frame rate in between.
+static void benchReset(FastGameboy &gameboy, int episodes, int length) {
+	std::vector<uint8_t> state(gameboy.stateSize());
+	gameboy.saveState(state.data(), state.size());
+	gameboy.setCheckpoint();
+	double reset = 0;
+	double load = 0;
+	double step = 0;
+	for(int i = 0; i < episodes; i++) {
+		auto start = std::chrono::steady_clock::now();
+		for(int j = 0; j < length; j++) {
+			runSceneFrame(gameboy, i * length + j);
+		}
+		step += microsSince(start);
+		start = std::chrono::steady_clock::now();
+		gameboy.resetToCheckpoint();
+		reset += microsSince(start);
+		start = std::chrono::steady_clock::now();
+		gameboy.loadState(state.data(), state.size());
+		load += microsSince(start);
+		// Leaves every block dirty against the checkpoint; set it again.
+		gameboy.setCheckpoint();
+	}
+	printf("reset: %d-frame episodes, %.2f us (%.0f resets/s) against loadState %.2f us, %.0f frames/s\n", length,
+			reset / episodes, episodes * 1e6 / reset, load / episodes, episodes * length * 1e6 / step);
+}
+
+// A loop that polls the joypad and scrolls the background while A is held.
+static void loadScrollProgram(MemoryMap *memory) {
+	const uint8_t program[] = {0xF0, 0x00, 0x0F, 0x38, 0xFB, 0xF0, 0x43, 0x3C, 0xE0, 0x43, 0x18, 0xF4};
+	for(size_t i = 0; i < sizeof(program); i++) {
+		memory->write8(0x0100 + i, program[i]);
+	}
+	memory->write8(0xFF00, 0x10);
+	memory->write8(0xFF40, 0x93);
+}
+
+// Cost per presented frame with run-ahead, against plain emulation, for
+// both PPUs. Rendering is skipped for all but the presented frame.
+template<class Gameboy>
+static void benchRunAhead(const char *name) {
+	const int frames = 300;
+	double base = 0;
+	for(int ahead = 0; ahead <= 4; ahead++) {
+		std::unique_ptr<Gameboy> gameboy(new Gameboy());
+		loadScrollProgram(gameboy->getMemory());
+		gameboy->setRunAhead(ahead);
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < frames; i++) {
+			gameboy->getMemory()->write8(0xFE01, i & 0xFF);
+			gameboy->getJoypad().setButtons(i & 0x10 ? BUTTON_A : 0);
+			gameboy->runFrame();
+		}
+		double perFrame = microsSince(start) / frames;
+		if(!ahead) {
+			base = perFrame;
+		}
+		printf("run-ahead %-8s N=%d: %8.1f us/frame (%.2fx)\n", name, ahead, perFrame, perFrame / base);
+	}
+}
+
+int main() {
+	std::unique_ptr<FastGameboy> gameboy(new FastGameboy());
+	gameboy->getMemory()->write8(0xFF40, 0x93);
+	std::vector<uint8_t> state(gameboy->stateSize());
+	const int iterations = 20000;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < iterations; i++) {
+		gameboy->saveState(state.data(), state.size());
+	}
+	double save = microsSince(start) / iterations;
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < iterations; i++) {
+		gameboy->loadState(state.data(), state.size());
+	}
+	double load = microsSince(start) / iterations;
+	printf("state: %zu bytes, save %.2f us, load %.2f us\n", state.size(), save, load);
+	benchRewind(*gameboy, 60 * 30);
+	benchHash(*gameboy, 600);
+	benchFork(*gameboy, 500);
+	benchReset(*gameboy, 500, 1);
+	benchReset(*gameboy, 100, 60);
+	benchRunAhead<FastGameboy>("scanline");
+	benchRunAhead<AccurateGameboy>("fifo");
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <vec-emulator.h>
+
+using namespace gbemulator;
+
+// A loop that polls the joypad and scrolls the background while A is held.
+static void loadScrollProgram(MemoryMap *memory) {
+	const uint8_t program[] = {0xF0, 0x00, 0x0F, 0x38, 0xFB, 0xF0, 0x43, 0x3C, 0xE0, 0x43, 0x18, 0xF4};
+	for(size_t i = 0; i < sizeof(program); i++) {
+		memory->write8(0x0100 + i, program[i]);
+	}
+	memory->write8(0xFF00, 0x10);
+	memory->write8(0xFF40, 0x93);
+}
+
+// Total frames per second across threads, stepping with action repeat 4
+// and writing 80x72 observations plus a few RAM bytes.
+static void benchEnvs(int count, int threads, int steps) {
+	VecEmulator<FastGameboy> envs(count, threads);
+	envs.setRamObservation({0xFF43, 0xFF44, 0xC000, 0xC001});
+	for(int i = 0; i < count; i++) {
+		loadScrollProgram(envs.get(i).getMemory());
+	}
+	std::vector<uint8_t> actions(count);
+	std::vector<uint8_t> frames(count * envs.frameObservationSize());
+	std::vector<uint8_t> ram(count * envs.ramObservationSize());
+	const int repeat = 4;
+	auto start = std::chrono::steady_clock::now();
+	for(int s = 0; s < steps; s++) {
+		for(int i = 0; i < count; i++) {
+			actions[i] = (s + i) & 2 ? BUTTON_A : 0;
+		}
+		envs.step(actions.data(), repeat, frames.data(), ram.data());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%3d envs, %2d threads: %8.0f frames/s, %7.0f steps/s\n", count, threads,
+			count * steps * repeat / seconds, count * steps / seconds);
+}
+
+int main() {
+	int cores = std::max(1u, std::thread::hardware_concurrency());
+	for(int threads = 1; threads <= cores; threads *= 2) {
+		benchEnvs(64, threads, 4);
+	}
+	if(cores & (cores - 1)) {
+		benchEnvs(64, cores, 4);
+	}
+	return 0;
+}
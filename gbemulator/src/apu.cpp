@@ -0,0 +1,620 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#define FLUSH_CHUNK_FRAMES 512
+#define NOISE_WIDE_LENGTH 32767
+#define NOISE_NARROW_LENGTH 127
+// Scales the mixed level (4 channels * 15 * master volume 8) to 16 bits.
+#define AMP_SCALE 64
+// Stems are scaled as if at full master volume.
+#define STEM_SCALE (AMP_SCALE * 8)
+
+namespace gbemulator {
+
+	static const uint8_t DUTY_PATTERNS[4] = {0x80, 0x81, 0xE1, 0x7E};
+	static const int NOISE_DIVISORS[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+	// Every state of the 15-bit and 7-bit noise LFSRs in the order they are
+	// stepped through from the trigger value 0x7FFF, with the inverse
+	// mapping and, per position, the number of steps until the output bit
+	// changes. The all-zero state locks up and has no position.
+	struct NoiseSequence {
+		int length;
+		std::vector<uint16_t> states;
+		std::vector<int16_t> positions;
+		std::vector<uint8_t> runs;
+
+		NoiseSequence(bool narrow) {
+			length = narrow ? NOISE_NARROW_LENGTH : NOISE_WIDE_LENGTH;
+			states.resize(length);
+			positions.assign(narrow ? 0x80 : 0x8000, -1);
+			runs.resize(length);
+			// In 7-bit mode the upper bits only hold recent feedback, so after a
+			// full cycle the 15-bit state is a function of the position.
+			uint16_t lfsr = 0x7FFF;
+			for(int i = 0; i < length * (narrow ? 2 : 1); i++) {
+				states[i % length] = lfsr;
+				int bit = (lfsr ^ (lfsr >> 1)) & 1;
+				lfsr = (lfsr >> 1) | (bit << 14);
+				if(narrow) {
+					lfsr = (lfsr & ~0x40) | (bit << 6);
+				}
+			}
+			for(int i = 0; i < length; i++) {
+				positions[narrow ? states[i] & 0x7F : states[i]] = i;
+			}
+			for(int i = length * 2 - 1; i >= 0; i--) {
+				int next = (i + 1) % length;
+				runs[i % length] = (states[next] ^ states[i % length]) & 1 ? 1 : runs[next] + 1;
+			}
+		}
+	};
+
+	static const NoiseSequence &noiseSequence(bool narrow) {
+		static const NoiseSequence wide(false);
+		static const NoiseSequence seven(true);
+		return narrow ? seven : wide;
+	}
+
+	static inline int dutyBit(int duty, int pos) {
+		return (DUTY_PATTERNS[duty] >> pos) & 1;
+	}
+
+	Apu::Apu(MemoryMap *memory, Scheduler *scheduler) : io(memory->getRegisters()), scheduler(scheduler), ring(nullptr), resampler(nullptr), capture(nullptr),
+			power(true), time(0), frameStart(0), nextSequencer(FRAME_SEQUENCER_PERIOD), sequencerStep(0),
+			mixLeft(0), mixRight(0), stemLevels(), muted(false), sweepPeriod(0), sweepTimer(0), sweepShift(0), sweepNegate(false),
+			sweepEnabled(false), shadowFreq(0), waveShift(4), narrowLfsr(false) {
+		memset(channels, 0, sizeof(channels));
+		for(int ch = 0; ch < APU_CHANNELS; ch++) {
+			setFrequency(ch);
+		}
+		setSampleRate(APU_SAMPLE_RATE);
+		for(int reg = REG_NR10; reg <= REG_NR52; reg++) {
+			io->onWrite(reg, [this, reg](uint8_t val) { write(reg, val); });
+		}
+		for(int reg = REG_WAVE; reg < REG_WAVE + WAVE_RAM_SIZE; reg++) {
+			io->onWrite(reg, [this, reg](uint8_t val) { write(reg, val); });
+		}
+		io->set(REG_NR50, 0x77);
+		io->set(REG_NR51, 0xF3);
+		updateStatus();
+	}
+
+	void Apu::setSampleRate(int rate) {
+		sampleRate = rate;
+		noiseSpacing = APU_CLOCK_RATE / rate;
+		left.setRates(APU_CLOCK_RATE, rate);
+		right.setRates(APU_CLOCK_RATE, rate);
+		for(BlipBuffer &stem : stems) {
+			stem.setRates(APU_CLOCK_RATE, rate);
+		}
+	}
+
+	void Apu::setCapture(AudioCapture *capture) {
+		this->capture = capture;
+		stems.clear();
+		memset(stemLevels, 0, sizeof(stemLevels));
+		if(capture && capture->hasStems()) {
+			stems.resize(APU_CHANNELS);
+			setSampleRate(sampleRate);
+		}
+	}
+
+	int Apu::endFrame() {
+		uint64_t now = scheduler->now();
+		sync(now);
+		left.endFrame(now - frameStart);
+		right.endFrame(now - frameStart);
+		for(BlipBuffer &stem : stems) {
+			stem.endFrame(now - frameStart);
+		}
+		frameStart = now;
+		return left.samplesAvailable();
+	}
+
+	int Apu::readSamples(int16_t *out, int frames) {
+		endFrame();
+		int count = left.readSamples(out, frames, 2);
+		right.readSamples(out + 1, count, 2);
+		if(capture) {
+			capture->getRing()->write(out, count * 2);
+			int16_t mono[FLUSH_CHUNK_FRAMES];
+			for(int ch = 0; ch < static_cast<int>(stems.size()); ch++) {
+				for(int done = 0; done < count;) {
+					int n = stems[ch].readSamples(mono, std::min(count - done, FLUSH_CHUNK_FRAMES));
+					capture->getStemRing(ch)->write(mono, n);
+					done += n;
+				}
+			}
+		}
+		return count;
+	}
+
+	void Apu::flush() {
+		if(!ring && !capture) {
+			return;
+		}
+		int16_t chunk[FLUSH_CHUNK_FRAMES * 2];
+		int frames;
+		while((frames = readSamples(chunk, FLUSH_CHUNK_FRAMES)) > 0) {
+			if(!ring) {
+				continue;
+			}
+			if(!resampler) {
+				ring->write(chunk, frames * 2);
+				continue;
+			}
+			resampler->push(chunk, frames);
+			int16_t converted[FLUSH_CHUNK_FRAMES * 2];
+			int count;
+			while((count = resampler->pull(converted, FLUSH_CHUNK_FRAMES)) > 0) {
+				ring->write(converted, count * 2);
+			}
+		}
+	}
+
+	void Apu::write(int reg, uint8_t val) {
+		sync(scheduler->now());
+		if(reg >= REG_WAVE) {
+			io->set(reg, val);
+			return;
+		}
+		if(!power && reg != REG_NR52) {
+			return;
+		}
+		io->set(reg, val);
+		switch(reg) {
+		case REG_NR10:
+			sweepPeriod = (val >> 4) & 7;
+			sweepNegate = val & 0x08;
+			sweepShift = val & 7;
+			break;
+		case REG_NR11:
+		case REG_NR21: {
+			Channel &c = channels[reg == REG_NR11 ? CHANNEL_PULSE1 : CHANNEL_PULSE2];
+			c.duty = val >> 6;
+			c.length = 64 - (val & 0x3F);
+			break;
+		}
+		case REG_NR31:
+			channels[CHANNEL_WAVE].length = 256 - val;
+			break;
+		case REG_NR41:
+			channels[CHANNEL_NOISE].length = 64 - (val & 0x3F);
+			break;
+		case REG_NR12:
+		case REG_NR22:
+		case REG_NR42: {
+			int ch = reg == REG_NR12 ? CHANNEL_PULSE1 : reg == REG_NR22 ? CHANNEL_PULSE2 : CHANNEL_NOISE;
+			channels[ch].dac = val & 0xF8;
+			if(!channels[ch].dac) {
+				disable(ch);
+			}
+			break;
+		}
+		case REG_NR30:
+			channels[CHANNEL_WAVE].dac = val & 0x80;
+			if(!channels[CHANNEL_WAVE].dac) {
+				disable(CHANNEL_WAVE);
+			}
+			break;
+		case REG_NR32:
+			waveShift = (val >> 5) & 3 ? ((val >> 5) & 3) - 1 : 4;
+			setAmplitude(CHANNEL_WAVE, time, output(CHANNEL_WAVE));
+			break;
+		case REG_NR13:
+		case REG_NR23:
+		case REG_NR33:
+			setFrequency(reg == REG_NR13 ? CHANNEL_PULSE1 : reg == REG_NR23 ? CHANNEL_PULSE2 : CHANNEL_WAVE);
+			break;
+		case REG_NR14:
+		case REG_NR24:
+		case REG_NR34:
+		case REG_NR44: {
+			int ch = (reg - REG_NR14) / 5;
+			setFrequency(ch);
+			channels[ch].lengthEnable = val & 0x40;
+			if(val & 0x80) {
+				trigger(ch);
+			}
+			break;
+		}
+		case REG_NR43:
+			setNoiseWidth(val & 0x08);
+			setFrequency(CHANNEL_NOISE);
+			break;
+		case REG_NR50:
+		case REG_NR51:
+			updateMix(time);
+			break;
+		case REG_NR52:
+			if(power && !(val & 0x80)) {
+				powerOff();
+			}
+			power = val & 0x80;
+			updateStatus();
+			break;
+		}
+	}
+
+	// Runs the channels from the last sync point to now, split at frame
+	// sequencer ticks so envelope, sweep and length changes land in order.
+	void Apu::sync(uint64_t now) {
+		while(time < now) {
+			uint64_t end = std::min(now, nextSequencer);
+			runPulse(CHANNEL_PULSE1, end);
+			runPulse(CHANNEL_PULSE2, end);
+			runWave(end);
+			runNoise(end);
+			time = end;
+			if(time == nextSequencer) {
+				clockSequencer();
+				nextSequencer += FRAME_SEQUENCER_PERIOD;
+			}
+		}
+	}
+
+	// Jumps straight from one output transition to the next; the volume
+	// cannot change between sequencer ticks, so steps in between are silent.
+	void Apu::runPulse(int ch, uint64_t end) {
+		Channel &c = channels[ch];
+		if(!c.enabled || c.nextEdge >= end) {
+			return;
+		}
+		while(c.nextEdge < end) {
+			int steps = 8;
+			if(c.volume) {
+				steps = 1;
+				while(steps < 8 && dutyBit(c.duty, (c.pos + steps) & 7) == dutyBit(c.duty, c.pos)) {
+					steps++;
+				}
+			}
+			uint64_t edge = c.nextEdge + (steps - 1) * c.period;
+			if(edge >= end) {
+				uint64_t skipped = (end - c.nextEdge + c.period - 1) / c.period;
+				c.pos = (c.pos + skipped) & 7;
+				c.nextEdge += skipped * c.period;
+				break;
+			}
+			c.pos = (c.pos + steps) & 7;
+			setAmplitude(ch, edge, output(ch));
+			c.nextEdge = edge + c.period;
+		}
+	}
+
+	void Apu::runWave(uint64_t end) {
+		Channel &c = channels[CHANNEL_WAVE];
+		if(!c.enabled || c.nextEdge >= end) {
+			return;
+		}
+		if(waveShift == 4) {
+			uint64_t skipped = (end - c.nextEdge + c.period - 1) / c.period;
+			c.pos = (c.pos + skipped) & 31;
+			c.nextEdge += skipped * c.period;
+			return;
+		}
+		for(; c.nextEdge < end; c.nextEdge += c.period) {
+			c.pos = (c.pos + 1) & 31;
+			setAmplitude(CHANNEL_WAVE, c.nextEdge, output(CHANNEL_WAVE));
+		}
+	}
+
+	// Walks the noise sequence from one output change to the next using the
+	// precomputed run lengths. Settings faster than the output sample rate
+	// are point-sampled once per output sample instead, so even the highest
+	// noise frequencies cost a bounded amount per sample. The sampled levels
+	// only shape the audio: the channel ends on the exact output of its
+	// final position, so the state does not depend on the host rate.
+	void Apu::runNoise(uint64_t end) {
+		Channel &c = channels[CHANNEL_NOISE];
+		if(!c.enabled || c.nextEdge >= end) {
+			return;
+		}
+		const NoiseSequence &seq = noiseSequence(narrowLfsr);
+		if(c.pos < 0 || c.volume == 0) {
+			uint64_t skipped = (end - c.nextEdge + c.period - 1) / c.period;
+			if(c.pos >= 0) {
+				c.pos = (c.pos + skipped) % seq.length;
+			}
+			c.nextEdge += skipped * c.period;
+			return;
+		}
+		uint64_t stride = noiseSpacing / c.period;
+		while(c.nextEdge < end) {
+			uint64_t steps = stride > 1 ? stride : seq.runs[c.pos];
+			// Checked by division first: with the LFSR stopped the period is
+			// NEVER / 2 and the product would wrap.
+			bool past = steps - 1 > (end - c.nextEdge) / c.period;
+			uint64_t edge = past ? end : c.nextEdge + (steps - 1) * c.period;
+			if(edge >= end) {
+				uint64_t skipped = (end - c.nextEdge + c.period - 1) / c.period;
+				c.pos = (c.pos + skipped) % seq.length;
+				c.nextEdge += skipped * c.period;
+				break;
+			}
+			c.pos = (c.pos + steps) % seq.length;
+			setAmplitude(CHANNEL_NOISE, edge, output(CHANNEL_NOISE));
+			c.nextEdge = edge + c.period;
+		}
+		if(stride > 1) {
+			setAmplitude(CHANNEL_NOISE, c.nextEdge - c.period, output(CHANNEL_NOISE));
+		}
+	}
+
+	// Keeps the LFSR state when bit 3 of NR43 switches sequences.
+	void Apu::setNoiseWidth(bool narrow) {
+		Channel &c = channels[CHANNEL_NOISE];
+		if(narrow != narrowLfsr && c.pos >= 0) {
+			uint16_t state = noiseSequence(narrowLfsr).states[c.pos];
+			c.pos = narrow ? noiseSequence(true).positions[state & 0x7F] : noiseSequence(false).positions[state];
+		}
+		narrowLfsr = narrow;
+	}
+
+	// 512 Hz: length on even steps, sweep on 2 and 6, envelopes on 7.
+	void Apu::clockSequencer() {
+		if(!(sequencerStep & 1)) {
+			for(int ch = 0; ch < APU_CHANNELS; ch++) {
+				Channel &c = channels[ch];
+				if(c.lengthEnable && c.length > 0 && --c.length == 0) {
+					disable(ch);
+				}
+			}
+		}
+		if(sequencerStep == 2 || sequencerStep == 6) {
+			clockSweep();
+		}
+		if(sequencerStep == 7) {
+			for(int ch : {CHANNEL_PULSE1, CHANNEL_PULSE2, CHANNEL_NOISE}) {
+				Channel &c = channels[ch];
+				if(c.envPeriod == 0 || --c.envTimer > 0) {
+					continue;
+				}
+				c.envTimer = c.envPeriod;
+				if(c.envUp ? c.volume < 15 : c.volume > 0) {
+					c.volume += c.envUp ? 1 : -1;
+					setAmplitude(ch, time, output(ch));
+				}
+			}
+		}
+		sequencerStep = (sequencerStep + 1) & 7;
+	}
+
+	void Apu::clockSweep() {
+		if(--sweepTimer > 0) {
+			return;
+		}
+		sweepTimer = sweepPeriod ? sweepPeriod : 8;
+		if(!sweepEnabled || !sweepPeriod) {
+			return;
+		}
+		int freq = sweepTarget();
+		if(freq <= 2047 && sweepShift) {
+			shadowFreq = freq;
+			io->set(REG_NR13, freq & 0xFF);
+			io->set(REG_NR14, (io->get(REG_NR14) & ~7) | (freq >> 8));
+			setFrequency(CHANNEL_PULSE1);
+			sweepTarget();
+		}
+	}
+
+	// Disables channel 1 when the next frequency would overflow.
+	int Apu::sweepTarget() {
+		int delta = shadowFreq >> sweepShift;
+		int freq = sweepNegate ? shadowFreq - delta : shadowFreq + delta;
+		if(freq > 2047) {
+			disable(CHANNEL_PULSE1);
+		}
+		return freq;
+	}
+
+	void Apu::trigger(int ch) {
+		Channel &c = channels[ch];
+		c.enabled = c.dac;
+		if(c.length == 0) {
+			c.length = ch == CHANNEL_WAVE ? 256 : 64;
+		}
+		c.nextEdge = time + c.period;
+		if(ch == CHANNEL_WAVE) {
+			c.pos = 0;
+		} else {
+			uint8_t env = io->get(ch == CHANNEL_NOISE ? REG_NR42 : ch == CHANNEL_PULSE1 ? REG_NR12 : REG_NR22);
+			c.volume = env >> 4;
+			c.envUp = env & 0x08;
+			c.envPeriod = env & 7;
+			c.envTimer = c.envPeriod;
+		}
+		if(ch == CHANNEL_NOISE) {
+			c.pos = 0;
+		}
+		if(ch == CHANNEL_PULSE1) {
+			shadowFreq = c.freq;
+			sweepTimer = sweepPeriod ? sweepPeriod : 8;
+			sweepEnabled = sweepPeriod || sweepShift;
+			if(sweepShift) {
+				sweepTarget();
+			}
+		}
+		setAmplitude(ch, time, output(ch));
+		updateStatus();
+	}
+
+	void Apu::disable(int ch) {
+		channels[ch].enabled = false;
+		setAmplitude(ch, time, 0);
+		updateStatus();
+	}
+
+	// Period changes take effect from the next waveform step.
+	void Apu::setFrequency(int ch) {
+		Channel &c = channels[ch];
+		if(ch == CHANNEL_NOISE) {
+			uint8_t nr43 = io->get(REG_NR43);
+			int shift = nr43 >> 4;
+			// Shifts 14 and 15 stop the LFSR.
+			c.period = shift >= 14 ? NEVER / 2 : static_cast<uint64_t>(NOISE_DIVISORS[nr43 & 7]) << shift;
+			return;
+		}
+		int lo = ch == CHANNEL_PULSE1 ? REG_NR13 : ch == CHANNEL_PULSE2 ? REG_NR23 : REG_NR33;
+		c.freq = io->get(lo) | ((io->get(lo + 1) & 7) << 8);
+		c.period = (2048 - c.freq) * (ch == CHANNEL_WAVE ? 2 : 4);
+	}
+
+	int Apu::output(int ch) const {
+		const Channel &c = channels[ch];
+		if(!c.enabled) {
+			return 0;
+		}
+		switch(ch) {
+		case CHANNEL_WAVE: {
+			uint8_t byte = io->get(REG_WAVE + (c.pos >> 1));
+			return ((c.pos & 1) ? byte & 0x0F : byte >> 4) >> waveShift;
+		}
+		case CHANNEL_NOISE:
+			return c.pos < 0 || (~noiseSequence(narrowLfsr).states[c.pos] & 1) ? c.volume : 0;
+		default:
+			return dutyBit(c.duty, c.pos) ? c.volume : 0;
+		}
+	}
+
+	void Apu::setAmplitude(int ch, uint64_t when, int amp) {
+		if(channels[ch].amplitude == amp) {
+			return;
+		}
+		channels[ch].amplitude = amp;
+		if(!stems.empty() && !muted) {
+			stems[ch].addDelta(when - frameStart, (amp - stemLevels[ch]) * STEM_SCALE);
+			stemLevels[ch] = amp;
+		}
+		updateMix(when);
+	}
+
+	void Apu::updateStems(uint64_t when) {
+		for(int ch = 0; ch < static_cast<int>(stems.size()); ch++) {
+			stems[ch].addDelta(when - frameStart, (channels[ch].amplitude - stemLevels[ch]) * STEM_SCALE);
+			stemLevels[ch] = channels[ch].amplitude;
+		}
+	}
+
+	void Apu::setMuted(bool muted) {
+		this->muted = muted;
+		if(!muted) {
+			updateMix(time);
+			updateStems(time);
+		}
+	}
+
+	// Recomputes both outputs from NR50/NR51 and adds the change as a step.
+	void Apu::updateMix(uint64_t when) {
+		if(muted) {
+			return;
+		}
+		uint8_t panning = io->get(REG_NR51);
+		uint8_t volume = io->get(REG_NR50);
+		int l = 0;
+		int r = 0;
+		for(int ch = 0; ch < APU_CHANNELS; ch++) {
+			if(panning & (0x10 << ch)) {
+				l += channels[ch].amplitude;
+			}
+			if(panning & (1 << ch)) {
+				r += channels[ch].amplitude;
+			}
+		}
+		l *= (((volume >> 4) & 7) + 1) * AMP_SCALE;
+		r *= ((volume & 7) + 1) * AMP_SCALE;
+		if(l != mixLeft) {
+			left.addDelta(when - frameStart, l - mixLeft);
+			mixLeft = l;
+		}
+		if(r != mixRight) {
+			right.addDelta(when - frameStart, r - mixRight);
+			mixRight = r;
+		}
+	}
+
+	void Apu::updateStatus() {
+		uint8_t status = power ? 0xF0 : 0x70;
+		for(int ch = 0; ch < APU_CHANNELS; ch++) {
+			if(channels[ch].enabled) {
+				status |= 1 << ch;
+			}
+		}
+		io->set(REG_NR52, status);
+	}
+
+	void Apu::powerOff() {
+		for(int ch = 0; ch < APU_CHANNELS; ch++) {
+			disable(ch);
+			channels[ch].dac = false;
+			channels[ch].lengthEnable = false;
+		}
+		for(int reg = REG_NR10; reg < REG_NR52; reg++) {
+			io->set(reg, 0);
+		}
+		updateMix(time);
+	}
+
+	void Apu::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_APU);
+		if(!out) {
+			return;
+		}
+		memcpy(out->channels, channels, sizeof(channels));
+		out->power = power;
+		out->time = time;
+		out->nextSequencer = nextSequencer;
+		out->sequencerStep = sequencerStep;
+		out->sweepPeriod = sweepPeriod;
+		out->sweepTimer = sweepTimer;
+		out->sweepShift = sweepShift;
+		out->sweepNegate = sweepNegate;
+		out->sweepEnabled = sweepEnabled;
+		out->shadowFreq = shadowFreq;
+		out->waveShift = waveShift;
+		out->narrowLfsr = narrowLfsr;
+	}
+
+	// Closes the buffered frame at the old time, then restarts it at the
+	// restored time with a step from the old level to the new one. While
+	// muted nothing was buffered since the last flush, so there is nothing
+	// to close and unmuting adds the step.
+	bool Apu::loadState(const StateReader &state) {
+		const State *in = static_cast<const State*>(state.section(STATE_APU, sizeof(State)));
+		if(!in) {
+			return false;
+		}
+		if(!muted) {
+			left.endFrame(time - frameStart);
+			right.endFrame(time - frameStart);
+			for(BlipBuffer &stem : stems) {
+				stem.endFrame(time - frameStart);
+			}
+		}
+		memcpy(channels, in->channels, sizeof(channels));
+		power = in->power;
+		time = in->time;
+		frameStart = time;
+		nextSequencer = in->nextSequencer;
+		sequencerStep = in->sequencerStep;
+		sweepPeriod = in->sweepPeriod;
+		sweepTimer = in->sweepTimer;
+		sweepShift = in->sweepShift;
+		sweepNegate = in->sweepNegate;
+		sweepEnabled = in->sweepEnabled;
+		shadowFreq = in->shadowFreq;
+		waveShift = in->waveShift;
+		narrowLfsr = in->narrowLfsr;
+		// Follows the host output rate, so it is not part of the state.
+		noiseSpacing = APU_CLOCK_RATE / sampleRate;
+		if(!muted) {
+			updateMix(time);
+			updateStems(time);
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "audio-capture.h"
+#include "blip-buffer.h"
+#include "memory-map.h"
+#include "resampler.h"
+#include "save-state.h"
+#include "ring-buffer.h"
+#include "scheduler.h"
+
+#include <cstdint>
+#include <vector>
+
+// Scheduler time runs at the single-speed T-cycle rate.
+#define APU_CLOCK_RATE 4194304
+#define APU_SAMPLE_RATE 48000
+#define APU_CHANNELS 4
+#define FRAME_SEQUENCER_PERIOD 8192
+#define WAVE_RAM_SIZE 16
+
+namespace gbemulator {
+
+enum ApuChannel {
+	CHANNEL_PULSE1 = 0,
+	CHANNEL_PULSE2,
+	CHANNEL_WAVE,
+	CHANNEL_NOISE
+};
+
+// Two pulse channels, the wave channel and the noise channel. Nothing runs
+// per cycle: the channels are brought up to date only when an NRxx register
+// or wave RAM is written or the host asks for samples, and then only the
+// points where a channel's output level changes are visited. Each change is
+// recorded as a timestamped step in a pair of band-limited buffers.
+class Apu {
+public:
+	Apu(MemoryMap *memory, Scheduler *scheduler);
+	void setSampleRate(int rate);
+	// Synthesizes up to the current time and returns the number of stereo
+	// frames ready to read.
+	int endFrame();
+	// Reads interleaved stereo samples, synthesizing up to now first.
+	int readSamples(int16_t *out, int frames);
+	// Routes output through a ring read by another thread. flush() moves
+	// everything synthesized so far into it; the ring owner picks how its
+	// consumer handles underruns.
+	void setOutput(AudioRing *output) { ring = output; }
+	// Optionally converts flushed audio from the sample rate to the host's.
+	void setResampler(Resampler *resampler) { this->resampler = resampler; }
+	// Copies everything read from the APU, at the APU sample rate, to a
+	// capture sink. Attach before running so the stems line up with the mix.
+	void setCapture(AudioCapture *capture);
+	void flush();
+	int getAmplitude(ApuChannel ch) const { return channels[ch].amplitude; }
+	// While muted the channels run as usual but add nothing to the output
+	// buffers, and endFrame()/flush() must not be called. Unmuting steps the
+	// output to the channels' current level. Used for frames that will be
+	// rolled back, such as run-ahead.
+	void setMuted(bool muted);
+	// Channel and sequencer state. Audio already synthesized stays queued;
+	// loading steps the output to the restored level from there on.
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	struct Channel {
+		bool enabled;
+		bool dac;
+		bool lengthEnable;
+		int length;
+		int volume;
+		int envPeriod;
+		int envTimer;
+		bool envUp;
+		int freq;
+		int duty;
+		int pos;
+		uint64_t period;
+		uint64_t nextEdge;
+		int amplitude;
+	};
+
+	struct State {
+		Channel channels[APU_CHANNELS];
+		bool power;
+		uint64_t time;
+		uint64_t nextSequencer;
+		int sequencerStep;
+		int sweepPeriod;
+		int sweepTimer;
+		int sweepShift;
+		bool sweepNegate;
+		bool sweepEnabled;
+		int shadowFreq;
+		int waveShift;
+		bool narrowLfsr;
+	};
+
+	void write(int reg, uint8_t val);
+	void sync(uint64_t now);
+	void runPulse(int ch, uint64_t end);
+	void runWave(uint64_t end);
+	void runNoise(uint64_t end);
+	void setNoiseWidth(bool narrow);
+	void clockSequencer();
+	void clockSweep();
+	int sweepTarget();
+	void trigger(int ch);
+	void disable(int ch);
+	void setFrequency(int ch);
+	int output(int ch) const;
+	void setAmplitude(int ch, uint64_t when, int amp);
+	void updateMix(uint64_t when);
+	void updateStems(uint64_t when);
+	void updateStatus();
+	void powerOff();
+
+	RegisterMap *io;
+	Scheduler *scheduler;
+	AudioRing *ring;
+	Resampler *resampler;
+	AudioCapture *capture;
+	int sampleRate;
+	BlipBuffer left;
+	BlipBuffer right;
+	// One mono buffer per channel while capturing stems.
+	std::vector<BlipBuffer> stems;
+	Channel channels[APU_CHANNELS];
+	bool power;
+	uint64_t time;
+	uint64_t frameStart;
+	uint64_t nextSequencer;
+	int sequencerStep;
+	// Levels last written to the output buffers.
+	int mixLeft;
+	int mixRight;
+	int stemLevels[APU_CHANNELS];
+	bool muted;
+	int sweepPeriod;
+	int sweepTimer;
+	int sweepShift;
+	bool sweepNegate;
+	bool sweepEnabled;
+	int shadowFreq;
+	int waveShift;
+	bool narrowLfsr;
+	uint64_t noiseSpacing;
+};
+
+}
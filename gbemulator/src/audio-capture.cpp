@@ -0,0 +1,145 @@
+#include "audio-capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define WAV_HEADER_SIZE 44
+
+namespace gbemulator {
+
+	static const char *STEM_NAMES[] = {"pulse1", "pulse2", "wave", "noise"};
+
+	// "dir/run.wav" + "noise" -> "dir/run.noise.wav".
+	static std::string stemPath(const std::string &path, const char *name) {
+		size_t slash = path.find_last_of('/');
+		size_t dot = path.find_last_of('.');
+		if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			return path + "." + name;
+		}
+		return path.substr(0, dot) + "." + name + path.substr(dot);
+	}
+
+	static void put16(uint8_t *p, uint16_t v) {
+		p[0] = v;
+		p[1] = v >> 8;
+	}
+
+	static void put32(uint8_t *p, uint32_t v) {
+		put16(p, v);
+		put16(p + 2, v >> 16);
+	}
+
+	AudioCapture::AudioCapture(const std::string &path, AudioFileFormat format, int sampleRate, bool stems) :
+			format(format), sampleRate(sampleRate), open(true), stopping(false) {
+		addStream(path, 2);
+		if(stems) {
+			for(const char *name : STEM_NAMES) {
+				addStream(stemPath(path, name), 1);
+			}
+		}
+		if(!open) {
+			return;
+		}
+		writer = std::thread([this]() { run(); });
+	}
+
+	AudioCapture::~AudioCapture() {
+		close();
+	}
+
+	void AudioCapture::addStream(const std::string &path, int channels) {
+		FILE *file = fopen(path.c_str(), "wb");
+		if(!file) {
+			open = false;
+		}
+		streams.emplace_back(new Stream(file, channels));
+		if(file && format == AUDIO_WAV) {
+			writeHeader(streams.back().get(), 0);
+		}
+	}
+
+	AudioRing *AudioCapture::getStemRing(int channel) {
+		return hasStems() ? &streams[channel + 1]->ring : nullptr;
+	}
+
+	// Written with zero sizes when the file is opened and patched on close.
+	void AudioCapture::writeHeader(Stream *stream, uint32_t dataBytes) {
+		uint8_t header[WAV_HEADER_SIZE];
+		memcpy(header, "RIFF", 4);
+		put32(header + 4, WAV_HEADER_SIZE - 8 + dataBytes);
+		memcpy(header + 8, "WAVEfmt ", 8);
+		put32(header + 16, 16);
+		put16(header + 20, 1);
+		put16(header + 22, stream->channels);
+		put32(header + 24, sampleRate);
+		put32(header + 28, sampleRate * stream->channels * 2);
+		put16(header + 32, stream->channels * 2);
+		put16(header + 34, 16);
+		memcpy(header + 36, "data", 4);
+		put32(header + 40, dataBytes);
+		fseek(stream->file, 0, SEEK_SET);
+		fwrite(header, 1, WAV_HEADER_SIZE, stream->file);
+	}
+
+	// Waits for a full batch per stream so the disk sees few large writes;
+	// once closing, drains whatever is left.
+	void AudioCapture::run() {
+		std::vector<int16_t> batch(CAPTURE_BATCH_SAMPLES);
+		for(;;) {
+			bool closing = stopping.load(std::memory_order_acquire);
+			bool wrote = false;
+			for(auto &stream : streams) {
+				size_t ready = stream->ring.available();
+				if(ready < CAPTURE_BATCH_SAMPLES && !(closing && ready > 0)) {
+					continue;
+				}
+				size_t count = stream->ring.read(batch.data(), std::min(ready, batch.size()), RING_BLOCK);
+				fwrite(batch.data(), sizeof(int16_t), count, stream->file);
+				stream->bytes += count * sizeof(int16_t);
+				wrote = true;
+			}
+			if(closing && !wrote) {
+				break;
+			}
+			if(!wrote) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_POLL_MS));
+			}
+		}
+	}
+
+	void AudioCapture::close() {
+		if(writer.joinable()) {
+			stopping.store(true, std::memory_order_release);
+			writer.join();
+		}
+		for(auto &stream : streams) {
+			if(!stream->file) {
+				continue;
+			}
+			if(format == AUDIO_WAV) {
+				writeHeader(stream.get(), stream->bytes);
+			}
+			fclose(stream->file);
+			stream->file = nullptr;
+		}
+		open = false;
+	}
+
+	uint64_t AudioCapture::getBytesWritten() const {
+		uint64_t total = 0;
+		for(auto &stream : streams) {
+			total += stream->bytes;
+		}
+		return total;
+	}
+
+	uint64_t AudioCapture::getDropped() const {
+		uint64_t total = 0;
+		for(auto &stream : streams) {
+			total += stream->ring.getOverflows();
+		}
+		return total;
+	}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ring-buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_RING_SAMPLES (1 << 18)
+// Samples gathered per stream before a write, 64 KB.
+#define CAPTURE_BATCH_SAMPLES (1 << 15)
+#define CAPTURE_POLL_MS 10
+
+namespace gbemulator {
+
+enum AudioFileFormat {
+	AUDIO_WAV,
+	// Headerless signed 16-bit little-endian PCM.
+	AUDIO_RAW
+};
+
+// Writes APU output to disk from a background thread. The emulation side
+// only queues samples into lock-free rings, so a slow disk costs dropped
+// samples (counted by getDropped()) rather than emulation stalls. With stems
+// enabled each channel is also written on its own as mono, next to the mix:
+// "run.wav" gets "run.pulse1.wav", "run.pulse2.wav", "run.wave.wav" and
+// "run.noise.wav".
+class AudioCapture {
+public:
+	AudioCapture(const std::string &path, AudioFileFormat format, int sampleRate, bool stems = false);
+	~AudioCapture();
+	AudioCapture(const AudioCapture&) = delete;
+	AudioCapture &operator=(const AudioCapture&) = delete;
+
+	bool isOpen() const { return open; }
+	bool hasStems() const { return streams.size() > 1; }
+	// Interleaved stereo mix.
+	AudioRing *getRing() { return &streams[0]->ring; }
+	// Mono output of one channel, or nullptr without stems.
+	AudioRing *getStemRing(int channel);
+	// Drains the rings, finishes the files and patches the WAV headers.
+	void close();
+	uint64_t getBytesWritten() const;
+	uint64_t getDropped() const;
+
+private:
+	struct Stream {
+		Stream(FILE *file, int channels) : file(file), channels(channels), bytes(0), ring(CAPTURE_RING_SAMPLES) {}
+		FILE *file;
+		int channels;
+		std::atomic<uint64_t> bytes;
+		AudioRing ring;
+	};
+
+	void addStream(const std::string &path, int channels);
+	void writeHeader(Stream *stream, uint32_t dataBytes);
+	void run();
+
+	AudioFileFormat format;
+	int sampleRate;
+	bool open;
+	std::atomic<bool> stopping;
+	std::vector<std::unique_ptr<Stream>> streams;
+	std::thread writer;
+};
+
+}
@@ -0,0 +1,106 @@
+#include "blip-buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Removes DC: the integrator leaks 1/2^BASS_SHIFT of its value per sample.
+#define BASS_SHIFT 9
+#define CUTOFF 0.9
+
+namespace gbemulator {
+
+	struct BlipKernel {
+		int16_t taps[BLIP_PHASES][BLIP_TAPS];
+
+		BlipKernel() {
+			const double pi = 3.14159265358979323846;
+			for(int p = 0; p < BLIP_PHASES; p++) {
+				double frac = static_cast<double>(p) / BLIP_PHASES;
+				double weights[BLIP_TAPS];
+				double sum = 0;
+				for(int k = 0; k < BLIP_TAPS; k++) {
+					double x = k - (BLIP_TAPS / 2 - 1) - frac;
+					double sinc = x == 0 ? 1.0 : std::sin(pi * CUTOFF * x) / (pi * CUTOFF * x);
+					double window = 0.5 + 0.5 * std::cos(pi * x / (BLIP_TAPS / 2));
+					weights[k] = sinc * window;
+					sum += weights[k];
+				}
+				// Every phase sums to exactly one so steps settle at the right level.
+				int total = 0;
+				for(int k = 0; k < BLIP_TAPS; k++) {
+					taps[p][k] = static_cast<int16_t>(std::lround(weights[k] / sum * (1 << BLIP_KERNEL_BITS)));
+					total += taps[p][k];
+				}
+				taps[p][BLIP_TAPS / 2 - 1] += (1 << BLIP_KERNEL_BITS) - total;
+			}
+		}
+	};
+
+	static const BlipKernel kernel;
+
+	BlipBuffer::BlipBuffer(int capacity) : factor(0), offset(0), available(0), written(0), integrator(0),
+			buffer(capacity + BLIP_TAPS, 0) {}
+
+	void BlipBuffer::setRates(double clockRate, double sampleRate) {
+		factor = static_cast<uint64_t>(sampleRate / clockRate * (1ull << BLIP_FRAC_BITS));
+	}
+
+	void BlipBuffer::addDelta(uint64_t time, int delta) {
+		uint64_t fixed = time * factor + offset;
+		uint64_t pos = fixed >> BLIP_FRAC_BITS;
+		if(pos + BLIP_TAPS > buffer.size()) {
+			return;
+		}
+		int phase = (fixed >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+		int32_t *out = buffer.data() + pos;
+		const int16_t *taps = kernel.taps[phase];
+		for(int k = 0; k < BLIP_TAPS; k++) {
+			out[k] += taps[k] * delta;
+		}
+		written = std::max(written, static_cast<int>(pos + BLIP_TAPS));
+	}
+
+	void BlipBuffer::endFrame(uint64_t time) {
+		offset += time * factor;
+		uint64_t limit = static_cast<uint64_t>(buffer.size() - BLIP_TAPS) << BLIP_FRAC_BITS;
+		if(offset > limit) {
+			offset = limit;
+		}
+		available = offset >> BLIP_FRAC_BITS;
+	}
+
+	// Only the entries that can be nonzero are moved and cleared, so a read
+	// costs what it returns rather than the buffer's capacity.
+	int BlipBuffer::readSamples(int16_t *out, int count, int stride) {
+		count = std::min(count, available);
+		if(count <= 0) {
+			return 0;
+		}
+		int32_t sum = integrator;
+		for(int i = 0; i < count; i++) {
+			int32_t s = sum >> BLIP_KERNEL_BITS;
+			sum += buffer[i];
+			s = std::max(-32768, std::min(32767, s));
+			out[i * stride] = s;
+			sum -= s << (BLIP_KERNEL_BITS - BASS_SHIFT);
+		}
+		integrator = sum;
+		int end = std::min(static_cast<int>(buffer.size()), std::max(written, available + BLIP_TAPS));
+		memmove(buffer.data(), buffer.data() + count, (end - count) * sizeof(int32_t));
+		std::fill(buffer.begin() + end - count, buffer.begin() + end, 0);
+		written = end - count;
+		available -= count;
+		offset -= static_cast<uint64_t>(count) << BLIP_FRAC_BITS;
+		return count;
+	}
+
+	void BlipBuffer::clear() {
+		offset = 0;
+		available = 0;
+		written = 0;
+		integrator = 0;
+		std::fill(buffer.begin(), buffer.end(), 0);
+	}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_KERNEL_BITS 14
+#define BLIP_FRAC_BITS 32
+
+namespace gbemulator {
+
+// Band-limited step synthesis. Callers record amplitude changes with their
+// clock timestamps; each change adds a windowed-sinc impulse to the buffer
+// and samples come out of a running sum, so cost follows the number of
+// waveform edges rather than the input clock rate.
+class BlipBuffer {
+public:
+	BlipBuffer(int capacity = 1 << 16);
+	void setRates(double clockRate, double sampleRate);
+	// Adds an amplitude change at a time in clocks since the last endFrame().
+	// Changes past the buffer's capacity are dropped.
+	void addDelta(uint64_t time, int delta);
+	// Makes samples up to the given time available for reading.
+	void endFrame(uint64_t time);
+	int samplesAvailable() const { return available; }
+	// Reads mono samples, writing every stride-th element of out.
+	int readSamples(int16_t *out, int count, int stride = 1);
+	void clear();
+
+private:
+	uint64_t factor;
+	uint64_t offset;
+	int available;
+	// Entries from here on are zero.
+	int written;
+	int32_t integrator;
+	std::vector<int32_t> buffer;
+};
+
+}
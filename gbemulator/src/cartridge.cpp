@@ -0,0 +1,158 @@
+#include "cartridge.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define PAGE_BLOCKS (PAGE_SIZE / DIRTY_BLOCK_SIZE)
+
+namespace gbemulator {
+
+	static const size_t RAM_SIZES[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+	struct OpenBusPage {
+		uint8_t bytes[PAGE_SIZE];
+		OpenBusPage() { memset(bytes, 0xFF, sizeof(bytes)); }
+	};
+
+	static const OpenBusPage openBusPage;
+	static const uint8_t *OPEN_BUS = openBusPage.bytes;
+
+	Cartridge::Cartridge() : rom(nullptr), romBanks(0), type(MBC_NONE), memory(nullptr), banks() {}
+
+	bool Cartridge::load(const uint8_t *rom, size_t size) {
+		if(size < ROM_END) {
+			return false;
+		}
+		uint8_t kind = rom[CART_TYPE];
+		if(kind == 0x00 || kind == 0x08 || kind == 0x09) {
+			type = MBC_NONE;
+		} else if(kind >= 0x01 && kind <= 0x03) {
+			type = MBC_1;
+		} else if(kind >= 0x0F && kind <= 0x13) {
+			type = MBC_3;
+		} else if(kind >= 0x19 && kind <= 0x1E) {
+			type = MBC_5;
+		} else {
+			return false;
+		}
+		this->rom = rom;
+		romBanks = size / ROM_BANK_SIZE;
+		uint8_t ramSize = rom[CART_RAM_SIZE];
+		size_t ramBytes = ramSize < 6 ? RAM_SIZES[ramSize] : 0;
+		// 2 KB carts get a full bank so every mapped page is backed.
+		ram.assign(ramBytes ? std::max(ramBytes, static_cast<size_t>(CART_RAM_BANK_SIZE)) : 0, 0xFF);
+		banks = Banks();
+		banks.romBank = 1;
+		if(memory) {
+			memory->setCartridge(this);
+			remap();
+			memory->markAllDirty();
+		}
+		return true;
+	}
+
+	// Until a ROM is loaded the memory map keeps its plain RAM.
+	void Cartridge::attach(MemoryMap *memory) {
+		this->memory = memory;
+		if(rom) {
+			memory->setCartridge(this);
+			remap();
+		}
+	}
+
+	void Cartridge::control(uint16_t addr, uint8_t val) {
+		switch(type) {
+		case MBC_NONE:
+			return;
+		case MBC_1:
+			if(addr < 0x2000) {
+				banks.ramEnabled = (val & 0x0F) == 0x0A;
+			} else if(addr < 0x4000) {
+				banks.romBank = (val & 0x1F) ? val & 0x1F : 1;
+			} else if(addr < 0x6000) {
+				banks.upper = val & 3;
+			} else {
+				banks.advanced = val & 1;
+			}
+			break;
+		case MBC_3:
+			if(addr < 0x2000) {
+				banks.ramEnabled = (val & 0x0F) == 0x0A;
+			} else if(addr < 0x4000) {
+				banks.romBank = (val & 0x7F) ? val & 0x7F : 1;
+			} else if(addr < 0x6000) {
+				banks.ramBank = val & 3;
+			}
+			break;
+		case MBC_5:
+			if(addr < 0x2000) {
+				banks.ramEnabled = (val & 0x0F) == 0x0A;
+			} else if(addr < 0x3000) {
+				banks.romBank = (banks.romBank & 0x100) | val;
+			} else if(addr < 0x4000) {
+				banks.romBank = (banks.romBank & 0xFF) | ((val & 1) << 8);
+			} else if(addr < 0x6000) {
+				banks.ramBank = val & 0x0F;
+			}
+			break;
+		}
+		remap();
+	}
+
+	// MBC1's upper bits extend the ROM bank, or in advanced mode also select
+	// the RAM bank and the bank seen at 0x0000.
+	void Cartridge::remap() {
+		size_t low = 0;
+		size_t high = banks.romBank;
+		size_t ramBank = banks.ramBank;
+		if(type == MBC_1) {
+			high |= banks.upper << 5;
+			if(banks.advanced) {
+				low = banks.upper << 5;
+				ramBank = banks.upper;
+			} else {
+				ramBank = 0;
+			}
+		}
+		low %= romBanks;
+		high %= romBanks;
+		uint8_t *romBase = const_cast<uint8_t*>(rom);
+		// ROM pages are never written; their blocks only keep the table whole.
+		for(int i = 0; i < ROM_BANK_SIZE / PAGE_SIZE; i++) {
+			int page = ROM_BANK_SIZE / PAGE_SIZE + i;
+			memory->mapPage(i, romBase + low * ROM_BANK_SIZE + i * PAGE_SIZE, DIRTY_FLAT_BLOCK + i * PAGE_BLOCKS);
+			memory->mapPage(page, romBase + high * ROM_BANK_SIZE + i * PAGE_SIZE, DIRTY_FLAT_BLOCK + page * PAGE_BLOCKS);
+		}
+		// Disabled or missing RAM reads as 0xFF; MemoryMap drops the writes.
+		size_t offset = ram.empty() ? 0 : (ramBank * CART_RAM_BANK_SIZE) % ram.size();
+		for(int i = 0; i < CART_RAM_BANK_SIZE / PAGE_SIZE; i++) {
+			size_t start = offset + i * PAGE_SIZE;
+			uint8_t *page = isRamEnabled() ? ram.data() + start : const_cast<uint8_t*>(OPEN_BUS);
+			memory->mapPage((CART_RAM_START >> PAGE_SHIFT) + i, page, DIRTY_CART_BLOCK + start / DIRTY_BLOCK_SIZE);
+		}
+	}
+
+	void Cartridge::saveState(StateWriter &state) const {
+		Banks *out = state.section<Banks>(STATE_CARTRIDGE);
+		if(out) {
+			out->romBank = banks.romBank;
+			out->ramBank = banks.ramBank;
+			out->upper = banks.upper;
+			out->ramEnabled = banks.ramEnabled;
+			out->advanced = banks.advanced;
+		}
+		state.put(STATE_CARTRIDGE_RAM, ram.data(), ram.size());
+	}
+
+	bool Cartridge::loadState(const StateReader &state) {
+		if(!state.get(STATE_CARTRIDGE, banks) ||
+				(!state.isSkipped(STATE_CARTRIDGE_RAM) && !state.get(STATE_CARTRIDGE_RAM, ram.data(), ram.size()))) {
+			return false;
+		}
+		if(rom && memory) {
+			remap();
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "memory-map.h"
+#include "save-state.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define ROM_BANK_SIZE 0x4000
+#define ROM_END 0x8000
+#define CART_RAM_START 0xA000
+#define CART_RAM_END 0xC000
+#define CART_RAM_BANK_SIZE 0x2000
+#define CART_TYPE 0x147
+#define CART_ROM_SIZE 0x148
+#define CART_RAM_SIZE 0x149
+
+namespace gbemulator {
+
+enum MbcType {
+	MBC_NONE = 0,
+	MBC_1,
+	MBC_3,
+	MBC_5
+};
+
+// Cartridge ROM and its memory bank controller. The ROM is referenced, not
+// copied or owned, and must outlive the cartridge; external RAM belongs to
+// the cartridge. Bank switches remap MemoryMap pages, so reads never go
+// through the controller. MBC3's clock registers are not modelled.
+class Cartridge {
+public:
+	Cartridge();
+	// Returns false if the ROM is too small or of an unsupported type.
+	bool load(const uint8_t *rom, size_t size);
+	void attach(MemoryMap *memory);
+	bool isLoaded() const { return rom; }
+	const uint8_t *getRom() const { return rom; }
+	size_t getRomSize() const { return romBanks * ROM_BANK_SIZE; }
+	MbcType getType() const { return type; }
+	// Writes to 0x0000-0x7FFF.
+	void control(uint16_t addr, uint8_t val);
+	bool isRamEnabled() const { return banks.ramEnabled && !ram.empty(); }
+	uint8_t *getRam() { return ram.data(); }
+	size_t getRamSize() const { return ram.size(); }
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	struct Banks {
+		int romBank;
+		int ramBank;
+		int upper;
+		bool ramEnabled;
+		bool advanced;
+	};
+
+	void remap();
+
+	const uint8_t *rom;
+	size_t romBanks;
+	MbcType type;
+	MemoryMap *memory;
+	Banks banks;
+	std::vector<uint8_t> ram;
+};
+
+}
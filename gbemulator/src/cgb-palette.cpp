@@ -0,0 +1,62 @@
+#include "cgb-palette.h"
+
+namespace gbemulator {
+
+	CgbPalette::CgbPalette(RegisterMap *io) : io(io), profile(COLOR_RAW), lut(colorLut(COLOR_RAW)) {
+		for(int i = 0; i < PALETTE_RAM_SIZE; i++) {
+			ram[0][i] = 0xFF;
+			ram[1][i] = 0xFF;
+		}
+		for(int i = 0; i < PALETTE_COLORS; i++) {
+			colors[i] = 0x7FFF;
+			hostColors[i] = lut[0x7FFF];
+		}
+		io->onWrite(REG_BCPS, [this](uint8_t val) { writeSpec(REG_BCPS, val); });
+		io->onWrite(REG_OCPS, [this](uint8_t val) { writeSpec(REG_OCPS, val); });
+		io->onWrite(REG_BCPD, [this](uint8_t val) { writeData(REG_BCPS, val); });
+		io->onWrite(REG_OCPD, [this](uint8_t val) { writeData(REG_OCPS, val); });
+	}
+
+	void CgbPalette::setProfile(ColorProfile profile) {
+		this->profile = profile;
+		lut = colorLut(profile);
+		for(int i = 0; i < PALETTE_COLORS; i++) {
+			hostColors[i] = lut[colors[i]];
+		}
+	}
+
+	bool CgbPalette::loadState(const StateReader &state) {
+		if(!state.get(STATE_PALETTE, ram, sizeof(ram))) {
+			return false;
+		}
+		for(int i = 0; i < PALETTE_COLORS; i++) {
+			const uint8_t *pair = &ram[i / OBJ_PALETTE_BASE][(i % OBJ_PALETTE_BASE) * 2];
+			colors[i] = (pair[0] | (pair[1] << 8)) & 0x7FFF;
+			hostColors[i] = lut[colors[i]];
+		}
+		return true;
+	}
+
+	// The data register always reads back the byte at the current index.
+	void CgbPalette::writeSpec(int specReg, uint8_t val) {
+		int bank = specReg == REG_OCPS;
+		io->set(specReg, val | 0x40);
+		io->set(specReg + 1, ram[bank][val & 0x3F]);
+	}
+
+	void CgbPalette::writeData(int specReg, uint8_t val) {
+		int bank = specReg == REG_OCPS;
+		uint8_t spec = io->get(specReg);
+		int index = spec & 0x3F;
+		ram[bank][index] = val;
+		int entry = bank * OBJ_PALETTE_BASE + index / 2;
+		uint8_t *pair = &ram[bank][index & ~1];
+		colors[entry] = (pair[0] | (pair[1] << 8)) & 0x7FFF;
+		hostColors[entry] = lut[colors[entry]];
+		if(spec & 0x80) {
+			spec = (spec & 0x80) | ((index + 1) & 0x3F);
+		}
+		writeSpec(specReg, spec);
+	}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include "color-correction.h"
+#include "register-map.h"
+#include "save-state.h"
+
+#define PALETTE_RAM_SIZE 64
+#define PALETTE_COLORS 64
+#define OBJ_PALETTE_BASE 32
+
+namespace gbemulator {
+
+// CGB palette RAM behind BCPS/BCPD (0xFF68/9) and OCPS/OCPD (0xFF6A/B).
+// Every data write refreshes one entry of a 64 color cache, both as raw
+// BGR555 and as a corrected host color, so rendering never decodes palette
+// RAM or corrects colors per pixel. Entries 0-31 are background colors,
+// 32-63 object colors; index = palette * 4 + color.
+class CgbPalette {
+public:
+	CgbPalette(RegisterMap *io);
+	uint16_t color(int index) const { return colors[index]; }
+	uint32_t hostColor(int index) const { return hostColors[index]; }
+	const uint32_t *getHostColors() const { return hostColors; }
+	void setProfile(ColorProfile profile);
+	ColorProfile getProfile() const { return profile; }
+	// Palette RAM only; the color caches are rebuilt on load.
+	void saveState(StateWriter &state) const { state.put(STATE_PALETTE, ram, sizeof(ram)); }
+	bool loadState(const StateReader &state);
+
+private:
+	void writeSpec(int specReg, uint8_t val);
+	void writeData(int specReg, uint8_t val);
+
+	RegisterMap *io;
+	ColorProfile profile;
+	const uint32_t *lut;
+	uint8_t ram[2][PALETTE_RAM_SIZE];
+	uint16_t colors[PALETTE_COLORS];
+	uint32_t hostColors[PALETTE_COLORS];
+};
+
+}
@@ -0,0 +1,54 @@
+#include "color-correction.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Gamma of the CGB LCD relative to an sRGB display.
+#define CGB_GAMMA (2.2 / 2.0)
+
+namespace gbemulator {
+
+	static inline uint32_t pack(int r, int g, int b) {
+		return r | (g << 8) | (b << 16) | 0xFF000000u;
+	}
+
+	static inline int gamma(int value) {
+		return static_cast<int>(std::lround(std::pow(value / 255.0, CGB_GAMMA) * 255.0));
+	}
+
+	static uint32_t correct(ColorProfile profile, uint16_t color) {
+		int r = color & 0x1F;
+		int g = (color >> 5) & 0x1F;
+		int b = (color >> 10) & 0x1F;
+		if(profile == COLOR_RAW) {
+			return pack((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2));
+		}
+		// Each output channel mixes in some of the others. The weights of each
+		// sum to 16, so white stays white after dividing by 31 * 16.
+		int mr = std::min(255, (r * 13 + g * 2 + b) * 255 / (31 * 16));
+		int mg = std::min(255, (g * 12 + b * 4) * 255 / (31 * 16));
+		int mb = std::min(255, (r * 3 + g * 2 + b * 11) * 255 / (31 * 16));
+		if(profile == COLOR_CGB_GAMMA) {
+			return pack(gamma(mr), gamma(mg), gamma(mb));
+		}
+		return pack(mr, mg, mb);
+	}
+
+	struct ColorLuts {
+		uint32_t tables[COLOR_PROFILES][BGR555_COLORS];
+
+		ColorLuts() {
+			for(int p = 0; p < COLOR_PROFILES; p++) {
+				for(int c = 0; c < BGR555_COLORS; c++) {
+					tables[p][c] = correct(static_cast<ColorProfile>(p), c);
+				}
+			}
+		}
+	};
+
+	const uint32_t *colorLut(ColorProfile profile) {
+		static const ColorLuts *luts = new ColorLuts();
+		return luts->tables[profile];
+	}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#define BGR555_COLORS 0x8000
+
+namespace gbemulator {
+
+enum ColorProfile {
+	COLOR_RAW = 0,       // Plain 5 to 8 bit expansion
+	COLOR_CGB_LCD = 1,   // Channel mixing approximating the CGB screen
+	COLOR_CGB_GAMMA = 2, // Channel mixing plus the screen's darker gamma
+	COLOR_PROFILES
+};
+
+// Returns the BGR555 to RGBA8888 table for a profile. All tables are built
+// together on first use and shared by every instance.
+const uint32_t *colorLut(ColorProfile profile);
+
+}
@@ -2,16 +2,72 @@
 
 namespace gbemulator {
 
-	Cpu::Cpu() {
-		memory = new MemoryMap();
-		instructions = new InstructionSet(&registers, memory);
+	Cpu::Cpu() : registers(), halted(false), stallCycles(0), instructions(&registers, &memory) {
+		// Post boot ROM state.
+		registers.registers16.PC = 0x0100;
+		registers.registers16.SP = 0xFFFE;
 	}
 
 	void Cpu::run() {
 		while(true) {
-			uint16_t& PC = registers.registers16.PC;
-			uint8_t opcode = memory->read8(PC++);
-			instructions->exec(opcode);
-		}		
+			step();
+		}
+	}
+
+	int Cpu::step() {
+		if(stallCycles) {
+			int cycles = stallCycles;
+			stallCycles = 0;
+			return cycles;
+		}
+		int cycles = serviceInterrupts();
+		if(cycles || halted) {
+			return cycles ? cycles : 4;
+		}
+		uint16_t& PC = registers.registers16.PC;
+		uint8_t opcode = memory.read8(PC++);
+		if(instructions.exec(opcode) == HALT) {
+			halted = true;
+		}
+		return instructions.getCycles();
+	}
+
+	int Cpu::serviceInterrupts() {
+		RegisterMap *io = memory.getRegisters();
+		uint8_t pending = io->get(REG_IE) & io->get(REG_IF) & 0x1F;
+		if(!pending) {
+			return 0;
+		}
+		halted = false;
+		if(!registers.registers16.IME) {
+			return 0;
+		}
+		int i = __builtin_ctz(pending);
+		io->set(REG_IF, io->get(REG_IF) & ~(1 << i));
+		registers.registers16.IME = false;
+		registers.registers16.SP -= 2;
+		memory.write16(registers.registers16.SP, registers.registers16.PC);
+		registers.registers16.PC = 0x40 + i * 8;
+		return 20;
+	}
+
+	void Cpu::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_CPU);
+		if(out) {
+			out->registers = registers;
+			out->halted = halted;
+			out->stallCycles = stallCycles;
+		}
+	}
+
+	bool Cpu::loadState(const StateReader &state) {
+		State cpu;
+		if(!state.get(STATE_CPU, cpu)) {
+			return false;
+		}
+		registers = cpu.registers;
+		halted = cpu.halted;
+		stallCycles = cpu.stallCycles;
+		return true;
 	}
 }
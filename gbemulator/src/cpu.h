@@ -4,19 +4,43 @@
 #include "register-map.h"
 #include "memory-map.h"
 #include "instruction-set.h"
+#include "save-state.h"
 
 namespace gbemulator {
 
 class Cpu {
 public:
 	Cpu();
+	Cpu(const Cpu&) = delete;
+	Cpu &operator=(const Cpu&) = delete;
 	void run();
+	// Executes one instruction or interrupt dispatch and returns its T-cycles.
+	int step();
 	void pause() {};
 	void resume() {};
+	// Adds cycles to the next step, for DMA that halts the CPU.
+	void stall(int cycles) { stallCycles += cycles; }
+	CpuRegisters &getRegisters() { return registers; }
+	MemoryMap *getMemory() { return &memory; }
+	const MemoryMap *getMemory() const { return &memory; }
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
 private:
+	struct State {
+		CpuRegisters registers;
+		bool halted;
+		int stallCycles;
+	};
+
+	int serviceInterrupts();
+
+	// Registers first: they and the memory map's page table are the hottest
+	// state of an instance.
 	CpuRegisters registers;
-	MemoryMap *memory;
-	InstructionSet *instructions;
+	bool halted;
+	int stallCycles;
+	MemoryMap memory;
+	InstructionSet instructions;
 };
 
 }
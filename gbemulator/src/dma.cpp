@@ -0,0 +1,130 @@
+#include "dma.h"
+
+#include <cstring>
+
+namespace gbemulator {
+
+	OamDma::OamDma(MemoryMap *memory, Scheduler *scheduler)
+			: memory(memory), scheduler(scheduler), active(false), restrictBus(false) {
+		RegisterMap *io = memory->getRegisters();
+		io->onWrite(REG_DMA, [this, io](uint8_t val) {
+			io->set(REG_DMA, val);
+			start(val);
+		});
+		scheduler->setHandler(EVENT_OAM_DMA, [this](uint64_t) { finish(); });
+	}
+
+	void OamDma::start(uint8_t page) {
+		// Sources above 0xDF00 read from WRAM through echo RAM.
+		uint16_t source = (page >= 0xE0 ? page - 0x20 : page) << 8;
+		memcpy(memory->oam(), memory->pointer(source), OAM_SIZE);
+		memory->markDirty(OAM_START, OAM_SIZE);
+		active = true;
+		memory->setDmaActive(true, restrictBus);
+		scheduler->scheduleIn(EVENT_OAM_DMA, scheduler->fromCpuCycles(OAM_DMA_CYCLES));
+	}
+
+	void OamDma::finish() {
+		active = false;
+		memory->setDmaActive(false, false);
+	}
+
+	void OamDma::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_DMA);
+		if(out) {
+			out->active = active;
+		}
+	}
+
+	bool OamDma::loadState(const StateReader &state) {
+		State dma;
+		if(!state.get(STATE_DMA, dma)) {
+			return false;
+		}
+		active = dma.active;
+		memory->setDmaActive(active, restrictBus);
+		return true;
+	}
+
+	Hdma::Hdma(MemoryMap *memory, StallHandler stall)
+			: memory(memory), stall(stall), source(0), dest(0), remaining(0), hblankActive(false) {
+		RegisterMap *io = memory->getRegisters();
+		io->onWrite(REG_HDMA1, [this](uint8_t val) { source = (source & 0x00FF) | (val << 8); });
+		io->onWrite(REG_HDMA2, [this](uint8_t val) { source = (source & 0xFF00) | (val & 0xF0); });
+		io->onWrite(REG_HDMA3, [this](uint8_t val) { dest = (dest & 0x00FF) | ((val & 0x1F) << 8); });
+		io->onWrite(REG_HDMA4, [this](uint8_t val) { dest = (dest & 0xFF00) | (val & 0xF0); });
+		io->onWrite(REG_HDMA5, [this](uint8_t val) { start(val); });
+		io->set(REG_HDMA5, 0xFF);
+	}
+
+	void Hdma::start(uint8_t val) {
+		RegisterMap *io = memory->getRegisters();
+		if(!memory->isCgb()) {
+			return;
+		}
+		if(hblankActive && !(val & 0x80)) {
+			// Cancelling an HBlank transfer leaves the remaining length readable.
+			hblankActive = false;
+			io->set(REG_HDMA5, 0x80 | (remaining - 1));
+			return;
+		}
+		remaining = (val & 0x7F) + 1;
+		if(val & 0x80) {
+			hblankActive = true;
+			io->set(REG_HDMA5, remaining - 1);
+			return;
+		}
+		int blocks = remaining;
+		while(remaining > 0) {
+			copyBlock();
+		}
+		io->set(REG_HDMA5, 0xFF);
+		stall((blocks * HDMA_BLOCK_CYCLES) << memory->isDoubleSpeed());
+	}
+
+	void Hdma::hblank() {
+		if(!hblankActive) {
+			return;
+		}
+		copyBlock();
+		RegisterMap *io = memory->getRegisters();
+		if(remaining == 0) {
+			hblankActive = false;
+			io->set(REG_HDMA5, 0xFF);
+		} else {
+			io->set(REG_HDMA5, remaining - 1);
+		}
+		stall(HDMA_BLOCK_CYCLES << memory->isDoubleSpeed());
+	}
+
+	// Blocks are 16 byte aligned, so neither side can cross a page.
+	void Hdma::copyBlock() {
+		memcpy(memory->pointer(VRAM_START | dest), memory->pointer(source), HDMA_BLOCK_SIZE);
+		memory->markDirty(VRAM_START | dest, HDMA_BLOCK_SIZE);
+		source += HDMA_BLOCK_SIZE;
+		dest = (dest + HDMA_BLOCK_SIZE) & 0x1FF0;
+		remaining--;
+	}
+
+	void Hdma::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_HDMA);
+		if(out) {
+			out->source = source;
+			out->dest = dest;
+			out->remaining = remaining;
+			out->hblankActive = hblankActive;
+		}
+	}
+
+	bool Hdma::loadState(const StateReader &state) {
+		State hdma;
+		if(!state.get(STATE_HDMA, hdma)) {
+			return false;
+		}
+		source = hdma.source;
+		dest = hdma.dest;
+		remaining = hdma.remaining;
+		hblankActive = hdma.hblankActive;
+		return true;
+	}
+}
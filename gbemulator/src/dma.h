@@ -0,0 +1,78 @@
+#pragma once
+
+#include "memory-map.h"
+#include "save-state.h"
+#include "scheduler.h"
+
+#include <functional>
+
+// 1 M-cycle of setup, then one byte per M-cycle, in CPU cycles.
+#define OAM_DMA_CYCLES (4 + OAM_SIZE * 4)
+#define HDMA_BLOCK_SIZE 16
+// 8 M-cycles per block in single speed, in CPU cycles; doubled in
+// double-speed mode, where the CPU runs twice as many in the same time.
+#define HDMA_BLOCK_CYCLES 32
+
+namespace gbemulator {
+
+// OAM DMA (0xFF46). The 160 bytes are copied in one go when the transfer
+// starts; the scheduler only tracks how long the bus stays locked.
+class OamDma {
+public:
+	OamDma(MemoryMap *memory, Scheduler *scheduler);
+	bool isActive() const { return active; }
+	// Accuracy option: restrict the CPU to I/O and HRAM during transfers,
+	// as the hardware does. Off by default since few games depend on it.
+	void setRestrictBus(bool restricted) { restrictBus = restricted; }
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	// restrictBus is a host setting and stays as set across loads.
+	struct State {
+		bool active;
+	};
+
+	void start(uint8_t page);
+	void finish();
+
+	MemoryMap *memory;
+	Scheduler *scheduler;
+	bool active;
+	bool restrictBus;
+};
+
+// CGB VRAM DMA (0xFF51-0xFF55). General-purpose transfers copy everything
+// at once; HBlank transfers copy one 16 byte block each time the PPU enters
+// HBlank. The CPU is stalled for the time the hardware would take.
+class Hdma {
+public:
+	typedef std::function<void(int)> StallHandler;
+
+	Hdma(MemoryMap *memory, StallHandler stall);
+	bool isActive() const { return hblankActive; }
+	// Called by the PPU when it enters Mode 0 on a visible line.
+	void hblank();
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	struct State {
+		uint16_t source;
+		uint16_t dest;
+		int remaining;
+		bool hblankActive;
+	};
+
+	void start(uint8_t val);
+	void copyBlock();
+
+	MemoryMap *memory;
+	StallHandler stall;
+	uint16_t source;
+	uint16_t dest;
+	int remaining;
+	bool hblankActive;
+};
+
+}
@@ -0,0 +1,265 @@
+#include "fifo-ppu.h"
+
+#include <cstring>
+
+// The first tile fetch of every line is thrown away by the hardware. With
+// the fetch that follows, pixels start coming out on dot 13 of Mode 3.
+#define LINE_START_DELAY 7
+#define SPRITE_FETCH_DOTS 6
+
+namespace gbemulator {
+
+	void FifoPpu::step() {
+		if(mode == MODE_TRANSFER) {
+			transferStep();
+		}
+		dot++;
+		if(mode == MODE_OAM_SCAN && dot == OAM_SCAN_DOTS) {
+			startTransfer();
+		} else if(dot == DOTS_PER_LINE) {
+			endLine();
+		}
+	}
+
+	void FifoPpu::endLine() {
+		dot = 0;
+		if(ly == LINES_PER_FRAME - 1) {
+			setLy(0);
+			beginLine();
+			return;
+		}
+		setLy(ly + 1);
+		if(ly == VISIBLE_LINES) {
+			enterVBlank();
+		} else if(ly < VISIBLE_LINES) {
+			beginLine();
+		}
+	}
+
+	void FifoPpu::startTransfer() {
+		setMode(MODE_TRANSFER);
+		spriteCount = (reg(REG_LCDC) & LCDC_OBJ_ENABLE) ? scanOam(sprites) : 0;
+		// Sprites are fetched in X order; OAM order breaks ties.
+		for(int i = 1; i < spriteCount; i++) {
+			Sprite s = sprites[i];
+			int j = i;
+			while(j > 0 && sprites[j - 1].x > s.x) {
+				sprites[j] = sprites[j - 1];
+				j--;
+			}
+			sprites[j] = s;
+		}
+		nextSprite = 0;
+		spriteStall = 0;
+		fetchState = FETCH_TILE;
+		fetchDots = -LINE_START_DELAY;
+		fetchX = 0;
+		fetchWindow = false;
+		bgHead = 0;
+		bgCount = 0;
+		memset(spriteFifo, 0, sizeof(spriteFifo));
+		lx = 0;
+		discard = reg(REG_SCX) & 7;
+		windowActive = false;
+	}
+
+	void FifoPpu::startWindow() {
+		windowActive = true;
+		fetchWindow = true;
+		fetchX = 0;
+		fetchState = FETCH_TILE;
+		fetchDots = 0;
+		bgCount = 0;
+	}
+
+	void FifoPpu::fetcherStep() {
+		if(fetchDots < 0) {
+			fetchDots++;
+			return;
+		}
+		switch(fetchState) {
+			case FETCH_TILE:
+			case FETCH_LOW:
+				if(++fetchDots == 2) {
+					fetchDots = 0;
+					fetchState = static_cast<FetchState>(fetchState + 1);
+				}
+				return;
+			case FETCH_HIGH:
+				if(++fetchDots < 2) {
+					return;
+				}
+				// Scroll registers are sampled when the tile is read, which is
+				// what lets mid-line SCX/SCY writes show up.
+				if(fetchWindow) {
+					bgTileRow(true, fetchX * 8, windowLine, fetchLo, fetchHi, fetchAttrs);
+				} else {
+					int mapX = ((reg(REG_SCX) & ~7) + fetchX * 8) & 0xFF;
+					bgTileRow(false, mapX, (ly + reg(REG_SCY)) & 0xFF, fetchLo, fetchHi, fetchAttrs);
+				}
+				fetchDots = 0;
+				fetchState = FETCH_PUSH;
+				// The push is tried on the same dot.
+				[[fallthrough]];
+			case FETCH_PUSH:
+				if(bgCount > 0) {
+					return;
+				}
+				for(int i = 0; i < 8; i++) {
+					bgFifo[(bgHead + i) % FIFO_SIZE] = colorAt(fetchLo, fetchHi, 7 - i)
+						| ((fetchAttrs & 7) << 2) | (fetchAttrs & 0x80);
+				}
+				bgCount = 8;
+				fetchX++;
+				fetchState = FETCH_TILE;
+				return;
+		}
+	}
+
+	void FifoPpu::mergeSprite(const Sprite &sprite) {
+		bool cgb = memory->isCgb();
+		uint8_t lo, hi;
+		spriteRow(sprite, lo, hi);
+		for(int p = 0; p < 8; p++) {
+			int slot = sprite.x - 8 + p - lx;
+			if(slot < 0 || slot >= 8) {
+				continue;
+			}
+			int color = colorAt(lo, hi, 7 - p);
+			SpritePixel &pixel = spriteFifo[slot];
+			// DMG keeps the first sprite fetched; CGB the lowest OAM index.
+			if(color == 0 || (pixel.color && !(cgb && sprite.index < pixel.index))) {
+				continue;
+			}
+			pixel.color = color;
+			if(cgb) {
+				pixel.palette = sprite.attrs & 7;
+			} else {
+				pixel.palette = (sprite.attrs & 0x10) ? REG_OBP1 : REG_OBP0;
+			}
+			pixel.behindBg = sprite.attrs & 0x80;
+			pixel.index = sprite.index;
+		}
+	}
+
+	void FifoPpu::transferStep() {
+		if(spriteStall > 0) {
+			if(--spriteStall == 0) {
+				mergeSprite(sprites[nextSprite++]);
+			}
+			return;
+		}
+		if(!windowActive && windowVisible() && lx + 7 >= reg(REG_WX) && discard == 0) {
+			startWindow();
+			return;
+		}
+		if(nextSprite < spriteCount && sprites[nextSprite].x <= lx + 8 && bgCount > 0) {
+			if(sprites[nextSprite].x == 0) {
+				nextSprite++;
+			} else {
+				spriteStall = SPRITE_FETCH_DOTS - 1;
+			}
+			return;
+		}
+		fetcherStep();
+		if(bgCount > 0) {
+			outputPixel();
+		}
+	}
+
+	void FifoPpu::outputPixel() {
+		uint8_t bg = bgFifo[bgHead];
+		bgHead = (bgHead + 1) % FIFO_SIZE;
+		bgCount--;
+		if(discard > 0) {
+			discard--;
+			return;
+		}
+		bool cgb = memory->isCgb();
+		uint8_t lcdc = reg(REG_LCDC);
+		uint8_t bgColor = bg & 3;
+		if(!cgb && !(lcdc & LCDC_BG_ENABLE)) {
+			bgColor = 0;
+		}
+		SpritePixel sprite = spriteFifo[0];
+		memmove(spriteFifo, spriteFifo + 1, sizeof(SpritePixel) * 7);
+		spriteFifo[7] = { 0, 0, 0, 0 };
+		bool bgPriority = !cgb || (lcdc & LCDC_BG_ENABLE);
+		bool behind = sprite.behindBg || (bg & 0x80);
+		bool showSprite = sprite.color && (lcdc & LCDC_OBJ_ENABLE) && !(bgPriority && behind && bgColor);
+		// Palettes are applied as pixels leave the FIFO.
+		if(!render) {
+			lx++;
+		} else if(cgb) {
+			int index = showSprite
+				? OBJ_PALETTE_BASE + sprite.palette * 4 + sprite.color
+				: ((bg >> 2) & 7) * 4 + bgColor;
+			framebuffer->colorLine(ly)[lx] = palette.color(index);
+			if(framebuffer->hasHostColors()) {
+				framebuffer->hostLine(ly)[lx] = palette.hostColor(index);
+			}
+			lx++;
+		} else {
+			uint8_t color = showSprite ? shade(reg(sprite.palette), sprite.color) : shade(reg(REG_BGP), bgColor);
+			framebuffer->indexedLine(ly)[lx++] = color;
+		}
+		if(lx == SCREEN_WIDTH) {
+			if(windowActive) {
+				windowLine++;
+			}
+			setMode(MODE_HBLANK);
+		}
+	}
+
+	void FifoPpu::saveState(StateWriter &state) const {
+		PpuBase::saveState(state);
+		Pipeline *out = state.section<Pipeline>(STATE_PPU_PIPELINE);
+		if(!out) {
+			return;
+		}
+		memcpy(out->sprites, sprites, sizeof(sprites));
+		out->spriteCount = spriteCount;
+		out->nextSprite = nextSprite;
+		out->spriteStall = spriteStall;
+		out->fetchState = fetchState;
+		out->fetchDots = fetchDots;
+		out->fetchX = fetchX;
+		out->fetchWindow = fetchWindow;
+		out->fetchLo = fetchLo;
+		out->fetchHi = fetchHi;
+		out->fetchAttrs = fetchAttrs;
+		memcpy(out->bgFifo, bgFifo, sizeof(bgFifo));
+		out->bgHead = bgHead;
+		out->bgCount = bgCount;
+		memcpy(out->spriteFifo, spriteFifo, sizeof(spriteFifo));
+		out->lx = lx;
+		out->discard = discard;
+		out->windowActive = windowActive;
+	}
+
+	bool FifoPpu::loadState(const StateReader &state) {
+		const Pipeline *in = static_cast<const Pipeline*>(state.section(STATE_PPU_PIPELINE, sizeof(Pipeline)));
+		if(!in || !PpuBase::loadState(state)) {
+			return false;
+		}
+		memcpy(sprites, in->sprites, sizeof(sprites));
+		spriteCount = in->spriteCount;
+		nextSprite = in->nextSprite;
+		spriteStall = in->spriteStall;
+		fetchState = in->fetchState;
+		fetchDots = in->fetchDots;
+		fetchX = in->fetchX;
+		fetchWindow = in->fetchWindow;
+		fetchLo = in->fetchLo;
+		fetchHi = in->fetchHi;
+		fetchAttrs = in->fetchAttrs;
+		memcpy(bgFifo, in->bgFifo, sizeof(bgFifo));
+		bgHead = in->bgHead;
+		bgCount = in->bgCount;
+		memcpy(spriteFifo, in->spriteFifo, sizeof(spriteFifo));
+		lx = in->lx;
+		discard = in->discard;
+		windowActive = in->windowActive;
+		return true;
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ppu.h"
+
+#define FIFO_SIZE 16
+
+namespace gbemulator {
+
+// Dot-stepped PPU modelling the background fetcher and pixel FIFOs, so that
+// register writes made during Mode 3 affect the remaining pixels of a line.
+class FifoPpu : public PpuBase {
+public:
+	FifoPpu(MemoryMap *memory, Framebuffer *framebuffer, Scheduler *scheduler)
+		: PpuBase(memory, framebuffer, scheduler), sprites(), spriteCount(0), nextSprite(0), spriteStall(0),
+		fetchState(FETCH_TILE), fetchDots(0), fetchX(0), fetchWindow(false), fetchLo(0), fetchHi(0), fetchAttrs(0),
+		bgFifo(), bgHead(0), bgCount(0), spriteFifo(), lx(0), discard(0), windowActive(false) {}
+	void tick(int cycles) {
+		if(!enabled) {
+			return;
+		}
+		for(int i = 0; i < cycles; i++) {
+			step();
+		}
+	}
+	// Adds the fetcher and FIFO contents, so a state saved mid-line
+	// resumes on the same pixel.
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	enum FetchState {
+		FETCH_TILE,
+		FETCH_LOW,
+		FETCH_HIGH,
+		FETCH_PUSH
+	};
+	// Palette is the OBP register on DMG, the palette number on CGB.
+	struct SpritePixel {
+		uint8_t color;
+		uint8_t palette;
+		uint8_t behindBg;
+		uint8_t index;
+	};
+
+	struct Pipeline {
+		Sprite sprites[MAX_LINE_SPRITES];
+		int spriteCount;
+		int nextSprite;
+		int spriteStall;
+		FetchState fetchState;
+		int fetchDots;
+		int fetchX;
+		bool fetchWindow;
+		uint8_t fetchLo;
+		uint8_t fetchHi;
+		uint8_t fetchAttrs;
+		uint8_t bgFifo[FIFO_SIZE];
+		int bgHead;
+		int bgCount;
+		SpritePixel spriteFifo[8];
+		int lx;
+		int discard;
+		bool windowActive;
+	};
+
+	void step();
+	void startTransfer();
+	void transferStep();
+	void fetcherStep();
+	void startWindow();
+	void mergeSprite(const Sprite &sprite);
+	void outputPixel();
+	void endLine();
+
+	Sprite sprites[MAX_LINE_SPRITES];
+	int spriteCount;
+	int nextSprite;
+	int spriteStall;
+
+	FetchState fetchState;
+	int fetchDots;
+	int fetchX;
+	bool fetchWindow;
+	uint8_t fetchLo;
+	uint8_t fetchHi;
+	uint8_t fetchAttrs;
+
+	// Color in bits 0-1, CGB palette in bits 2-4, CGB priority in bit 7.
+	uint8_t bgFifo[FIFO_SIZE];
+	int bgHead;
+	int bgCount;
+	SpritePixel spriteFifo[8];
+
+	int lx;
+	int discard;
+	bool windowActive;
+};
+
+}
@@ -0,0 +1,43 @@
+#include "framebuffer.h"
+
+#include <cstring>
+
+namespace gbemulator {
+
+	const uint32_t Framebuffer::DMG_RGBA8888[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+	const uint16_t Framebuffer::DMG_RGB565[4] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
+	const uint8_t Framebuffer::DMG_GRAY8[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+
+	void Framebuffer::toRGBA8888(uint32_t *out, const uint32_t palette[4]) const {
+		if(format == INDEXED8) {
+			indexedToRGBA8888(indexed(), out, SCREEN_PIXELS, palette);
+		} else {
+			bgr555ToRGBA8888(color(), out, SCREEN_PIXELS);
+		}
+	}
+
+	void Framebuffer::toHostRGBA8888(uint32_t *out) const {
+		if(format == BGR555 && hasHostColors()) {
+			memcpy(out, host.data(), SCREEN_PIXELS * sizeof(uint32_t));
+		} else {
+			toRGBA8888(out);
+		}
+	}
+
+	void Framebuffer::toRGB565(uint16_t *out, const uint16_t palette[4]) const {
+		if(format == INDEXED8) {
+			indexedToRGB565(indexed(), out, SCREEN_PIXELS, palette);
+		} else {
+			bgr555ToRGB565(color(), out, SCREEN_PIXELS);
+		}
+	}
+
+	void Framebuffer::toGray8(uint8_t *out, const uint8_t palette[4]) const {
+		if(format == INDEXED8) {
+			indexedToGray8(indexed(), out, SCREEN_PIXELS, palette);
+		} else {
+			bgr555ToGray8(color(), out, SCREEN_PIXELS);
+		}
+	}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pixel-convert.h"
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+#define SCREEN_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+namespace gbemulator {
+
+enum PixelFormat {
+	INDEXED8 = 0, // DMG shade 0-3, one byte per pixel
+	BGR555 = 1    // CGB color, two bytes per pixel
+};
+
+// The PPU's native output. Pixels stay in the format the hardware produces
+// and are only converted to host formats when a consumer asks for them.
+class Framebuffer {
+public:
+	Framebuffer(PixelFormat format = INDEXED8) : format(format) {}
+	PixelFormat getFormat() const { return format; }
+	void setFormat(PixelFormat format) { this->format = format; }
+	uint8_t *indexedLine(int y) { return pixels + y * SCREEN_WIDTH; }
+	uint16_t *colorLine(int y) { return reinterpret_cast<uint16_t*>(pixels) + y * SCREEN_WIDTH; }
+	const uint8_t *indexed() const { return pixels; }
+	const uint16_t *color() const { return reinterpret_cast<const uint16_t*>(pixels); }
+	const uint8_t *data() const { return pixels; }
+	size_t size() const { return format == INDEXED8 ? SCREEN_PIXELS : SCREEN_PIXELS * 2; }
+	// CGB frames can also be kept as host colors, which the PPU copies from
+	// the palette's corrected color cache as it draws. Off by default.
+	void setHostColors(bool enabled) {
+		if(enabled != hasHostColors()) {
+			host.assign(enabled ? SCREEN_PIXELS : 0, 0xFF000000);
+		}
+	}
+	bool hasHostColors() const { return !host.empty(); }
+	uint32_t *hostLine(int y) { return host.data() + y * SCREEN_WIDTH; }
+	// Palettes are only used for INDEXED8 frames.
+	void toRGBA8888(uint32_t *out, const uint32_t palette[4] = DMG_RGBA8888) const;
+	void toRGB565(uint16_t *out, const uint16_t palette[4] = DMG_RGB565) const;
+	void toGray8(uint8_t *out, const uint8_t palette[4] = DMG_GRAY8) const;
+	// The host colors of a BGR555 frame when they are kept, otherwise the
+	// same as toRGBA8888(out).
+	void toHostRGBA8888(uint32_t *out) const;
+
+	static const uint32_t DMG_RGBA8888[4];
+	static const uint16_t DMG_RGB565[4];
+	static const uint8_t DMG_GRAY8[4];
+private:
+	PixelFormat format;
+	alignas(64) uint8_t pixels[SCREEN_PIXELS * 2];
+	std::vector<uint32_t> host;
+};
+
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "apu.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "dma.h"
+#include "framebuffer.h"
+#include "fifo-ppu.h"
+#include "joypad.h"
+#include "save-state.h"
+#include "state-hash.h"
+#include "scanline-ppu.h"
+#include "scheduler.h"
+#include "video-capture.h"
+
+#include <vector>
+
+namespace gbemulator {
+
+// Emulator core. The PPU implementation is chosen at compile time so the
+// fast build carries no trace of the dot-stepped pipeline and vice versa.
+// Components are held by value, so an instance is one cache-line aligned
+// block: CPU registers and the page table first, then RAM, then component
+// state. Cartridge ROM is referenced and cartridge RAM is sized per game;
+// both live outside it.
+template<class Ppu>
+class Gameboy {
+public:
+	Gameboy() : ppu(cpu.getMemory(), &framebuffer, &scheduler), dma(cpu.getMemory(), &scheduler),
+			hdma(cpu.getMemory(), [this](int cycles) { cpu.stall(cycles); }), apu(cpu.getMemory(), &scheduler),
+			joypad(cpu.getMemory()), runAhead(0), videoCapture(nullptr) {
+		cartridge.attach(cpu.getMemory());
+		ppu.setHBlankHandler([this]() { hdma.hblank(); });
+		cpu.getMemory()->setSpeedHandler([this](bool doubleSpeed) { scheduler.setDoubleSpeed(doubleSpeed); });
+	}
+	Gameboy(const Gameboy&) = delete;
+	Gameboy &operator=(const Gameboy&) = delete;
+
+	int step() {
+		int cycles = cpu.step();
+		scheduler.advance(cycles);
+		ppu.tick(scheduler.fromCpuCycles(cycles));
+		return cycles;
+	}
+	// Runs until the PPU completes a frame, or for one frame's worth of
+	// cycles while the LCD is off, then hands the frame's audio to the APU
+	// output ring and the completed frame to the video capture, if attached.
+	// Also closes the memory map's per-frame dirty block counts.
+	//
+	// With run-ahead, the frame is emulated without rendering, its state is
+	// saved, and that many more frames are emulated with the same input,
+	// muted and rendering only the last. The last one is presented and the
+	// state is restored, so the game reacts to input that many frames
+	// sooner than its own logic would show it. Only the RAM blocks those
+	// frames wrote are copied back, and the dirty trackers forget them.
+	void runFrame() {
+		if(runAhead) {
+			ppu.setRenderEnabled(false);
+		}
+		bool completed = emulateFrame();
+		apu.flush();
+		cpu.getMemory()->closeFrame();
+		if(runAhead) {
+			StateWriter measure(nullptr, 0, STATE_RAM_SECTIONS);
+			saveSections(measure);
+			aheadState.resize(measure.finish());
+			StateWriter state(aheadState.data(), aheadState.size(), STATE_RAM_SECTIONS);
+			saveSections(state);
+			state.finish();
+			cpu.getMemory()->saveRollback(aheadRam);
+			apu.setMuted(true);
+			for(int i = 0; i < runAhead; i++) {
+				ppu.setRenderEnabled(i == runAhead - 1);
+				completed = emulateFrame();
+			}
+			cpu.getMemory()->rollback(aheadRam);
+			loadSections(StateReader(aheadState.data(), aheadState.size()));
+			apu.setMuted(false);
+		}
+		if(completed && videoCapture) {
+			videoCapture->submit(framebuffer);
+		}
+	}
+	// Frames to run ahead, 0 to disable. A game's input lag is usually one
+	// or two frames; running further ahead shows mispredicted frames.
+	void setRunAhead(int frames) {
+		runAhead = frames;
+		ppu.setRenderEnabled(true);
+	}
+	int getRunAhead() const { return runAhead; }
+	// Hash of everything a save state holds, so equal hashes mean the
+	// emulation continues identically. Cheap enough for every frame: RAM
+	// blocks not written since the previous call keep their cached hashes.
+	uint64_t stateHash() { return stateHashes().total; }
+	// The same, with a hash per region to tell where two runs diverged.
+	const StateHashes &stateHashes() {
+		StateWriter measure(nullptr, 0, STATE_RAM_SECTIONS);
+		saveSections(measure);
+		hashState.resize(measure.finish());
+		StateWriter state(hashState.data(), hashState.size(), STATE_RAM_SECTIONS);
+		saveSections(state);
+		return hasher.update(cpu.getMemory(), hashState.data(), state.finish());
+	}
+	const StateHasher &getHasher() const { return hasher; }
+	// Copies this instance's state into each child, for searches that
+	// expand many successors of one state. The state is saved once and
+	// loaded into every child; children reuse their instances, so a fork
+	// allocates nothing once they have run with this cartridge. They share
+	// the cartridge ROM and take copies of cartridge RAM; their video
+	// capture and framebuffer contents stay their own until they run a
+	// frame. Returns false if a child has a cartridge where this instance
+	// has none.
+	bool fork(Gameboy *const *children, int count) {
+		forkState.resize(stateSize());
+		size_t size = saveState(forkState.data(), forkState.size());
+		for(int i = 0; i < count; i++) {
+			Gameboy *child = children[i];
+			if(cartridge.getRom() != child->cartridge.getRom() &&
+					!child->loadRom(cartridge.getRom(), cartridge.getRomSize())) {
+				return false;
+			}
+			child->framebuffer.setFormat(framebuffer.getFormat());
+			child->framebuffer.setHostColors(framebuffer.hasHostColors());
+			child->ppu.getPalette().setProfile(ppu.getPalette().getProfile());
+			child->runAhead = runAhead;
+			if(!child->loadState(forkState.data(), size)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	bool fork(Gameboy &child) {
+		Gameboy *children[] = {&child};
+		return fork(children, 1);
+	}
+	Joypad &getJoypad() { return joypad; }
+	void setVideoCapture(VideoCapture *capture) { videoCapture = capture; }
+	// Maps a cartridge ROM, which must outlive the emulator. Without one,
+	// 0x0000-0x7FFF and 0xA000-0xBFFF are plain RAM.
+	bool loadRom(const uint8_t *rom, size_t size) { return cartridge.load(rom, size); }
+	// Bytes a save state needs with the current cartridge.
+	size_t stateSize() const {
+		StateWriter state(nullptr, 0);
+		saveSections(state);
+		return state.finish();
+	}
+	// Writes a save state and returns its size, or 0 if the buffer is too
+	// small. The framebuffer and host-side outputs are not part of it.
+	size_t saveState(uint8_t *buffer, size_t capacity) const {
+		StateWriter state(buffer, capacity);
+		saveSections(state);
+		return state.finish();
+	}
+	// Rejects states from other versions or builds, or made with a
+	// different cartridge RAM size, before changing anything.
+	bool loadState(const uint8_t *buffer, size_t size) {
+		StateReader state(buffer, size);
+		if(!state.isValid() || state.getSize() != stateSize()) {
+			return false;
+		}
+		return loadSections(state);
+	}
+	// Saves a state to return to with resetToCheckpoint(), such as the start
+	// of an episode: component state, plus a copy of RAM in the memory map.
+	void setCheckpoint() {
+		StateWriter measure(nullptr, 0, STATE_RAM_SECTIONS);
+		saveSections(measure);
+		checkpointState.resize(measure.finish());
+		StateWriter state(checkpointState.data(), checkpointState.size(), STATE_RAM_SECTIONS);
+		saveSections(state);
+		state.finish();
+		cpu.getMemory()->saveCheckpoint(checkpointRam);
+	}
+	// Returns to the checkpoint. Only the RAM blocks written since it was
+	// set or last reset are copied back, so a reset costs about as much as
+	// the memory an episode touched. Fails if there is no checkpoint or the
+	// cartridge RAM size has changed since.
+	bool resetToCheckpoint() {
+		if(checkpointState.empty() || cpu.getMemory()->restoreCheckpoint(checkpointRam) < 0) {
+			return false;
+		}
+		return loadSections(StateReader(checkpointState.data(), checkpointState.size()));
+	}
+	Cpu &getCpu() { return cpu; }
+	MemoryMap *getMemory() { return cpu.getMemory(); }
+	Ppu &getPpu() { return ppu; }
+	Scheduler &getScheduler() { return scheduler; }
+	OamDma &getDma() { return dma; }
+	Hdma &getHdma() { return hdma; }
+	Apu &getApu() { return apu; }
+	Cartridge &getCartridge() { return cartridge; }
+	void setCgbMode(bool cgb) {
+		cpu.getMemory()->setCgbMode(cgb);
+		framebuffer.setFormat(cgb ? BGR555 : INDEXED8);
+	}
+	// Has the PPU also draw CGB frames as host colors corrected with
+	// profile, read with Framebuffer::toHostRGBA8888().
+	void setColorProfile(ColorProfile profile) {
+		ppu.getPalette().setProfile(profile);
+		framebuffer.setHostColors(true);
+	}
+	const Framebuffer &getFramebuffer() const { return framebuffer; }
+
+private:
+	// Returns false if the LCD stayed off for a whole frame's worth of cycles.
+	bool emulateFrame() {
+		int cycles = 0;
+		while(!ppu.takeFrame()) {
+			cycles += step();
+			if(!ppu.isEnabled() && cycles >= DOTS_PER_FRAME) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool loadSections(const StateReader &state) {
+		return cpu.getMemory()->loadState(state) && cartridge.loadState(state) && joypad.loadState(state) && scheduler.loadState(state) &&
+			cpu.loadState(state) && ppu.loadState(state) && dma.loadState(state) && hdma.loadState(state) &&
+			apu.loadState(state);
+	}
+
+	void saveSections(StateWriter &state) const {
+		cpu.getMemory()->saveState(state);
+		cartridge.saveState(state);
+		joypad.saveState(state);
+		scheduler.saveState(state);
+		cpu.saveState(state);
+		ppu.saveState(state);
+		dma.saveState(state);
+		hdma.saveState(state);
+		apu.saveState(state);
+	}
+
+	Cpu cpu;
+	Cartridge cartridge;
+	Scheduler scheduler;
+	Framebuffer framebuffer;
+	Ppu ppu;
+	OamDma dma;
+	Hdma hdma;
+	Apu apu;
+	Joypad joypad;
+	StateHasher hasher;
+	int runAhead;
+	std::vector<uint8_t> aheadState;
+	std::vector<uint8_t> aheadRam;
+	std::vector<uint8_t> hashState;
+	std::vector<uint8_t> forkState;
+	std::vector<uint8_t> checkpointState;
+	std::vector<uint8_t> checkpointRam;
+	VideoCapture *videoCapture;
+};
+
+typedef Gameboy<ScanlinePpu> FastGameboy;
+typedef Gameboy<FifoPpu> AccurateGameboy;
+
+}
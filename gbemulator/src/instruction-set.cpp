@@ -1,6 +1,7 @@
 #include "instruction-set.h"
 
 #define INSTRUCTIONS 0x100
+#define SPEED_SWITCH_CYCLES 8200
 #define REG8(ID) registers->get8BitReg((ID))
 #define REG16(ID) registers->get16BitReg((ID))
 #define READ_ADDR8(X) memory->read8(0xFF00 + (X))
@@ -41,8 +42,46 @@
 
 namespace gbemulator {
 
-	InstructionSet::InstructionSet(CpuRegisters *registers, MemoryMap *memory)
-       		: registers(registers), memory(memory) {
+	// T-cycles per opcode, with conditional branches not taken.
+	static const uint8_t opcodeCycles[INSTRUCTIONS] = {
+		 4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4,
+		 4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+		 8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+		 8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+		 8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  0, 12, 24,  8, 16,
+		 8, 12, 12,  4, 12, 16,  8, 16,  8, 16, 12,  4, 12,  4,  8, 16,
+		12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16,
+		12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16
+	};
+
+	// Extra T-cycles when a conditional JR/RET/JP/CALL is taken.
+	static int branchCycles(uint8_t opcode) {
+		switch(opcode & 0xE7) {
+			case 0x20: return 4;
+			case 0xC0: return 12;
+			case 0xC2: return 4;
+			case 0xC4: return 12;
+		}
+		return 0;
+	}
+
+	static int cbCycles(uint8_t opcode) {
+		if((opcode & 0x07) != 0x6) {
+			return 8;
+		}
+		return (opcode >= 0x40 && opcode < 0x80) ? 12 : 16;
+	}
+
+	InstructionSet::InstructionSet(CpuRegisters *cpuRegisters, MemoryMap *memoryMap)
+       		: registers(cpuRegisters), memory(memoryMap) {
 		instructions = std::vector<std::function<InstructionStatus()>>(0x100);
 		cbInstructions = std::vector<std::function<InstructionStatus()>>(0x100);
 
@@ -50,66 +89,74 @@ namespace gbemulator {
 		instructions[0x00] = [](){ return OK; };
 
 		// STOP
-		instructions[0x10] = [](){ return STOP; };
+		// Performs the CGB speed switch when armed through KEY1.
+		instructions[0x10] = [this]() {
+			POSTINC(REG16(PC));
+			if(memory->switchSpeed()) {
+				cycles += SPEED_SWITCH_CYCLES;
+				return OK;
+			}
+			return STOP;
+		};
 
 		// HALT
 		instructions[0x76] = [](){ return HALT; };
 
 		// LD
 		// 8-bit Loads
-		instructions[0x02] = [&registers, &memory]() {
+		instructions[0x02] = [this]() {
 			if(WRITE_ADDR16(REG16(BC), REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0x12] = [&registers, &memory]() {
+		instructions[0x12] = [this]() {
 			if(WRITE_ADDR16(REG16(DE), REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0x22] = [&registers, &memory]() {
+		instructions[0x22] = [this]() {
 			if(WRITE_ADDR16(POSTINC(REG16(HL)), REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0x32] = [&registers, &memory]() {
+		instructions[0x32] = [this]() {
 			if(WRITE_ADDR16(POSTDEC(REG16(HL)), REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0x0A] = [&registers, &memory]() {
+		instructions[0x0A] = [this]() {
 			REG8(A) = READ_ADDR16(REG16(BC));
 			return OK;
 		};
-		instructions[0x1A] = [&registers, &memory]() {
+		instructions[0x1A] = [this]() {
 			REG8(A) = READ_ADDR16(REG16(DE));
 			return OK;
 		};
-		instructions[0x2A] = [&registers, &memory]() {
+		instructions[0x2A] = [this]() {
 			REG8(A) = READ_ADDR16(POSTINC(REG16(HL)));
 			return OK;
 		};
-		instructions[0x3A] = [&registers, &memory]() {
+		instructions[0x3A] = [this]() {
 			REG8(A) = READ_ADDR16(POSTDEC(REG16(HL)));
 			return OK;
 		};
 		for(int i = 0x0; i <= 0x3; i++) {
 			if(i != 0x3) {
-				instructions[(i << 4) + 0x6] = [&registers, &memory, i]() {
+				instructions[(i << 4) + 0x6] = [this, i]() {
 					REG8(i*2) = N;
 					return OK;
 				};
 			}
-			instructions[(i << 4) + 0x6] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x6] = [this, i]() {
 				REG8(i*2+1) = N;
 				return OK;
 			};
 		}
-		instructions[0x36] = [&registers, &memory]() {
+		instructions[0x36] = [this]() {
 			if(WRITE_ADDR16(REG16(HL), N)) {
 				return OK;
 			}
@@ -118,20 +165,20 @@ namespace gbemulator {
 		for(int i = 0x4; i <= 0x6; ++i) {
 			for(int j = 0x0; j <= 0x7; j++) {
 				if(j == 0x6) continue;
-				instructions[(i << 4) + j] = [&registers, i, j]() {
+				instructions[(i << 4) + j] = [this, i, j]() {
 					REG8((i-0x4)*2) = REG8(j);
 					return OK;
 				};
 			}
 			for(int j = 0x8; j <= 0xF; j++) {
 				if(j == 0xE) continue;
-				instructions[(i << 4) + j] = [&registers, i, j]() {
+				instructions[(i << 4) + j] = [this, i, j]() {
 					REG8((i-0x4)*2+1) = REG8(j-0x8);
 					return OK;
 				};
 			}
 			for(int j = 0; j <= 1; j++) {
-				instructions[(i << 4) + j * 0x8 + 0x6] = [&registers, &memory, i, j]() {
+				instructions[(i << 4) + j * 0x8 + 0x6] = [this, i, j]() {
 					REG8((i-0x4)*2+j) = READ_ADDR16(REG16(HL));
 					return OK;
 				};
@@ -139,7 +186,7 @@ namespace gbemulator {
 		}
 		for(int i = 0x0; i <= 0x7; i++) {
 			if(i == 0x6) continue;
-			instructions[0x70 + i] = [&registers, &memory, i]() {
+			instructions[0x70 + i] = [this, i]() {
 				if(WRITE_ADDR16(REG16(HL), REG8(i))) {
 					return OK;
 				}
@@ -148,119 +195,119 @@ namespace gbemulator {
 		}
 		for(int i = 0x8; i <= 0xF; i++) {
 			if(i == 0xE) continue;
-			instructions[0x70 + i] = [&registers, i]() {
+			instructions[0x70 + i] = [this, i]() {
 				REG8(A) = REG8(i-0x8);
 				return OK;
 			};
 		}
-		instructions[0x7E] = [&registers, &memory]() {
+		instructions[0x7E] = [this]() {
 			REG8(A) = READ_ADDR8(REG16(HL));
 			return OK;
 		};
-		instructions[0xE0] = [&registers, &memory]() {
+		instructions[0xE0] = [this]() {
 			if(WRITE_ADDR8(N, REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0xF0] = [&registers, &memory]() {
+		instructions[0xF0] = [this]() {
 			REG8(A) = READ_ADDR8(N);
 			return OK;
 		};
-		instructions[0xE2] = [&registers, &memory]() {
+		instructions[0xE2] = [this]() {
 			if(WRITE_ADDR8(REG8(C), REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0xF2] = [&registers, &memory]() {
+		instructions[0xF2] = [this]() {
 			REG8(A) = READ_ADDR8(REG8(C));
 			return OK;
 		};
-		instructions[0xEA] = [&registers, &memory]() {
+		instructions[0xEA] = [this]() {
 			if(WRITE_ADDR16(NN, REG8(A))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
-		instructions[0xFA] = [&registers, &memory]() {
+		instructions[0xFA] = [this]() {
 			REG8(A) = READ_ADDR8(NN);
 			return OK;
 		};
 		// 16-bit loads
 		// LD XX,nn
 		for(int i = 0x0; i <= 0x3; ++i) {
-			instructions[(i << 4) + 0x1] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x1] = [this, i]() {
 				REG16(i) = READ_ADDR16(NN);
 				return OK;
 			};
 		}
 		// LD (nn),SP
-		instructions[0x08] = [&registers, &memory]() {
+		instructions[0x08] = [this]() {
 			if(WRITE_ADDR16(NN, REG16(SP))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
 		// POP BC
-		instructions[0xC1] = [&registers, &memory]() {
+		instructions[0xC1] = [this]() {
 			REG16(BC) = READ16(POSTINC(REG16(SP)));
 			PREINC(REG16(SP));
 			return OK;
 		};
 		// POP DE
-		instructions[0xD1] = [&registers, &memory]() {
+		instructions[0xD1] = [this]() {
 			REG16(DE) = READ16(POSTINC(REG16(SP)));
 			PREINC(REG16(SP));
 			return OK;
 		};
 		// POP HL
-		instructions[0xE1] = [&registers, &memory]() {
+		instructions[0xE1] = [this]() {
 			REG16(HL) = READ16(POSTINC(REG16(SP)));
 			PREINC(REG16(SP));
 			return OK;
 		};
 		// POP AF
-		instructions[0xF1] = [&registers, &memory]() {
+		instructions[0xF1] = [this]() {
 			REG16(AF) = READ16(POSTINC(REG16(SP)));
 			PREINC(REG16(SP));
 			return OK;
 		};
 		// PUSH BC
-		instructions[0xC5] = [&registers, &memory]() {
+		instructions[0xC5] = [this]() {
 			if(WRITE16(PREDEC(PREDEC(REG16(SP))), REG16(BC))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
 		// PUSH DE
-		instructions[0xD5] = [&registers, &memory]() {
+		instructions[0xD5] = [this]() {
 			if(WRITE16(PREDEC(PREDEC(REG16(SP))), REG16(DE))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
 		// PUSH HL
-		instructions[0xE5] = [&registers, &memory]() {
+		instructions[0xE5] = [this]() {
 			if(WRITE16(PREDEC(PREDEC(REG16(SP))), REG16(HL))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
 		// PUSH AF
-		instructions[0xF5] = [&registers, &memory]() {
+		instructions[0xF5] = [this]() {
 			if(WRITE16(PREDEC(PREDEC(REG16(SP))), REG16(AF))) {
 				return OK;
 			}
 			return WRITE_FAIL;
 		};
 		// LD HL,SP+e
-		instructions[0xF8] = [&registers, &memory]() {
+		instructions[0xF8] = [this]() {
 			REG16(HL) = REG16(SP) + SIGNED_IMM;
 			return OK;
 		};
 		// LD SP,HL
-		instructions[0xF9] = [&registers, &memory]() {
+		instructions[0xF9] = [this]() {
 			REG16(SP) = REG16(HL);
 			return OK;
 		};
@@ -268,14 +315,14 @@ namespace gbemulator {
 		// 8-bit arithmetic
 		// INC R
 		for(int i = 0x0; i <= 0x2; i++) {
-			instructions[(i << 4) + 0x4] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x4] = [this, i]() {
 				PREINC(REG8(i*2));
 				SET_Z(REG8(i*2) == 0);
 				SET_N(false);
 				SET_H(LOWER_NIBBLE(REG8(i*2)) == 0);
 				return OK;
 			};
-			instructions[(i << 4) + 0xC] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0xC] = [this, i]() {
 				PREINC(REG8(i*2+1));
 				SET_Z(REG8(i*2+1) == 0);
 				SET_N(false);
@@ -284,7 +331,7 @@ namespace gbemulator {
 			};
 		}
 		// INC (HL)
-		instructions[0x34] = [&registers, &memory]() {
+		instructions[0x34] = [this]() {
 			uint8_t val = READ_ADDR16(REG16(HL)) + 1;
 			if(WRITE_ADDR16(REG16(HL), val)) {
 				SET_Z(val == 0);
@@ -295,7 +342,7 @@ namespace gbemulator {
 			return WRITE_FAIL;
 		};
 		// INC A
-		instructions[0x3C] = [&registers, &memory]() {
+		instructions[0x3C] = [this]() {
 			PREINC(REG8(A));
 			SET_Z(REG8(A) == 0);
 			SET_N(false);
@@ -304,14 +351,14 @@ namespace gbemulator {
 		};
 		// DEC X
 		for(int i = 0x0; i <= 0x2; i++) {
-			instructions[(i << 4) + 0x5] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x5] = [this, i]() {
 				PREDEC(REG8(i*2));
 				SET_Z(REG8(i*2) == 0);
 				SET_N(true);
 				SET_H(LOWER_NIBBLE(REG8(i*2)) == 0);
 				return OK;
 			};
-			instructions[(i << 4) + 0xD] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0xD] = [this, i]() {
 				PREDEC(REG8(i*2+1));
 				SET_Z(REG8(i*2+1) == 0);
 				SET_N(true);
@@ -320,7 +367,7 @@ namespace gbemulator {
 			};
 		}
 		// DEC (HL)
-		instructions[0x35] = [&registers, &memory]() {
+		instructions[0x35] = [this]() {
 			uint8_t val = READ_ADDR16(REG16(HL)) - 1;
 			if(WRITE_ADDR16(REG16(HL), val)) {
 				SET_Z(val == 0);
@@ -331,7 +378,7 @@ namespace gbemulator {
 			return WRITE_FAIL;
 		};
 		// DEC A
-		instructions[0x3D] = [&registers, &memory]() {
+		instructions[0x3D] = [this]() {
 			PREDEC(REG8(A));
 			SET_Z(REG8(A) == 0);
 			SET_N(false);
@@ -339,7 +386,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// DAA
-		instructions[0x27] = [&registers, &memory] () {
+		instructions[0x27] = [this] () {
 			SET_C(false);
 			if(REG8(A) >= 0xA0) {
 				REG8(A) -= 0xA0;
@@ -357,25 +404,25 @@ namespace gbemulator {
 			return OK;
 		};
 		// SCF
-		instructions[0x37] = [&registers, &memory] () {
+		instructions[0x37] = [this] () {
 			registers->setFlags("-001"); 
 			return OK;
 		};
 		// CPL
-		instructions[0x2F] = [&registers, &memory] () {
+		instructions[0x2F] = [this] () {
 			REG8(A) = ~REG8(A);
 			registers->setFlags("-11-");
 			return OK;
 		};
 		// CCF
-		instructions[0x3F] = [&registers, &memory] () {
+		instructions[0x3F] = [this] () {
 			registers->setFlags("-00x");
 			return OK;
 		};
 		// ADD R
 		for(int i = 0x0; i <= 0x7; i++) {
 			if(i == 0x6) continue;
-			instructions[0x80 + i] = [&registers, &memory, i] () {
+			instructions[0x80 + i] = [this, i] () {
 				SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(REG8(i)) > 0xF);
 				SET_C(static_cast<int>(REG8(A)) + REG8(i) > 0xFF);
 				REG8(A) += REG8(i);
@@ -387,7 +434,7 @@ namespace gbemulator {
 		// SUB R
 		for(int i = 0x0; i <= 0x7; i++) {
 			if(i == 0x6) continue;
-			instructions[0x90 + i] = [&registers, &memory, i] () {
+			instructions[0x90 + i] = [this, i] () {
 				SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(REG8(i)) < 0);
 				SET_C(static_cast<int>(REG8(A)) - REG8(i) < 0);
 				REG8(A) -= REG8(i);
@@ -399,7 +446,7 @@ namespace gbemulator {
 		// AND R
 		for(int i = 0x0; i <= 0x7; i++) {
 			if(i == 0x6) continue;
-			instructions[0xA0 + i] = [&registers, &memory, i] () {
+			instructions[0xA0 + i] = [this, i] () {
 				REG8(A) &= REG8(i);
 				SET_Z(REG8(A) == 0);
 				registers->setFlags("-010");
@@ -409,7 +456,7 @@ namespace gbemulator {
 		// OR R
 		for(int i = 0x0; i <= 0x7; i++) {
 			if(i == 0x6) continue;
-			instructions[0xA0 + i] = [&registers, &memory, i] () {
+			instructions[0xA0 + i] = [this, i] () {
 				REG8(A) |= REG8(i);
 				SET_Z(REG8(A) == 0);
 				registers->setFlags("-000");
@@ -419,7 +466,7 @@ namespace gbemulator {
 		// ADC R
 		for(int i = 0x9; i <= 0xF; i++) {
 			if(i == 0xE) continue;
-			instructions[0x80 + i] = [&registers, &memory, i] () {
+			instructions[0x80 + i] = [this, i] () {
 				SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(REG8(i-0x9)) + GET_C() > 0xF);
 				bool c = static_cast<int>(REG8(A)) + REG8(i-0x9) + GET_C() > 0xFF;
 				REG8(A) += REG8(i-0x9) + GET_C();
@@ -432,7 +479,7 @@ namespace gbemulator {
 		// SBC R
 		for(int i = 0x9; i <= 0xF; i++) {
 			if(i == 0xE) continue;
-			instructions[0x90 + i] = [&registers, &memory, i] () {
+			instructions[0x90 + i] = [this, i] () {
 				SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(REG8(i-0x9)) - GET_C() < 0);
 				bool c = static_cast<int>(REG8(A)) - REG8(i-0x9) - GET_C() < 0;
 				REG8(A) -= REG8(i-0x9) + GET_C();
@@ -445,7 +492,7 @@ namespace gbemulator {
 		// XOR R
 		for(int i = 0x9; i <= 0xF; i++) {
 			if(i == 0xE) continue;
-			instructions[0xA0 + i] = [&registers, &memory, i] () {
+			instructions[0xA0 + i] = [this, i] () {
 				REG8(A) ^= REG8(i-0x9);
 				SET_Z(REG8(A) == 0);
 				registers->setFlags("-000");
@@ -455,7 +502,7 @@ namespace gbemulator {
 		// CP R
 		for(int i = 0x9; i <= 0xF; i++) {
 			if(i == 0xE) continue;
-			instructions[0xB0 + i] = [&registers, &memory, i] () {
+			instructions[0xB0 + i] = [this, i] () {
 				SET_Z(REG8(A) - REG8(i-0x9) == 0);
 				SET_N(true);
 				SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(REG8(i-0x9)) < 0);
@@ -464,7 +511,7 @@ namespace gbemulator {
 			};
 		}
 		// ADD (HL)
-		instructions[0x86] = [&registers, &memory]() {
+		instructions[0x86] = [this]() {
 			uint8_t val = HL_READ;
 			SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(val) > 0xF);
 			SET_C(static_cast<int>(REG8(A)) + val > 0xFF);
@@ -474,7 +521,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SUB (HL)
-		instructions[0x96] = [&registers, &memory]() {
+		instructions[0x96] = [this]() {
 			uint8_t val = HL_READ;
 			SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(val) < 0);
 			SET_C(static_cast<int>(REG8(A)) - val < 0);
@@ -484,21 +531,21 @@ namespace gbemulator {
 			return OK;
 		};
 		// AND (HL)
-		instructions[0xA6] = [&registers, &memory]() {
+		instructions[0xA6] = [this]() {
 			REG8(A) &= HL_READ;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-010");
 			return OK;
 		};
 		// OR (HL)
-		instructions[0xB6] = [&registers, &memory]() {
+		instructions[0xB6] = [this]() {
 			REG8(A) |= HL_READ;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-000");
 			return OK;
 		};
 		// ADC (HL)
-		instructions[0x8F] = [&registers, &memory]() {
+		instructions[0x8F] = [this]() {
 			uint8_t val = HL_READ;
 			SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(val) + GET_C() > 0xF);
 			SET_C(static_cast<int>(REG8(A)) + val + GET_C() > 0xFF);
@@ -508,7 +555,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SBC (HL)
-		instructions[0x9F] = [&registers, &memory]() {
+		instructions[0x9F] = [this]() {
 			uint8_t val = HL_READ;
 			SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(val) - GET_C() < 0);
 			SET_C(static_cast<int>(REG8(A)) - val - GET_C() < 0);
@@ -518,14 +565,14 @@ namespace gbemulator {
 			return OK;
 		};
 		// XOR (HL)
-		instructions[0xAF] = [&registers, &memory]() {
+		instructions[0xAF] = [this]() {
 			REG8(A) ^= HL_READ;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-000");
 			return OK;
 		};
 		// CP (HL)
-		instructions[0xBF] = [&registers, &memory] () {
+		instructions[0xBF] = [this] () {
 			uint8_t val = HL_READ;
 			SET_Z(REG8(A) - REG8(val) == 0);
 			SET_N(true);
@@ -534,7 +581,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// ADD n
-		instructions[0xC6] = [&registers, &memory] () {
+		instructions[0xC6] = [this] () {
 			uint8_t val = N;
 			SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(val) > 0xF);
 			SET_C(static_cast<int>(REG8(A)) + val > 0xFF);
@@ -544,7 +591,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SUB n
-		instructions[0xD6] = [&registers, &memory]() {
+		instructions[0xD6] = [this]() {
 			uint8_t val = N;
 			SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(val) < 0);
 			SET_C(static_cast<int>(REG8(A)) - val < 0);
@@ -554,21 +601,21 @@ namespace gbemulator {
 			return OK;
 		};
 		// AND n
-		instructions[0xE6] = [&registers, &memory]() {
+		instructions[0xE6] = [this]() {
 			REG8(A) &= N;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-010");
 			return OK;
 		};
 		// OR n
-		instructions[0xF6] = [&registers, &memory]() {
+		instructions[0xF6] = [this]() {
 			REG8(A) |= N;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-000");
 			return OK;
 		};
 		// ADC n
-		instructions[0xCE] = [&registers, &memory]() {
+		instructions[0xCE] = [this]() {
 			uint8_t val = N;
 			SET_H(LOWER_NIBBLE(REG8(A)) + LOWER_NIBBLE(val) + GET_C() > 0xF);
 			SET_C(static_cast<int>(REG8(A)) + val + GET_C() > 0xFF);
@@ -578,7 +625,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SBC n
-		instructions[0xDE] = [&registers, &memory]() {
+		instructions[0xDE] = [this]() {
 			uint8_t val = N;
 			SET_H(static_cast<int>(LOWER_NIBBLE(REG8(A))) - LOWER_NIBBLE(val) - GET_C() < 0);
 			SET_C(static_cast<int>(REG8(A)) - val - GET_C() < 0);
@@ -588,14 +635,14 @@ namespace gbemulator {
 			return OK;
 		};
 		// XOR n
-		instructions[0xEE] = [&registers, &memory]() {
+		instructions[0xEE] = [this]() {
 			REG8(A) ^= N;
 			SET_Z(REG8(A) == 0);
 			registers->setFlags("-000");
 			return OK;
 		};
 		// CP n
-		instructions[0xEF] = [&registers, &memory] () {
+		instructions[0xEF] = [this] () {
 			uint8_t val = N;
 			SET_Z(REG8(A) - REG8(val) == 0);
 			SET_N(true);
@@ -607,7 +654,7 @@ namespace gbemulator {
 		// 16-bit arithmetic
 		// INC RR
 		for(int i = 0x0; i <= 0x3; ++i) {
-			instructions[(i << 4) + 0x3] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x3] = [this, i]() {
 				PREINC(REG16(i));
 				return OK;
 			};
@@ -615,7 +662,7 @@ namespace gbemulator {
 		}
 		// DEC RR
 		for(int i = 0x0; i <= 0x3; ++i) {
-			instructions[(i << 4) + 0xB] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0xB] = [this, i]() {
 				PREDEC(REG16(i));
 				return OK;
 			};
@@ -623,7 +670,7 @@ namespace gbemulator {
 		}
 		// ADD HL,RR
 		for(int i = 0x0; i <= 0x3; ++i) {
-			instructions[(i << 4) + 0x9] = [&registers, &memory, i]() {
+			instructions[(i << 4) + 0x9] = [this, i]() {
 				SET_N(false);
 				SET_H(LOWER_NIBBLE(REG16(HL)) + LOWER_NIBBLE(REG16(i)) > 0xF);
 				SET_C(REG16(HL) > 0xFFFF - REG16(i));
@@ -632,7 +679,7 @@ namespace gbemulator {
 			};
 		}
 		// ADD SP,e
-		instructions[0xE8] = [&registers, &memory]() {
+		instructions[0xE8] = [this]() {
 			SET_Z(false);
 			SET_N(false);
 			int8_t val = SIGNED_IMM;
@@ -656,14 +703,14 @@ namespace gbemulator {
 
 		// Rotates, shifts, and bit operations
 		// RLCA
-		instructions[0x07] = [&registers, &memory]() {
+		instructions[0x07] = [this]() {
 			SET_C(REG8(A) & (1 << 7));
 			REG8(A) <<= 1;
 			REG8(A) |= GET_C();
 			return OK;
 		};
 		// RLA
-		instructions[0x17] = [&registers, &memory]() {
+		instructions[0x17] = [this]() {
 			int c = GET_C();
 			SET_C(REG8(A) & (1 << 7));
 			REG8(A) <<= 1;
@@ -671,14 +718,14 @@ namespace gbemulator {
 			return OK;
 		};
 		// RRCA
-		instructions[0x0F] = [&registers, &memory]() {
+		instructions[0x0F] = [this]() {
 			SET_C(REG8(A) & 1);
 			REG8(A) >>= 1;
 			REG8(A) |= (GET_C() << 7);
 			return OK;
 		};
 		// RRA
-		instructions[0x1F] = [&registers, &memory]() {
+		instructions[0x1F] = [this]() {
 			int c = GET_C();
 			SET_C(REG8(A) & 1);
 			REG8(A) >>= 1;
@@ -690,7 +737,7 @@ namespace gbemulator {
 		for(int i = 0x0; i <= 0x7; ++i) {
 			if(i == 0x6) continue;
 			// RLC R
-			cbInstructions[i] = [&registers, i]() {
+			cbInstructions[i] = [this, i]() {
 				int c = GET_C();
 				SET_C(REG8(i) & (1 << 7));
 				REG8(i) <<= 1;
@@ -700,7 +747,7 @@ namespace gbemulator {
 				return OK;
 			};
 			// RRC R
-			cbInstructions[i + 0x8] = [&registers, i]() {
+			cbInstructions[i + 0x8] = [this, i]() {
 				SET_C(REG8(i) & 1);
 				REG8(i) >>= 1;
 				REG8(i) |= (GET_C() << 7);
@@ -709,7 +756,7 @@ namespace gbemulator {
 				return OK;
 			};
 			// RL R
-			cbInstructions[0x10 + i] = [&registers, i]() {
+			cbInstructions[0x10 + i] = [this, i]() {
 				int c = GET_C();
 				SET_C(REG8(i) & (1 << 7));
 				REG8(i) <<= 1;
@@ -719,7 +766,7 @@ namespace gbemulator {
 				return OK;
 			};
 			// RR R
-			cbInstructions[0x10 + i + 0x8] = [&registers, i]() {
+			cbInstructions[0x10 + i + 0x8] = [this, i]() {
 				int c = GET_C();
 				SET_C(REG8(A) & 1);
 				REG8(i) >>= 1;
@@ -729,7 +776,7 @@ namespace gbemulator {
 				return OK;
 			};
 			// SLA R
-			cbInstructions[0x20 + i] = [&registers, i]() {
+			cbInstructions[0x20 + i] = [this, i]() {
 				SET_C(REG8(i) & (1 << 7));
 				REG8(i) <<= 1;
 				SET_Z(REG8(i) == 0);
@@ -737,7 +784,7 @@ namespace gbemulator {
 				return  OK;
 			};
 			// SRA R
-			cbInstructions[0x20 + i + 0x8] = [&registers, i]() {
+			cbInstructions[0x20 + i + 0x8] = [this, i]() {
 				SET_C(REG8(i) & 1);
 				REG8(i) >>= 1;
 				// b7=b7
@@ -747,14 +794,14 @@ namespace gbemulator {
 				return  OK;
 			};
 			// SWAP R
-			cbInstructions[0x30 + i] = [&registers, i]() {
+			cbInstructions[0x30 + i] = [this, i]() {
 				REG8(i) = (LOWER_NIBBLE(REG8(i)) << 4) + UPPER_NIBBLE_SHIFTED(REG8(i));
 				SET_Z(REG8(i) == 0);
 				registers->setFlags("-000");
 				return OK;
 			};
 			// SRL R
-			cbInstructions[0x30 + i + 0x8] = [&registers, i]() {
+			cbInstructions[0x30 + i + 0x8] = [this, i]() {
 				SET_C(REG8(i) & 1);
 				REG8(i) >>= 1;
 				SET_Z(REG8(i) == 0);
@@ -763,41 +810,41 @@ namespace gbemulator {
 			};
 			for(int j = 0; j <= 3; ++j) {
 				// BIT n,R (even)
-				cbInstructions[0x10 * j + 0x40 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x40 + i] = [this, i, j]() {
 					SET_Z(REG8(i) & (1 << (j*2)));
 					registers->setFlags("-01-");
 					return OK;
 				};
 				// BIT n,R (odd)
-				cbInstructions[0x10 * j + 0x48 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x48 + i] = [this, i, j]() {
 					SET_Z(REG8(i) & (1 << (j*2+1)));
 					registers->setFlags("-01-");
 					return OK;
 				};
 				// RES n,R (even)
-				cbInstructions[0x10 * j + 0x50 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x50 + i] = [this, i, j]() {
 					REG8(i) &= ~(1 << (j*2));
 					return OK;
 				};
 				// RES n,R (odd)
-				cbInstructions[0x10 * j + 0x58 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x58 + i] = [this, i, j]() {
 					REG8(i) &= ~(1 << (j*2+1));
 					return OK;
 				};
 				// SET n,R (even)
-				cbInstructions[0x10 * j + 0x60 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x60 + i] = [this, i, j]() {
 					REG8(i) |= (1 << (j*2));
 					return OK;
 				};
 				// SET n,R (odd)
-				cbInstructions[0x10 * j + 0x68 + i] = [&registers, i, j]() {
+				cbInstructions[0x10 * j + 0x68 + i] = [this, i, j]() {
 					REG8(i) |= (1 << (j*2+1));
 					return OK;
 				};
 			}
 		}
 		// RLC (HL)
-		cbInstructions[0x06] = [&registers, &memory]() {
+		cbInstructions[0x06] = [this]() {
 			int c = GET_C();
 			SET_C(HL_READ & (1 << 7));
 			HL_WRITE((HL_READ << 1) | c);
@@ -806,7 +853,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RRC (HL)
-		cbInstructions[0x0E] = [&registers, &memory]() {
+		cbInstructions[0x0E] = [this]() {
 			SET_C(HL_READ & 1);
 			HL_WRITE((HL_READ >> 1) | (GET_C() << 7));
 			SET_Z(HL_READ == 0);
@@ -814,7 +861,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RL (HL)
-		cbInstructions[0x16] = [&registers, &memory]() {
+		cbInstructions[0x16] = [this]() {
 			int c = GET_C();
 			SET_C(HL_READ & (1 << 7));
 			HL_WRITE((HL_READ << 1) | c);
@@ -823,7 +870,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RR (HL)
-		cbInstructions[0x1E] = [&registers, &memory]() {
+		cbInstructions[0x1E] = [this]() {
 			int c = GET_C();
 			SET_C(HL_READ & 1);
 			HL_WRITE((HL_READ >> 1) | (c << 7));
@@ -832,7 +879,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SLA (HL)
-		cbInstructions[0x26] = [&registers, &memory]() {
+		cbInstructions[0x26] = [this]() {
 			SET_C(HL_READ & (1 << 7));
 			HL_WRITE(HL_READ << 1);
 			SET_Z(HL_READ == 0);
@@ -840,7 +887,7 @@ namespace gbemulator {
 			return  OK;
 		};
 		// SRA (HL)
-		cbInstructions[0x2E] = [&registers, &memory]() {
+		cbInstructions[0x2E] = [this]() {
 			SET_C(HL_READ & 1);
 			// b7=b7
 			HL_WRITE((HL_READ >> 1) | (HL_READ & (1 << 7)));
@@ -849,7 +896,7 @@ namespace gbemulator {
 			return  OK;
 		};
 		// SWAP (HL)
-		cbInstructions[0x36] = [&registers, &memory]() {
+		cbInstructions[0x36] = [this]() {
 			uint val = HL_READ;
 			HL_WRITE((LOWER_NIBBLE(val) << 4) + UPPER_NIBBLE_SHIFTED(val));
 			SET_Z(HL_READ == 0);
@@ -857,7 +904,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// SRL (HL)
-		cbInstructions[0x3E] = [&registers, &memory]() {
+		cbInstructions[0x3E] = [this]() {
 			SET_C(HL_READ & 1);
 			HL_WRITE(HL_READ >> 1);
 			SET_Z(HL_READ == 0);
@@ -866,58 +913,58 @@ namespace gbemulator {
 		};
 		for(int i = 0; i <= 3; ++i) {
 			// BIT n,(HL) (even)
-			cbInstructions[0x46 + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0x46 + 0x10 * i] = [this, i]() {
 				SET_Z(HL_READ & (1 << (i*2)));
 				registers->setFlags("-01-");
 				return OK;
 			};
 			// BIT n,(HL) (odd)
-			cbInstructions[0x4E + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0x4E + 0x10 * i] = [this, i]() {
 				SET_Z(HL_READ & (1 << (i*2+1)));
 				registers->setFlags("-01-");
 				return OK;
 			};
 			// RES n,(HL) (even)
-			cbInstructions[0x86 + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0x86 + 0x10 * i] = [this, i]() {
 				HL_WRITE(HL_READ & ~(1 << (i*2)));
 				return OK;
 			};
 			// RES n,(HL) (odd)
-			cbInstructions[0x8E + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0x8E + 0x10 * i] = [this, i]() {
 				HL_WRITE(HL_READ & ~(1 << (i*2+1)));
 				return OK;
 			};
 			// SET n,(HL) (even)
-			cbInstructions[0xC6 + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0xC6 + 0x10 * i] = [this, i]() {
 				HL_WRITE(HL_READ | (1 << (i*2)));
 				return OK;
 			};
 			// SET n,(HL) (odd)
-			cbInstructions[0xCE + 0x10 * i] = [&registers, &memory, i]() {
+			cbInstructions[0xCE + 0x10 * i] = [this, i]() {
 				HL_WRITE(HL_READ | (1 << (i*2+1)));
 				return OK;
 			};
 		}
 
 		// CB
-		instructions[0xCB] = [this, &registers, &memory]() {
+		instructions[0xCB] = [this]() {
 			uint8_t cb_op = N;
 			return this->cbInstructions[cb_op]();
 		};
 		
 		// Control Flow
 		// JP nn
-		instructions[0xC3] = [&registers, &memory]() {
+		instructions[0xC3] = [this]() {
 			REG16(PC) = NN;
 			return OK;
 		};
 		// JP HL
-		instructions[0xE9] = [&registers]() {
+		instructions[0xE9] = [this]() {
 			REG16(PC) = REG16(HL);
 			return OK;
 		};
 		// JP NZ
-		instructions[0xC2] = [&registers, &memory]() {
+		instructions[0xC2] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_Z()) {
 				REG16(PC) = nn;
@@ -925,7 +972,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JP NC
-		instructions[0xD2] = [&registers, &memory]() {
+		instructions[0xD2] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_C()) {
 				REG16(PC) = nn;
@@ -933,7 +980,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JP Z
-		instructions[0xCA] = [&registers, &memory]() {
+		instructions[0xCA] = [this]() {
 			uint16_t nn = NN;
 			if(GET_Z()) {
 				REG16(PC) = nn;
@@ -941,7 +988,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JP C 
-		instructions[0xDA] = [&registers, &memory]() {
+		instructions[0xDA] = [this]() {
 			uint16_t nn = NN;
 			if(GET_C()) {
 				REG16(PC) = nn;
@@ -949,13 +996,13 @@ namespace gbemulator {
 			return OK;
 		};
 		// JR e
-		instructions[0x18] = [&registers, &memory]() {
+		instructions[0x18] = [this]() {
 			int8_t e = SIGNED_IMM;
 			REG16(PC) += e;
 			return OK;
 		};
 		// JR NZ,e
-		instructions[0x20] = [&registers, &memory]() {
+		instructions[0x20] = [this]() {
 			uint8_t e = SIGNED_IMM;
 			if(!GET_Z()) {
 				REG16(PC) = e;
@@ -963,7 +1010,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JR NC,e
-		instructions[0x30] = [&registers, &memory]() {
+		instructions[0x30] = [this]() {
 			uint16_t e = SIGNED_IMM;
 			if(!GET_C()) {
 				REG16(PC) = e;
@@ -971,7 +1018,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JR Z,e
-		instructions[0x28] = [&registers, &memory]() {
+		instructions[0x28] = [this]() {
 			uint16_t e = SIGNED_IMM;
 			if(GET_Z()) {
 				REG16(PC) = e;
@@ -979,7 +1026,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// JR C,e
-		instructions[0x38] = [&registers, &memory]() {
+		instructions[0x38] = [this]() {
 			uint16_t e = SIGNED_IMM;
 			if(GET_C()) {
 				REG16(PC) = e;
@@ -987,13 +1034,13 @@ namespace gbemulator {
 			return OK;
 		};
 		// CALL nn
-		instructions[0xCD] = [&registers, &memory]() {
+		instructions[0xCD] = [this]() {
 			uint16_t nn = NN;
 			CALL(nn);
 			return OK;
 		};
 		// CALL NZ,nn
-		instructions[0xC4] = [&registers, &memory]() {
+		instructions[0xC4] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_Z()) {
 				CALL(nn);
@@ -1001,7 +1048,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// CALL NC,nn
-		instructions[0xD4] = [&registers, &memory]() {
+		instructions[0xD4] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_C()) {
 				CALL(nn);
@@ -1009,7 +1056,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// CALL Z,nn
-		instructions[0xCC] = [&registers, &memory]() {
+		instructions[0xCC] = [this]() {
 			uint16_t nn = NN;
 			if(GET_Z()) {
 				CALL(nn);
@@ -1017,7 +1064,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// CALL C,nn
-		instructions[0xDC] = [&registers, &memory]() {
+		instructions[0xDC] = [this]() {
 			uint16_t nn = NN;
 			if(GET_C()) {
 				CALL(nn);
@@ -1025,12 +1072,12 @@ namespace gbemulator {
 			return OK;
 		};
 		// RET
-		instructions[0xC9] = [&registers, &memory]() {
+		instructions[0xC9] = [this]() {
 			RET();
 			return OK;
 		};
 		// RET NZ
-		instructions[0xC0] = [&registers, &memory]() {
+		instructions[0xC0] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_Z()) {
 				RET();
@@ -1038,7 +1085,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RET NC
-		instructions[0xD0] = [&registers, &memory]() {
+		instructions[0xD0] = [this]() {
 			uint16_t nn = NN;
 			if(!GET_C()) {
 				RET();
@@ -1046,7 +1093,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RET Z
-		instructions[0xC8] = [&registers, &memory]() {
+		instructions[0xC8] = [this]() {
 			uint16_t nn = NN;
 			if(GET_Z()) {
 				RET();
@@ -1054,7 +1101,7 @@ namespace gbemulator {
 			return OK;
 		};
 		// RET C
-		instructions[0xD8] = [&registers, &memory]() {
+		instructions[0xD8] = [this]() {
 			uint16_t nn = NN;
 			if(GET_C()) {
 				RET();
@@ -1062,29 +1109,29 @@ namespace gbemulator {
 			return OK;
 		};
 		// RETI
-		instructions[0xD9] = [&registers, &memory]() {
+		instructions[0xD9] = [this]() {
 			RET();
 			registers->registers16.IME = true;
 			return OK;
 		};
 		// RST n
 		for(int i = 0x0; i <= 0x3; i++) {
-			instructions[0xC7 + (i << 4)] = [&registers, &memory, i]() {
+			instructions[0xC7 + (i << 4)] = [this, i]() {
 				CALL(0x10 * i);
 				return OK;
 			};
-			instructions[0xCF + (i << 4)] = [&registers, &memory, i]() {
+			instructions[0xCF + (i << 4)] = [this, i]() {
 				CALL(0x08 + 0x10 * i);
 				return OK;
 			};
 		}
 		// EI
-		instructions[0xFB] = [&registers]() {
+		instructions[0xFB] = [this]() {
 			registers->registers16.IME = true;
 			return OK;
 		};
 		// DI
-		instructions[0xF3] = [&registers]() {
+		instructions[0xF3] = [this]() {
 			registers->registers16.IME = false;
 			return OK;
 		};
@@ -1092,6 +1139,21 @@ namespace gbemulator {
 
 	// Returns a status code.
 	InstructionStatus InstructionSet::exec(uint8_t opcode) {
+		if(opcode == 0xCB) {
+			cycles = cbCycles(memory->read8(REG16(PC)));
+		} else {
+			cycles = opcodeCycles[opcode];
+			int extra = branchCycles(opcode);
+			if(extra) {
+				bool flag = registers->getFlag(opcode & 0x10 ? FLAG_C : FLAG_Z);
+				if(flag == static_cast<bool>(opcode & 0x08)) {
+					cycles += extra;
+				}
+			}
+		}
+		if(!instructions[opcode]) {
+			return ILLEGAL_OPCODE;
+		}
 		return instructions[opcode]();
 	}
 
@@ -10,6 +10,7 @@
 namespace gbemulator {
 
 enum InstructionStatus {
+	ILLEGAL_OPCODE = -2,
 	WRITE_FAIL = -1,
 	OK = 0,
 	STOP = 1,
@@ -20,7 +21,10 @@ class InstructionSet {
 public:
 	InstructionSet(CpuRegisters *registers, MemoryMap *memory);
 	InstructionStatus exec(uint8_t opcode);
+	// T-cycles taken by the last executed instruction.
+	int getCycles() const { return cycles; }
 private:
+	int cycles;
 	CpuRegisters *registers;
 	MemoryMap *memory;
 	std::vector<std::function<InstructionStatus()>> instructions;
@@ -0,0 +1,37 @@
+#include "joypad.h"
+
+namespace gbemulator {
+
+	Joypad::Joypad(MemoryMap *memory) : io(memory->getRegisters()), buttons(0) {
+		io->onWrite(REG_P1, [this](uint8_t val) {
+			io->set(REG_P1, (io->get(REG_P1) & 0xCF) | (val & 0x30));
+			update();
+		});
+		io->set(REG_P1, 0xCF);
+	}
+
+	void Joypad::setButtons(uint8_t pressed) {
+		buttons = pressed;
+		update();
+	}
+
+	bool Joypad::loadState(const StateReader &state) {
+		return state.get(STATE_JOYPAD, buttons);
+	}
+
+	void Joypad::update() {
+		uint8_t p1 = io->get(REG_P1);
+		uint8_t lines = 0x0F;
+		if(!(p1 & 0x10)) {
+			lines &= ~(buttons & 0x0F);
+		}
+		if(!(p1 & 0x20)) {
+			lines &= ~(buttons >> 4);
+		}
+		if((p1 & 0x0F) & ~lines) {
+			io->requestInterrupt(INT_JOYPAD);
+		}
+		io->set(REG_P1, 0xC0 | (p1 & 0x30) | lines);
+	}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "memory-map.h"
+#include "save-state.h"
+
+#include <cstdint>
+
+namespace gbemulator {
+
+enum JoypadButton {
+	BUTTON_RIGHT  = 0x01,
+	BUTTON_LEFT   = 0x02,
+	BUTTON_UP     = 0x04,
+	BUTTON_DOWN   = 0x08,
+	BUTTON_A      = 0x10,
+	BUTTON_B      = 0x20,
+	BUTTON_SELECT = 0x40,
+	BUTTON_START  = 0x80
+};
+
+// P1 (0xFF00). The game selects the direction and/or action row through
+// bits 4-5 and reads the pressed buttons of those rows as 0 bits in 0-3.
+// Presses that pull a selected line low request the joypad interrupt.
+class Joypad {
+public:
+	Joypad(MemoryMap *memory);
+	// Sets the held buttons, as a mask of JoypadButton values.
+	void setButtons(uint8_t pressed);
+	uint8_t getButtons() const { return buttons; }
+	void saveState(StateWriter &state) const { state.put(STATE_JOYPAD, &buttons, sizeof(buttons)); }
+	bool loadState(const StateReader &state);
+
+private:
+	void update();
+
+	RegisterMap *io;
+	uint8_t buttons;
+};
+
+}
@@ -0,0 +1,165 @@
+#include "lz.h"
+
+#include <cstring>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+// Inputs end with literals so the match search never reads past the end.
+#define LZ_TAIL 8
+
+namespace gbemulator {
+
+	static inline uint32_t load32(const uint8_t *p) {
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	static inline uint64_t load64(const uint8_t *p) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		return v;
+	}
+
+	static inline uint32_t hash(uint32_t v) {
+		return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+	}
+
+	// Lengths of 15 and above continue in bytes of 255 plus a final byte.
+	static uint8_t *putLength(uint8_t *out, size_t length) {
+		for(length -= 15; length >= 255; length -= 255) {
+			*out++ = 255;
+		}
+		*out++ = length;
+		return out;
+	}
+
+	static bool getLength(const uint8_t *&in, const uint8_t *end, size_t &length) {
+		uint8_t b;
+		do {
+			if(in >= end) {
+				return false;
+			}
+			b = *in++;
+			length += b;
+		} while(b == 255);
+		return true;
+	}
+
+	size_t lzBound(size_t size) {
+		return size + size / 255 + 16;
+	}
+
+	static uint8_t *putSequence(uint8_t *out, const uint8_t *literals, size_t literalCount, size_t matchLength) {
+		uint8_t *token = out++;
+		*token = (literalCount < 15 ? literalCount : 15) << 4;
+		if(literalCount >= 15) {
+			out = putLength(out, literalCount);
+		}
+		memcpy(out, literals, literalCount);
+		out += literalCount;
+		if(matchLength) {
+			size_t m = matchLength - LZ_MIN_MATCH;
+			*token |= m < 15 ? m : 15;
+		}
+		return out;
+	}
+
+	size_t lzCompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+		if(capacity < lzBound(size)) {
+			return 0;
+		}
+		uint32_t table[1 << LZ_HASH_BITS] = {};
+		uint8_t *out = dst;
+		size_t anchor = 0;
+		size_t i = 0;
+		while(size >= LZ_TAIL && i < size - LZ_TAIL) {
+			uint32_t v = load32(src + i);
+			uint32_t h = hash(v);
+			size_t candidate = table[h];
+			table[h] = i;
+			if(candidate >= i || i - candidate > LZ_MAX_OFFSET || load32(src + candidate) != v) {
+				i++;
+				continue;
+			}
+			// Extends eight bytes at a time; state deltas have long runs.
+			size_t length = LZ_MIN_MATCH;
+			size_t limit = size - LZ_TAIL - i;
+			while(length + 8 <= limit) {
+				uint64_t diff = load64(src + candidate + length) ^ load64(src + i + length);
+				if(diff) {
+					length += __builtin_ctzll(diff) >> 3;
+					break;
+				}
+				length += 8;
+			}
+			while(length < limit && src[candidate + length] == src[i + length]) {
+				length++;
+			}
+			out = putSequence(out, src + anchor, i - anchor, length);
+			size_t offset = i - candidate;
+			*out++ = offset;
+			*out++ = offset >> 8;
+			if(length - LZ_MIN_MATCH >= 15) {
+				out = putLength(out, length - LZ_MIN_MATCH);
+			}
+			i += length;
+			anchor = i;
+		}
+		out = putSequence(out, src + anchor, size - anchor, 0);
+		return out - dst;
+	}
+
+	size_t lzDecompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+		const uint8_t *in = src;
+		const uint8_t *end = src + size;
+		uint8_t *out = dst;
+		uint8_t *outEnd = dst + capacity;
+		while(in < end) {
+			uint8_t token = *in++;
+			size_t literals = token >> 4;
+			if(literals == 15 && !getLength(in, end, literals)) {
+				return 0;
+			}
+			if(literals > static_cast<size_t>(end - in) || literals > static_cast<size_t>(outEnd - out)) {
+				return 0;
+			}
+			memcpy(out, in, literals);
+			in += literals;
+			out += literals;
+			if(in == end) {
+				break;
+			}
+			if(end - in < 2) {
+				return 0;
+			}
+			size_t offset = in[0] | (in[1] << 8);
+			in += 2;
+			size_t length = token & 15;
+			if(length == 15 && !getLength(in, end, length)) {
+				return 0;
+			}
+			length += LZ_MIN_MATCH;
+			if(offset == 0 || offset > static_cast<size_t>(out - dst) || length > static_cast<size_t>(outEnd - out)) {
+				return 0;
+			}
+			// Overlapping matches repeat the last offset bytes; the repeated
+			// span doubles with each copy.
+			if(offset == 1) {
+				memset(out, out[-1], length);
+				out += length;
+				continue;
+			}
+			while(length) {
+				size_t chunk = offset < length ? offset : length;
+				memcpy(out, out - offset, chunk);
+				out += chunk;
+				length -= chunk;
+				offset += chunk;
+			}
+		}
+		return out - dst;
+	}
+
+}
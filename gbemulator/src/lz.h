@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gbemulator {
+
+// Byte-oriented LZ77 coder in the style of LZ4: sequences of a token, a
+// run of literals and a match of at least four bytes up to 64 KB back.
+// Built for speed on save state deltas, which are mostly long zero runs.
+
+// Worst-case compressed size for size input bytes.
+size_t lzBound(size_t size);
+// Returns the compressed size, or 0 if it does not fit in capacity.
+size_t lzCompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+// Returns the decompressed size, or 0 on corrupt input or overflow.
+size_t lzDecompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+
+}
@@ -1,29 +1,324 @@
 #include "memory-map.h"
 
+#include "cartridge.h"
+
+#include <cstring>
+#include <numeric>
+
+// 0xF000-0xFFFF: the page holding OAM, I/O and HRAM.
+#define HIGH_START 0xF000
+#define FLAT_SIZE (VRAM_START + CART_RAM_END - VRAM_END)
+#define ECHO_OFFSET (ECHO_START - WRAM_START)
+
 namespace gbemulator {
 
-	MemoryMap::MemoryMap() {
-		mem = new uint8_t[ADDRESS_SPACE];
-		registerMap = new RegisterMap(mem + 0xFF00);
+	MemoryMap::MemoryMap() : dirty(), cartridge(nullptr), cgb(false), ppuMode(0), dmaActive(false), busLocked(false),
+			vramLocked(false), oamLocked(false), mem(), vramBanks(), wramBanks(), registerMap(mem + IO_START), frameCounts(),
+			rollbackDirty() {
+		for(int i = 0; i < PAGES; i++) {
+			mapPage(i, mem + i * PAGE_SIZE, DIRTY_FLAT_BLOCK + i * PAGE_SIZE / DIRTY_BLOCK_SIZE);
+		}
+		mapPage(WRAM_START >> PAGE_SHIFT, wramBanks, DIRTY_WRAM_BLOCK);
+		mapPage(ECHO_START >> PAGE_SHIFT, wramBanks, DIRTY_WRAM_BLOCK);
+		mapVramBank(0);
+		mapWramBank(1);
+		registerMap.onWrite(REG_VBK, [this](uint8_t val) {
+			if(cgb) {
+				mapVramBank(val & 1);
+			}
+		});
+		registerMap.onWrite(REG_SVBK, [this](uint8_t val) {
+			if(cgb) {
+				mapWramBank(val & 7);
+			}
+		});
+		registerMap.onWrite(REG_KEY1, [this](uint8_t val) {
+			if(cgb) {
+				registerMap.set(REG_KEY1, (registerMap.get(REG_KEY1) & 0x80) | 0x7E | (val & 1));
+			}
+		});
+		registerMap.set(REG_KEY1, 0x7E);
+	}
+
+	bool MemoryMap::switchSpeed() {
+		uint8_t key1 = registerMap.get(REG_KEY1);
+		if(!cgb || !(key1 & 1)) {
+			return false;
+		}
+		key1 = (key1 ^ 0x80) & ~1;
+		registerMap.set(REG_KEY1, key1);
+		if(speedHandler) {
+			speedHandler(key1 & 0x80);
+		}
+		return true;
+	}
+
+	void MemoryMap::setCgbMode(bool cgb) {
+		this->cgb = cgb;
+		mapVramBank(0);
+		mapWramBank(1);
+	}
+
+	// Banking only swaps page pointers; the access paths stay branch-free.
+	void MemoryMap::mapVramBank(int bank) {
+		uint8_t *base = vramBanks + bank * VRAM_BANK_SIZE;
+		int block = DIRTY_VRAM_BLOCK + bank * VRAM_BANK_SIZE / DIRTY_BLOCK_SIZE;
+		mapPage(VRAM_START >> PAGE_SHIFT, base, block);
+		mapPage((VRAM_START >> PAGE_SHIFT) + 1, base + PAGE_SIZE, block + PAGE_SIZE / DIRTY_BLOCK_SIZE);
+		registerMap.set(REG_VBK, 0xFE | bank);
+	}
+
+	// Bank 0 selects bank 1, as on hardware.
+	void MemoryMap::mapWramBank(int bank) {
+		if(bank == 0) {
+			bank = 1;
+		}
+		mapPage((WRAM_START >> PAGE_SHIFT) + 1, wramBanks + bank * WRAM_BANK_SIZE,
+			DIRTY_WRAM_BLOCK + bank * WRAM_BANK_SIZE / DIRTY_BLOCK_SIZE);
+		registerMap.set(REG_SVBK, 0xF8 | bank);
 	}
 
 	uint8_t MemoryMap::read8(uint16_t addr)  const {
-		return mem[addr];
+		if(busLocked && addr < IO_START) {
+			return 0xFF;
+		}
+		if(addr >= VRAM_START && addr < VRAM_END && vramLocked) {
+			return 0xFF;
+		}
+		if(addr >= OAM_START && addr < OAM_END && oamLocked) {
+			return 0xFF;
+		}
+		// Only 0xE000-0xEFFF has its own page; the rest of echo RAM shares
+		// the high page and is redirected to the switchable WRAM bank.
+		if(addr >= HIGH_START && addr < OAM_START) {
+			addr -= ECHO_OFFSET;
+		}
+		return pages[addr >> PAGE_SHIFT][addr & (PAGE_SIZE - 1)];
 	}
 
 	uint16_t MemoryMap::read16(uint16_t addr) const {
-		return mem[addr] + (mem[addr+1] << 8);
+		return read8(addr) + (read8(addr+1) << 8);
 	}
 
 	bool MemoryMap::write8(uint16_t addr, uint8_t val) {
-		mem[addr] = val;
+		if(addr >= IO_START && addr < IO_END) {
+			registerMap.write(addr - IO_START, val);
+			markBlock(DIRTY_FLAT_BLOCK + (IO_START >> DIRTY_BLOCK_SHIFT));
+			return true;
+		}
+		if(busLocked && addr < IO_START) {
+			return true;
+		}
+		if(cartridge) {
+			if(addr < ROM_END) {
+				cartridge->control(addr, val);
+				return true;
+			}
+			if(addr >= CART_RAM_START && addr < CART_RAM_END && !cartridge->isRamEnabled()) {
+				return true;
+			}
+		}
+		if(addr >= VRAM_START && addr < VRAM_END && vramLocked) {
+			return true;
+		}
+		if(addr >= OAM_START && addr < OAM_END && oamLocked) {
+			return true;
+		}
+		if(addr >= HIGH_START && addr < OAM_START) {
+			addr -= ECHO_OFFSET;
+		}
+		int page = addr >> PAGE_SHIFT;
+		pages[page][addr & (PAGE_SIZE - 1)] = val;
+		markBlock(pageBlocks[page] + ((addr >> DIRTY_BLOCK_SHIFT) & 15));
 		return true;
 	}
 
 	bool MemoryMap::write16(uint16_t addr, uint16_t val) {
-		mem[addr] = val;
-		mem[addr+1] = val >> 8;
+		write8(addr, val);
+		write8(addr+1, val >> 8);
+		return true;
+	}
+
+	void MemoryMap::saveState(StateWriter &state) const {
+		Flags *flags = state.section<Flags>(STATE_MEMORY_FLAGS);
+		if(flags) {
+			flags->cgb = cgb;
+			flags->ppuMode = ppuMode;
+			flags->dmaActive = dmaActive;
+		}
+		// ROM and cartridge RAM areas, when no cartridge maps them.
+		uint8_t *flat = static_cast<uint8_t*>(state.section(STATE_MEMORY, cartridge ? 0 : FLAT_SIZE));
+		if(flat && !cartridge) {
+			memcpy(flat, mem, VRAM_START);
+			memcpy(flat + VRAM_START, mem + VRAM_END, CART_RAM_END - VRAM_END);
+		}
+		state.put(STATE_HIGH_MEMORY, mem + HIGH_START, ADDRESS_SPACE - HIGH_START);
+		state.put(STATE_VRAM, vramBanks, VRAM_BANK_SIZE * VRAM_BANKS);
+		state.put(STATE_WRAM, wramBanks, WRAM_BANK_SIZE * WRAM_BANKS);
+	}
+
+	// Bank pages are rebuilt from the restored VBK/SVBK values. A state
+	// written without STATE_RAM_SECTIONS leaves RAM as it is. The bus lock
+	// depends on a host setting, so OamDma::loadState() sets it again.
+	bool MemoryMap::loadState(const StateReader &state) {
+		Flags flags;
+		if(!state.get(STATE_MEMORY_FLAGS, flags) || (!state.isSkipped(STATE_VRAM) && !loadRam(state))) {
+			return false;
+		}
+		cgb = flags.cgb;
+		ppuMode = flags.ppuMode;
+		dmaActive = flags.dmaActive;
+		updateLocks();
+		mapVramBank(cgb ? registerMap.get(REG_VBK) & 1 : 0);
+		mapWramBank(cgb ? registerMap.get(REG_SVBK) & 7 : 1);
 		return true;
 	}
 
+	bool MemoryMap::loadRam(const StateReader &state) {
+		const uint8_t *flat = static_cast<const uint8_t*>(state.section(STATE_MEMORY, cartridge ? 0 : FLAT_SIZE));
+		if(!flat || !state.get(STATE_HIGH_MEMORY, mem + HIGH_START, ADDRESS_SPACE - HIGH_START) ||
+				!state.get(STATE_VRAM, vramBanks, VRAM_BANK_SIZE * VRAM_BANKS) ||
+				!state.get(STATE_WRAM, wramBanks, WRAM_BANK_SIZE * WRAM_BANKS)) {
+			return false;
+		}
+		if(!cartridge) {
+			memcpy(mem, flat, VRAM_START);
+			memcpy(mem + VRAM_END, flat + VRAM_START, CART_RAM_END - VRAM_END);
+		}
+		markAllDirty();
+		return true;
+	}
+
+	const uint8_t *MemoryMap::blockData(int block) const {
+		if(block >= DIRTY_CART_BLOCK) {
+			return cartridge->getRam() + (block - DIRTY_CART_BLOCK) * DIRTY_BLOCK_SIZE;
+		}
+		if(block >= DIRTY_FLAT_BLOCK) {
+			return mem + (block - DIRTY_FLAT_BLOCK) * DIRTY_BLOCK_SIZE;
+		}
+		if(block >= DIRTY_WRAM_BLOCK) {
+			return wramBanks + (block - DIRTY_WRAM_BLOCK) * DIRTY_BLOCK_SIZE;
+		}
+		return vramBanks + (block - DIRTY_VRAM_BLOCK) * DIRTY_BLOCK_SIZE;
+	}
+
+	int MemoryMap::blockCount() const {
+		return DIRTY_CART_BLOCK + (cartridge ? cartridge->getRamSize() / DIRTY_BLOCK_SIZE : 0);
+	}
+
+	void MemoryMap::markAllDirty() {
+		for(int block = 0; block < blockCount(); block++) {
+			markBlock(block);
+		}
+	}
+
+	int MemoryMap::snapshotDirty(MemoryDelta &delta) {
+		markBlock(DIRTY_FLAT_BLOCK + (IO_START >> DIRTY_BLOCK_SHIFT));
+		delta.blocks.clear();
+		for(int w = 0; w < DIRTY_WORDS; w++) {
+			for(uint64_t bits = dirty[DIRTY_SNAPSHOT][w]; bits; bits &= bits - 1) {
+				delta.blocks.push_back(w * 64 + __builtin_ctzll(bits));
+			}
+			dirty[DIRTY_SNAPSHOT][w] = 0;
+		}
+		delta.data.resize(delta.blocks.size() * DIRTY_BLOCK_SIZE);
+		for(size_t i = 0; i < delta.blocks.size(); i++) {
+			memcpy(&delta.data[i * DIRTY_BLOCK_SIZE], blockData(delta.blocks[i]), DIRTY_BLOCK_SIZE);
+		}
+		return delta.blocks.size();
+	}
+
+	void MemoryMap::applyDelta(const MemoryDelta &delta) {
+		for(size_t i = 0; i < delta.blocks.size(); i++) {
+			if(delta.blocks[i] < blockCount()) {
+				memcpy(writableBlock(delta.blocks[i]), &delta.data[i * DIRTY_BLOCK_SIZE], DIRTY_BLOCK_SIZE);
+				markBlock(delta.blocks[i]);
+			}
+		}
+	}
+
+	void MemoryMap::takeHashDirty(uint64_t out[DIRTY_WORDS]) {
+		int io = DIRTY_FLAT_BLOCK + (IO_START >> DIRTY_BLOCK_SHIFT);
+		memcpy(out, dirty[DIRTY_HASH], sizeof(dirty[DIRTY_HASH]));
+		memset(dirty[DIRTY_HASH], 0, sizeof(dirty[DIRTY_HASH]));
+		out[io >> 6] |= 1ull << (io & 63);
+	}
+
+	void MemoryMap::saveCheckpoint(std::vector<uint8_t> &blocks) {
+		blocks.resize(blockCount() * DIRTY_BLOCK_SIZE);
+		for(int block = 0; block < blockCount(); block++) {
+			memcpy(&blocks[block * DIRTY_BLOCK_SIZE], blockData(block), DIRTY_BLOCK_SIZE);
+		}
+		memset(dirty[DIRTY_CHECKPOINT], 0, sizeof(dirty[DIRTY_CHECKPOINT]));
+	}
+
+	// Restored blocks count as written for every other tracker.
+	int MemoryMap::restoreCheckpoint(const std::vector<uint8_t> &blocks) {
+		if(blocks.size() != static_cast<size_t>(blockCount()) * DIRTY_BLOCK_SIZE) {
+			return -1;
+		}
+		markBlock(DIRTY_FLAT_BLOCK + (IO_START >> DIRTY_BLOCK_SHIFT));
+		int count = 0;
+		for(int w = 0; w < DIRTY_WORDS; w++) {
+			for(uint64_t bits = dirty[DIRTY_CHECKPOINT][w]; bits; bits &= bits - 1) {
+				int block = w * 64 + __builtin_ctzll(bits);
+				memcpy(writableBlock(block), &blocks[block * DIRTY_BLOCK_SIZE], DIRTY_BLOCK_SIZE);
+				markBlock(block);
+				count++;
+			}
+			dirty[DIRTY_CHECKPOINT][w] = 0;
+		}
+		return count;
+	}
+
+	void MemoryMap::saveRollback(std::vector<uint8_t> &blocks) {
+		blocks.resize(blockCount() * DIRTY_BLOCK_SIZE);
+		for(int block = 0; block < blockCount(); block++) {
+			memcpy(&blocks[block * DIRTY_BLOCK_SIZE], blockData(block), DIRTY_BLOCK_SIZE);
+		}
+		memcpy(rollbackDirty, dirty, sizeof(dirty));
+		memset(dirty[DIRTY_ROLLBACK], 0, sizeof(dirty[DIRTY_ROLLBACK]));
+	}
+
+	int MemoryMap::rollback(const std::vector<uint8_t> &blocks) {
+		markBlock(DIRTY_FLAT_BLOCK + (IO_START >> DIRTY_BLOCK_SHIFT));
+		int count = 0;
+		for(int w = 0; w < DIRTY_WORDS; w++) {
+			for(uint64_t bits = dirty[DIRTY_ROLLBACK][w]; bits; bits &= bits - 1) {
+				int block = w * 64 + __builtin_ctzll(bits);
+				memcpy(writableBlock(block), &blocks[block * DIRTY_BLOCK_SIZE], DIRTY_BLOCK_SIZE);
+				count++;
+			}
+		}
+		memcpy(dirty, rollbackDirty, sizeof(dirty));
+		return count;
+	}
+
+	int MemoryMap::dirtyBlocks() const {
+		int count = 0;
+		for(int w = 0; w < DIRTY_WORDS; w++) {
+			count += __builtin_popcountll(dirty[DIRTY_SNAPSHOT][w]);
+		}
+		return count;
+	}
+
+	// Region boundaries fall on bitmap word boundaries.
+	DirtyCounts MemoryMap::closeFrame() {
+		int words[DIRTY_WORDS];
+		for(int w = 0; w < DIRTY_WORDS; w++) {
+			words[w] = __builtin_popcountll(dirty[DIRTY_FRAME][w]);
+			dirty[DIRTY_FRAME][w] = 0;
+		}
+		int *vram = words + DIRTY_VRAM_BLOCK / 64;
+		int *wram = words + DIRTY_WRAM_BLOCK / 64;
+		int *flat = words + DIRTY_FLAT_BLOCK / 64;
+		int *cart = words + DIRTY_CART_BLOCK / 64;
+		frameCounts.vram = std::accumulate(vram, wram, 0);
+		frameCounts.wram = std::accumulate(wram, flat, 0);
+		frameCounts.memory = std::accumulate(flat, cart, 0);
+		frameCounts.cartRam = std::accumulate(cart, words + DIRTY_WORDS, 0);
+		frameCounts.total = frameCounts.vram + frameCounts.wram + frameCounts.memory + frameCounts.cartRam;
+		return frameCounts;
+	}
+
 }
@@ -1,23 +1,206 @@
 #pragma once
 
 #include "register-map.h"
+#include "save-state.h"
 
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
 
 #define ADDRESS_SPACE 0x10000
+#define PAGE_SIZE 0x1000
+#define PAGE_SHIFT 12
+#define PAGES (ADDRESS_SPACE / PAGE_SIZE)
+#define VRAM_START 0x8000
+#define VRAM_END 0xA000
+#define VRAM_BANK_SIZE 0x2000
+#define VRAM_BANKS 2
+#define WRAM_START 0xC000
+#define WRAM_BANK_SIZE 0x1000
+#define WRAM_BANKS 8
+#define ECHO_START 0xE000
+#define OAM_START 0xFE00
+#define OAM_END 0xFEA0
+#define OAM_SIZE (OAM_END - OAM_START)
+#define IO_START 0xFF00
+#define IO_END 0xFF80
+// Dirty tracking works on 256 byte blocks numbered across the backing
+// regions: VRAM banks, WRAM banks, the flat 64 KB map (ROM area and cart
+// RAM area without a cartridge, OAM, I/O, HRAM), then cartridge RAM.
+#define DIRTY_BLOCK_SIZE 0x100
+#define DIRTY_BLOCK_SHIFT 8
+#define DIRTY_VRAM_BLOCK 0
+#define DIRTY_WRAM_BLOCK (DIRTY_VRAM_BLOCK + VRAM_BANK_SIZE * VRAM_BANKS / DIRTY_BLOCK_SIZE)
+#define DIRTY_FLAT_BLOCK (DIRTY_WRAM_BLOCK + WRAM_BANK_SIZE * WRAM_BANKS / DIRTY_BLOCK_SIZE)
+#define DIRTY_CART_BLOCK (DIRTY_FLAT_BLOCK + ADDRESS_SPACE / DIRTY_BLOCK_SIZE)
+#define DIRTY_CART_BLOCKS (0x20000 / DIRTY_BLOCK_SIZE)
+#define DIRTY_BLOCKS (DIRTY_CART_BLOCK + DIRTY_CART_BLOCKS)
+#define DIRTY_WORDS (DIRTY_BLOCKS / 64)
 
 namespace gbemulator {
 
+class Cartridge;
+
+// Each consumer of dirty blocks keeps its own bitmap, so none of them
+// misses writes another one has already collected.
+enum DirtyTracker {
+	DIRTY_SNAPSHOT = 0,
+	DIRTY_FRAME,
+	DIRTY_HASH,
+	DIRTY_CHECKPOINT,
+	DIRTY_ROLLBACK,
+	DIRTY_TRACKERS
+};
+
+// Blocks written between two snapshots: block numbers and, in the same
+// order, DIRTY_BLOCK_SIZE bytes of contents each.
+struct MemoryDelta {
+	std::vector<uint16_t> blocks;
+	std::vector<uint8_t> data;
+};
+
+// Blocks written during the last completed frame, by region.
+struct DirtyCounts {
+	int vram;
+	int wram;
+	int memory;
+	int cartRam;
+	int total;
+};
+
+// RAM regions live inline, so the map and everything it addresses is one
+// block inside its owner; only cartridge ROM and RAM are outside it.
 class MemoryMap {
 public:
 	MemoryMap();
+	MemoryMap(const MemoryMap&) = delete;
+	MemoryMap &operator=(const MemoryMap&) = delete;
 	uint8_t read8(uint16_t addr) const;
 	uint16_t read16(uint16_t addr) const;
 	bool write8(uint16_t addr, uint8_t val);
 	bool write16(uint16_t addr, uint16_t val);
+	RegisterMap *getRegisters() { return &registerMap; }
+	// Enables the CGB VRAM (0xFF4F) and WRAM (0xFF70) bank registers.
+	void setCgbMode(bool cgb);
+	bool isCgb() const { return cgb; }
+	bool isDoubleSpeed() const { return registerMap.get(REG_KEY1) & 0x80; }
+	// Toggles CPU speed if a switch was armed through KEY1 (0xFF4D). Called
+	// by STOP; the handler lets the scheduler rescale its clock.
+	bool switchSpeed();
+	void setSpeedHandler(std::function<void(bool)> handler) { speedHandler = handler; }
+	// Routes writes below 0x8000 to the cartridge's bank controller, which
+	// maps its ROM and RAM pages through mapPage().
+	void setCartridge(Cartridge *cartridge) { this->cartridge = cartridge; }
+	// block is the dirty block number of the page's first 256 bytes.
+	void mapPage(int page, uint8_t *base, int block) {
+		pages[page] = base;
+		pageBlocks[page] = block;
+	}
+	// For components writing through vram()/oam()/pointer() directly.
+	void markDirty(uint16_t addr, int size) {
+		for(int a = addr & ~(DIRTY_BLOCK_SIZE - 1); a < addr + size; a += DIRTY_BLOCK_SIZE) {
+			markBlock(pageBlocks[a >> PAGE_SHIFT] + ((a >> DIRTY_BLOCK_SHIFT) & 15));
+		}
+	}
+	void markAllDirty();
+	// Copies every block written since the previous snapshot into delta,
+	// replacing its contents, and starts a new interval. The I/O block is
+	// always included since the PPU updates LY and STAT without writes.
+	int snapshotDirty(MemoryDelta &delta);
+	// Writes a delta's blocks back. Applying a full capture and then each
+	// later delta in order reproduces memory at the last snapshot.
+	void applyDelta(const MemoryDelta &delta);
+	int dirtyBlocks() const;
+	// Counts the blocks written since the last call, per region, and starts
+	// a new frame. Called by the core at the end of each frame.
+	DirtyCounts closeFrame();
+	const DirtyCounts &getFrameDirty() const { return frameCounts; }
+	// Moves the bitmap of blocks written since the last call into out, for
+	// a cache of block hashes. Includes the I/O block, as snapshots do.
+	void takeHashDirty(uint64_t out[DIRTY_WORDS]);
+	// Copies every block, in block order, into blocks and starts tracking
+	// writes against that copy.
+	void saveCheckpoint(std::vector<uint8_t> &blocks);
+	// Copies back the blocks written since the checkpoint was saved or last
+	// restored, plus the I/O block, and returns how many. Returns -1 if
+	// the cartridge RAM size has changed since.
+	int restoreCheckpoint(const std::vector<uint8_t> &blocks);
+	// Copies every block, in block order, into blocks and keeps the other
+	// trackers' bitmaps, before frames that will be rolled back.
+	void saveRollback(std::vector<uint8_t> &blocks);
+	// Copies back the blocks written since saveRollback(), plus the I/O
+	// block, and returns how many. Memory is then as it was, so every
+	// tracker gets its saved bitmap back and the rolled back frames cost
+	// later hashes, snapshots and checkpoint resets nothing.
+	int rollback(const std::vector<uint8_t> &blocks);
+	const uint8_t *blockData(int block) const;
+	// Blocks in use: all but cartridge RAM beyond the loaded cartridge's.
+	int blockCount() const;
+	// RAM, bank selection and access flags. Only memory no bank or cartridge
+	// page shadows is saved; an attached cartridge saves its own RAM.
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+	// Host pointer to the byte currently mapped at addr. Bank switches swap
+	// page pointers, so callers must not hold this across a switch.
+	const uint8_t *pointer(uint16_t addr) const { return pages[addr >> PAGE_SHIFT] + (addr & (PAGE_SIZE - 1)); }
+	uint8_t *pointer(uint16_t addr) { return pages[addr >> PAGE_SHIFT] + (addr & (PAGE_SIZE - 1)); }
+	// Direct VRAM/OAM access for the PPU and DMA, bypassing the CPU access locks.
+	const uint8_t *vram(int bank = 0) const { return vramBanks + bank * VRAM_BANK_SIZE; }
+	const uint8_t *oam() const { return mem + OAM_START; }
+	uint8_t *oam() { return mem + OAM_START; }
+	// Called by the PPU on mode changes so CPU accesses see the same
+	// VRAM/OAM locking whichever PPU implementation is in use.
+	void setPpuMode(int mode) {
+		ppuMode = mode;
+		updateLocks();
+	}
+	// While OAM DMA runs, OAM is unavailable to the CPU. With restrictBus
+	// everything outside I/O and HRAM is too.
+	void setDmaActive(bool active, bool restrictBus) {
+		dmaActive = active;
+		busLocked = active && restrictBus;
+		updateLocks();
+	}
 private:
-	RegisterMap *registerMap;
-	uint8_t *mem;
+	struct Flags {
+		bool cgb;
+		int ppuMode;
+		bool dmaActive;
+	};
+
+	void mapVramBank(int bank);
+	void mapWramBank(int bank);
+	bool loadRam(const StateReader &state);
+	void markBlock(int block) {
+		for(int t = 0; t < DIRTY_TRACKERS; t++) {
+			dirty[t][block >> 6] |= 1ull << (block & 63);
+		}
+	}
+	uint8_t *writableBlock(int block) { return const_cast<uint8_t*>(blockData(block)); }
+	void updateLocks() {
+		vramLocked = ppuMode == 3;
+		oamLocked = ppuMode >= 2 || dmaActive;
+	}
+
+	// Consulted on every access.
+	uint8_t *pages[PAGES];
+	uint16_t pageBlocks[PAGES];
+	uint64_t dirty[DIRTY_TRACKERS][DIRTY_WORDS];
+	Cartridge *cartridge;
+	bool cgb;
+	int ppuMode;
+	bool dmaActive;
+	bool busLocked;
+	bool vramLocked;
+	bool oamLocked;
+	alignas(64) uint8_t mem[ADDRESS_SPACE];
+	alignas(64) uint8_t vramBanks[VRAM_BANK_SIZE * VRAM_BANKS];
+	alignas(64) uint8_t wramBanks[WRAM_BANK_SIZE * WRAM_BANKS];
+	RegisterMap registerMap;
+	std::function<void(bool)> speedHandler;
+	DirtyCounts frameCounts;
+	uint64_t rollbackDirty[DIRTY_TRACKERS][DIRTY_WORDS];
 };
 
 }
@@ -0,0 +1,119 @@
+#include "movie.h"
+
+#include <cstring>
+
+#define HEADER_SIZE 16
+
+namespace gbemulator {
+
+	static void put16(uint8_t *p, uint16_t v) {
+		p[0] = v;
+		p[1] = v >> 8;
+	}
+
+	static void put32(uint8_t *p, uint32_t v) {
+		put16(p, v);
+		put16(p + 2, v >> 16);
+	}
+
+	static void put64(uint8_t *p, uint64_t v) {
+		put32(p, v);
+		put32(p + 4, v >> 32);
+	}
+
+	static uint16_t get16(const uint8_t *p) {
+		return p[0] | (p[1] << 8);
+	}
+
+	static uint32_t get32(const uint8_t *p) {
+		return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+	}
+
+	static uint64_t get64(const uint8_t *p) {
+		return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+	}
+
+	MovieWriter::MovieWriter(const std::string &path, const uint8_t *state, size_t stateSize, bool hashes)
+			: hashes(hashes), frames(0) {
+		file = fopen(path.c_str(), "wb");
+		if(!file) {
+			return;
+		}
+		uint8_t header[HEADER_SIZE];
+		memcpy(header, "GBMV", 4);
+		put16(header + 4, MOVIE_VERSION);
+		put16(header + 6, (state ? MOVIE_HAS_STATE : 0) | (hashes ? MOVIE_HAS_HASHES : 0));
+		put32(header + 8, 0);
+		put32(header + 12, state ? stateSize : 0);
+		fwrite(header, 1, HEADER_SIZE, file);
+		if(state) {
+			fwrite(state, 1, stateSize, file);
+		}
+	}
+
+	MovieWriter::~MovieWriter() {
+		close();
+	}
+
+	void MovieWriter::addFrame(uint8_t buttons, uint64_t hash) {
+		if(!file) {
+			return;
+		}
+		uint8_t record[9];
+		record[0] = buttons;
+		put64(record + 1, hash);
+		fwrite(record, 1, hashes ? 9 : 1, file);
+		frames++;
+	}
+
+	void MovieWriter::close() {
+		if(!file) {
+			return;
+		}
+		uint8_t count[4];
+		put32(count, frames);
+		fseek(file, 8, SEEK_SET);
+		fwrite(count, 1, 4, file);
+		fclose(file);
+		file = nullptr;
+	}
+
+	MovieReader::MovieReader(const std::string &path) : open(false) {
+		FILE *file = fopen(path.c_str(), "rb");
+		if(!file) {
+			return;
+		}
+		std::vector<uint8_t> data;
+		uint8_t chunk[1 << 16];
+		size_t n;
+		while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+			data.insert(data.end(), chunk, chunk + n);
+		}
+		fclose(file);
+		if(data.size() < HEADER_SIZE || memcmp(data.data(), "GBMV", 4) || get16(&data[4]) != MOVIE_VERSION) {
+			return;
+		}
+		uint16_t flags = get16(&data[6]);
+		size_t frames = get32(&data[8]);
+		size_t stateSize = get32(&data[12]);
+		size_t record = (flags & MOVIE_HAS_HASHES) ? 9 : 1;
+		if(data.size() != HEADER_SIZE + stateSize + frames * record) {
+			return;
+		}
+		const uint8_t *p = &data[HEADER_SIZE];
+		state.assign(p, p + stateSize);
+		p += stateSize;
+		buttons.resize(frames);
+		if(flags & MOVIE_HAS_HASHES) {
+			hashes.resize(frames);
+		}
+		for(size_t i = 0; i < frames; i++, p += record) {
+			buttons[i] = p[0];
+			if(flags & MOVIE_HAS_HASHES) {
+				hashes[i] = get64(p + 1);
+			}
+		}
+		open = true;
+	}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define MOVIE_VERSION 2
+
+namespace gbemulator {
+
+enum MovieFlag {
+	MOVIE_HAS_STATE = 0x01,
+	MOVIE_HAS_HASHES = 0x02
+};
+
+// Input movie: a starting point and the joypad buttons held for each frame.
+// Movies start at power-on (with the same ROM loaded) or from an embedded
+// save state, which ties them to builds with the same state layout. With
+// hashes, each frame also stores the state hash after it, so playback can
+// report the first frame that diverges.
+//
+// Layout, little-endian:
+//   "GBMV" u16 version, u16 flags, u32 frame count, u32 state size
+//   state bytes
+//   per frame: u8 buttons, then u64 state hash with MOVIE_HAS_HASHES
+class MovieWriter {
+public:
+	// A null state records from power-on.
+	MovieWriter(const std::string &path, const uint8_t *state = nullptr, size_t stateSize = 0, bool hashes = true);
+	~MovieWriter();
+	MovieWriter(const MovieWriter&) = delete;
+	MovieWriter &operator=(const MovieWriter&) = delete;
+	bool isOpen() const { return file; }
+	void addFrame(uint8_t buttons, uint64_t hash = 0);
+	// Patches the frame count into the header.
+	void close();
+	int getFrameCount() const { return frames; }
+
+private:
+	FILE *file;
+	bool hashes;
+	uint32_t frames;
+};
+
+// Reads a whole movie into memory; an hour of input is about 2 MB.
+class MovieReader {
+public:
+	MovieReader(const std::string &path);
+	bool isOpen() const { return open; }
+	int getFrameCount() const { return buttons.size(); }
+	bool hasState() const { return !state.empty(); }
+	const uint8_t *getState() const { return state.data(); }
+	size_t getStateSize() const { return state.size(); }
+	bool hasHashes() const { return !hashes.empty(); }
+	uint8_t getButtons(int frame) const { return buttons[frame]; }
+	uint64_t getHash(int frame) const { return hashes[frame]; }
+
+private:
+	bool open;
+	std::vector<uint8_t> state;
+	std::vector<uint8_t> buttons;
+	std::vector<uint64_t> hashes;
+};
+
+// Runs one frame with the given input and appends it to the movie.
+template<class Gameboy>
+void recordMovieFrame(Gameboy &gameboy, MovieWriter &movie, uint8_t buttons) {
+	gameboy.getJoypad().setButtons(buttons);
+	gameboy.runFrame();
+	movie.addFrame(buttons, gameboy.stateHash());
+}
+
+// Plays a movie on an emulator in its power-on state with the movie's ROM
+// loaded. Returns the first frame whose state hash differs from the
+// recorded one, or -1 if none does; a state that will not load fails at
+// frame 0. Without a frame callback nothing is rendered, since hashes do
+// not cover the framebuffer, so playback runs at headless speed.
+template<class Gameboy>
+int playMovie(Gameboy &gameboy, const MovieReader &movie, std::function<void(int)> onFrame = nullptr) {
+	if(movie.hasState() && !gameboy.loadState(movie.getState(), movie.getStateSize())) {
+		return 0;
+	}
+	gameboy.getPpu().setRenderEnabled(static_cast<bool>(onFrame));
+	int desync = -1;
+	for(int i = 0; i < movie.getFrameCount(); i++) {
+		gameboy.getJoypad().setButtons(movie.getButtons(i));
+		gameboy.runFrame();
+		if(onFrame) {
+			onFrame(i);
+		}
+		if(movie.hasHashes() && gameboy.stateHash() != movie.getHash(i)) {
+			desync = i;
+			break;
+		}
+	}
+	gameboy.getPpu().setRenderEnabled(true);
+	return desync;
+}
+
+}
@@ -0,0 +1,75 @@
+#include "pacer.h"
+
+#include "apu.h"
+#include "ppu.h"
+
+#include <algorithm>
+#include <thread>
+
+// Weight of the newest fill reading in the smoothed level.
+#define FILL_SMOOTHING 0.1
+
+namespace gbemulator {
+
+	Pacer::Pacer(AudioRing *ring, Resampler *resampler, double minLatencyMs, double maxLatencyMs) :
+			ring(ring), resampler(resampler), minLatency(minLatencyMs), maxLatency(maxLatencyMs) {
+		resetMetrics();
+		deadline = Clock::now();
+	}
+
+	void Pacer::setWindow(double minLatencyMs, double maxLatencyMs) {
+		minLatency = minLatencyMs;
+		maxLatency = maxLatencyMs;
+	}
+
+	double Pacer::getFillMs() const {
+		return ring->available() / static_cast<double>(RESAMPLER_CHANNELS) / resampler->getOutputRate() * 1000;
+	}
+
+	// Proportional control around the middle of the window: an emptying ring
+	// speeds the output rate up, a filling one slows it down.
+	void Pacer::update() {
+		double fill = getFillMs();
+		if(!primed) {
+			metrics.fillMs = fill;
+			primed = true;
+		} else {
+			metrics.fillMs += (fill - metrics.fillMs) * FILL_SMOOTHING;
+		}
+		double target = (minLatency + maxLatency) / 2;
+		double error = (target - metrics.fillMs) / ((maxLatency - minLatency) / 2);
+		error = std::max(-1.0, std::min(1.0, error));
+		metrics.adjust = PACER_MAX_ADJUST * error;
+		resampler->setAdjust(metrics.adjust);
+		metrics.minFillMs = std::min(metrics.minFillMs, fill);
+		metrics.maxFillMs = std::max(metrics.maxFillMs, fill);
+		metrics.frames++;
+		metrics.overflows = ring->getOverflows();
+		metrics.underflows = ring->getUnderflows();
+	}
+
+	void Pacer::waitForNextFrame() {
+		const Clock::duration frame = std::chrono::duration_cast<Clock::duration>(
+				std::chrono::duration<double>(static_cast<double>(DOTS_PER_FRAME) / APU_CLOCK_RATE));
+		deadline += frame;
+		Clock::time_point now = Clock::now();
+		if(now > deadline + frame) {
+			metrics.lateFrames++;
+			deadline = now;
+			return;
+		}
+		std::this_thread::sleep_until(deadline);
+	}
+
+	PacerMetrics Pacer::getMetrics() const {
+		return metrics;
+	}
+
+	void Pacer::resetMetrics() {
+		metrics = PacerMetrics();
+		metrics.minFillMs = 1e9;
+		metrics.adjust = resampler->getAdjust();
+		primed = false;
+	}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "resampler.h"
+#include "ring-buffer.h"
+
+#include <chrono>
+#include <cstdint>
+
+#define PACER_MIN_LATENCY_MS 20.0
+#define PACER_MAX_LATENCY_MS 40.0
+// Largest change to the output rate, in parts of one.
+#define PACER_MAX_ADJUST 0.005
+
+namespace gbemulator {
+
+struct PacerMetrics {
+	// Smoothed audio ring fill level.
+	double fillMs;
+	double minFillMs;
+	double maxFillMs;
+	// Current resampler rate adjustment.
+	double adjust;
+	uint64_t frames;
+	uint64_t lateFrames;
+	uint64_t overflows;
+	uint64_t underflows;
+};
+
+// Real-time pacing for interactive use. Video frames are timed by the host
+// clock at the nominal frame rate; audio stays smooth because the resampler
+// ratio is steered by how full the audio ring is, holding the latency inside
+// a window instead of letting host and emulated clocks drift apart.
+class Pacer {
+public:
+	Pacer(AudioRing *ring, Resampler *resampler, double minLatencyMs = PACER_MIN_LATENCY_MS,
+			double maxLatencyMs = PACER_MAX_LATENCY_MS);
+	void setWindow(double minLatencyMs, double maxLatencyMs);
+	// Call once per emulated frame after the APU has flushed.
+	void update();
+	// Sleeps until the next frame is due. If emulation has fallen more than
+	// a frame behind, the schedule restarts from now instead of catching up.
+	void waitForNextFrame();
+	double getFillMs() const;
+	PacerMetrics getMetrics() const;
+	void resetMetrics();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	AudioRing *ring;
+	Resampler *resampler;
+	double minLatency;
+	double maxLatency;
+	bool primed;
+	Clock::time_point deadline;
+	PacerMetrics metrics;
+};
+
+}
@@ -0,0 +1,209 @@
+#include "pixel-convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define EXPAND5(X) (((X) << 3) | ((X) >> 2))
+#define GRAY(R, G, B) (((R) * 77 + (G) * 150 + (B) * 29) >> 8)
+
+namespace gbemulator {
+
+	static inline uint32_t bgr555ToRGBA(uint16_t c) {
+		uint32_t r = EXPAND5(c & 0x1F);
+		uint32_t g = EXPAND5((c >> 5) & 0x1F);
+		uint32_t b = EXPAND5((c >> 10) & 0x1F);
+		return r | (g << 8) | (b << 16) | 0xFF000000u;
+	}
+
+	static inline uint16_t bgr555To565(uint16_t c) {
+		uint16_t r = c & 0x1F;
+		uint16_t g = (c >> 5) & 0x1F;
+		uint16_t b = (c >> 10) & 0x1F;
+		return (r << 11) | (((g << 1) | (g >> 4)) << 5) | b;
+	}
+
+	static inline uint8_t bgr555ToGray(uint16_t c) {
+		uint32_t r = EXPAND5(c & 0x1F);
+		uint32_t g = EXPAND5((c >> 5) & 0x1F);
+		uint32_t b = EXPAND5((c >> 10) & 0x1F);
+		return GRAY(r, g, b);
+	}
+
+#if defined(__SSE2__)
+	// Selects palette[idx] per lane. idx lanes must already be masked to 0-3.
+	static inline __m128i select8(__m128i idx, const __m128i p[4]) {
+		__m128i out = _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_setzero_si128()), p[0]);
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(1)), p[1]));
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(2)), p[2]));
+		return _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(3)), p[3]));
+	}
+
+	static inline __m128i select16(__m128i idx, const __m128i p[4]) {
+		__m128i out = _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_setzero_si128()), p[0]);
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_set1_epi16(1)), p[1]));
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_set1_epi16(2)), p[2]));
+		return _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_set1_epi16(3)), p[3]));
+	}
+
+	static inline __m128i select32(__m128i idx, const __m128i p[4]) {
+		__m128i out = _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_setzero_si128()), p[0]);
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(1)), p[1]));
+		out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(2)), p[2]));
+		return _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(3)), p[3]));
+	}
+
+	// Splits 8 BGR555 lanes into 8-bit channel values held in 16-bit lanes.
+	static inline void expand555(__m128i c, __m128i &r, __m128i &g, __m128i &b) {
+		const __m128i mask = _mm_set1_epi16(0x1F);
+		r = _mm_and_si128(c, mask);
+		g = _mm_and_si128(_mm_srli_epi16(c, 5), mask);
+		b = _mm_and_si128(_mm_srli_epi16(c, 10), mask);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+	}
+#endif
+
+	void indexedToRGBA8888(const uint8_t *src, uint32_t *dst, size_t count, const uint32_t palette[4]) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i p[4] = {
+			_mm_set1_epi32(palette[0]), _mm_set1_epi32(palette[1]),
+			_mm_set1_epi32(palette[2]), _mm_set1_epi32(palette[3])
+		};
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi8(3);
+		for(; i + 16 <= count; i += 16) {
+			__m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), mask);
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128i *out = reinterpret_cast<__m128i*>(dst + i);
+			_mm_storeu_si128(out, select32(_mm_unpacklo_epi16(lo, zero), p));
+			_mm_storeu_si128(out + 1, select32(_mm_unpackhi_epi16(lo, zero), p));
+			_mm_storeu_si128(out + 2, select32(_mm_unpacklo_epi16(hi, zero), p));
+			_mm_storeu_si128(out + 3, select32(_mm_unpackhi_epi16(hi, zero), p));
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = palette[src[i] & 3];
+		}
+	}
+
+	void indexedToRGB565(const uint8_t *src, uint16_t *dst, size_t count, const uint16_t palette[4]) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i p[4] = {
+			_mm_set1_epi16(palette[0]), _mm_set1_epi16(palette[1]),
+			_mm_set1_epi16(palette[2]), _mm_set1_epi16(palette[3])
+		};
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi8(3);
+		for(; i + 16 <= count; i += 16) {
+			__m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), mask);
+			__m128i *out = reinterpret_cast<__m128i*>(dst + i);
+			_mm_storeu_si128(out, select16(_mm_unpacklo_epi8(v, zero), p));
+			_mm_storeu_si128(out + 1, select16(_mm_unpackhi_epi8(v, zero), p));
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = palette[src[i] & 3];
+		}
+	}
+
+	void indexedToGray8(const uint8_t *src, uint8_t *dst, size_t count, const uint8_t palette[4]) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i p[4] = {
+			_mm_set1_epi8(palette[0]), _mm_set1_epi8(palette[1]),
+			_mm_set1_epi8(palette[2]), _mm_set1_epi8(palette[3])
+		};
+		const __m128i mask = _mm_set1_epi8(3);
+		for(; i + 16 <= count; i += 16) {
+			__m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), mask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), select8(v, p));
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = palette[src[i] & 3];
+		}
+	}
+
+	void bgr555ToRGBA8888(const uint16_t *src, uint32_t *dst, size_t count) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xFF00));
+		for(; i + 8 <= count; i += 8) {
+			__m128i r, g, b;
+			expand555(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), r, g, b);
+			__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+			__m128i ba = _mm_or_si128(b, alpha);
+			__m128i *out = reinterpret_cast<__m128i*>(dst + i);
+			_mm_storeu_si128(out, _mm_unpacklo_epi16(rg, ba));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg, ba));
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = bgr555ToRGBA(src[i]);
+		}
+	}
+
+	void bgr555ToRGB565(const uint16_t *src, uint16_t *dst, size_t count) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i mask = _mm_set1_epi16(0x1F);
+		for(; i + 8 <= count; i += 8) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i r = _mm_and_si128(c, mask);
+			__m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), mask);
+			__m128i b = _mm_and_si128(_mm_srli_epi16(c, 10), mask);
+			g = _mm_or_si128(_mm_slli_epi16(g, 1), _mm_srli_epi16(g, 4));
+			__m128i out = _mm_or_si128(_mm_slli_epi16(r, 11), _mm_or_si128(_mm_slli_epi16(g, 5), b));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = bgr555To565(src[i]);
+		}
+	}
+
+	void bgr555ToGray8(const uint16_t *src, uint8_t *dst, size_t count) {
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i kr = _mm_set1_epi16(77);
+		const __m128i kg = _mm_set1_epi16(150);
+		const __m128i kb = _mm_set1_epi16(29);
+		for(; i + 16 <= count; i += 16) {
+			__m128i y[2];
+			for(int j = 0; j < 2; j++) {
+				__m128i r, g, b;
+				expand555(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + j * 8)), r, g, b);
+				__m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, kr), _mm_mullo_epi16(g, kg));
+				sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, kb));
+				y[j] = _mm_srli_epi16(sum, 8);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(y[0], y[1]));
+		}
+#endif
+		for(; i < count; i++) {
+			dst[i] = bgr555ToGray(src[i]);
+		}
+	}
+
+	void downscaleGray8(const uint8_t *src, int width, int height, int factor, uint8_t *dst) {
+		int area = factor * factor;
+		for(int y = 0; y < height; y += factor) {
+			for(int x = 0; x < width; x += factor) {
+				int sum = 0;
+				for(int dy = 0; dy < factor; dy++) {
+					const uint8_t *row = src + (y + dy) * width + x;
+					for(int dx = 0; dx < factor; dx++) {
+						sum += row[dx];
+					}
+				}
+				*dst++ = (sum + area / 2) / area;
+			}
+		}
+	}
+
+}
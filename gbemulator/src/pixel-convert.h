@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gbemulator {
+
+// Converters from the native framebuffer formats to host pixel formats.
+// Indexed sources hold DMG shades 0-3 and are mapped through a four entry
+// palette. BGR555 sources hold CGB colors (red in the low bits).
+// RGBA8888 output is laid out R, G, B, A in memory.
+
+void indexedToRGBA8888(const uint8_t *src, uint32_t *dst, size_t count, const uint32_t palette[4]);
+void indexedToRGB565(const uint8_t *src, uint16_t *dst, size_t count, const uint16_t palette[4]);
+void indexedToGray8(const uint8_t *src, uint8_t *dst, size_t count, const uint8_t palette[4]);
+
+void bgr555ToRGBA8888(const uint16_t *src, uint32_t *dst, size_t count);
+void bgr555ToRGB565(const uint16_t *src, uint16_t *dst, size_t count);
+void bgr555ToGray8(const uint16_t *src, uint8_t *dst, size_t count);
+
+// Shrinks an 8-bit image by factor in both directions, averaging each
+// factor x factor box. Dimensions must be multiples of factor.
+void downscaleGray8(const uint8_t *src, int width, int height, int factor, uint8_t *dst);
+
+}
@@ -0,0 +1,174 @@
+#include "ppu.h"
+
+namespace gbemulator {
+
+	PpuBase::PpuBase(MemoryMap *memory, Framebuffer *framebuffer, Scheduler *scheduler)
+			: memory(memory), io(memory->getRegisters()), framebuffer(framebuffer), scheduler(scheduler), palette(io),
+			mode(MODE_OAM_SCAN), ly(0), dot(0), windowLine(0), windowYHit(false),
+			enabled(true), statLine(false), frameDone(false), render(true) {
+		io->set(REG_LCDC, 0x91);
+		io->set(REG_BGP, 0xFC);
+		io->set(REG_STAT, 0x80 | MODE_OAM_SCAN);
+		memory->setPpuMode(MODE_OAM_SCAN);
+		io->onWrite(REG_LCDC, [this](uint8_t val) { writeLcdc(val); });
+		io->onWrite(REG_STAT, [this](uint8_t val) {
+			io->set(REG_STAT, 0x80 | (val & 0x78) | (io->get(REG_STAT) & 0x07));
+			updateStatLine();
+		});
+		io->onWrite(REG_LY, [](uint8_t) {});
+		io->onWrite(REG_LYC, [this](uint8_t val) {
+			io->set(REG_LYC, val);
+			setLy(ly);
+		});
+	}
+
+	void PpuBase::writeLcdc(uint8_t val) {
+		bool on = val & LCDC_ENABLE;
+		io->set(REG_LCDC, val);
+		if(on == enabled) {
+			return;
+		}
+		enabled = on;
+		dot = 0;
+		windowLine = 0;
+		windowYHit = false;
+		setLy(0);
+		if(on) {
+			beginLine();
+		} else {
+			setMode(MODE_HBLANK);
+		}
+	}
+
+	void PpuBase::setMode(PpuMode mode) {
+		this->mode = mode;
+		io->set(REG_STAT, (io->get(REG_STAT) & ~0x03) | mode);
+		memory->setPpuMode(mode);
+		updateStatLine();
+		if(mode == MODE_HBLANK && enabled && hblankHandler) {
+			hblankHandler();
+		}
+	}
+
+	void PpuBase::setLy(uint8_t ly) {
+		this->ly = ly;
+		io->set(REG_LY, ly);
+		uint8_t stat = io->get(REG_STAT) & ~0x04;
+		if(ly == io->get(REG_LYC)) {
+			stat |= 0x04;
+		}
+		io->set(REG_STAT, stat);
+		updateStatLine();
+	}
+
+	void PpuBase::updateStatLine() {
+		uint8_t stat = io->get(REG_STAT);
+		bool line = ((stat & 0x40) && (stat & 0x04))
+			|| ((stat & 0x08) && mode == MODE_HBLANK)
+			|| ((stat & 0x10) && mode == MODE_VBLANK)
+			|| ((stat & 0x20) && mode == MODE_OAM_SCAN);
+		if(line && !statLine && enabled) {
+			io->requestInterrupt(INT_STAT);
+		}
+		statLine = line;
+	}
+
+	void PpuBase::enterVBlank() {
+		setMode(MODE_VBLANK);
+		io->requestInterrupt(INT_VBLANK);
+		frameDone = true;
+	}
+
+	void PpuBase::beginLine() {
+		if(ly == 0) {
+			windowLine = 0;
+			windowYHit = false;
+		}
+		if(ly == reg(REG_WY)) {
+			windowYHit = true;
+		}
+		setMode(MODE_OAM_SCAN);
+	}
+
+	int PpuBase::scanOam(Sprite sprites[MAX_LINE_SPRITES]) const {
+		const uint8_t *oam = memory->oam();
+		int height = (reg(REG_LCDC) & LCDC_OBJ_SIZE) ? 16 : 8;
+		int count = 0;
+		for(int i = 0; i < OAM_SPRITES && count < MAX_LINE_SPRITES; i++) {
+			const uint8_t *entry = oam + i * 4;
+			int top = entry[0] - 16;
+			if(ly >= top && ly < top + height) {
+				sprites[count++] = { entry[0], entry[1], entry[2], entry[3], static_cast<uint8_t>(i) };
+			}
+		}
+		return count;
+	}
+
+	void PpuBase::bgTileRow(bool window, int mapX, int mapY, uint8_t &lo, uint8_t &hi, uint8_t &attrs) const {
+		uint8_t lcdc = reg(REG_LCDC);
+		bool highMap = window ? (lcdc & LCDC_WINDOW_MAP) : (lcdc & LCDC_BG_MAP);
+		int entry = (highMap ? 0x1C00 : 0x1800) + ((mapY >> 3) & 31) * 32 + ((mapX >> 3) & 31);
+		uint8_t tile = memory->vram()[entry];
+		attrs = memory->isCgb() ? memory->vram(1)[entry] : 0;
+		const uint8_t *vram = memory->vram((attrs & 0x08) ? 1 : 0);
+		int row = (attrs & 0x40) ? 7 - (mapY & 7) : (mapY & 7);
+		int addr = (lcdc & LCDC_TILE_DATA) ? tile * 16 : 0x1000 + static_cast<int8_t>(tile) * 16;
+		addr += row * 2;
+		lo = vram[addr];
+		hi = vram[addr + 1];
+		if(attrs & 0x20) {
+			lo = reverseBits(lo);
+			hi = reverseBits(hi);
+		}
+	}
+
+	void PpuBase::spriteRow(const Sprite &sprite, uint8_t &lo, uint8_t &hi) const {
+		bool cgbBank = memory->isCgb() && (sprite.attrs & 0x08);
+		const uint8_t *vram = memory->vram(cgbBank ? 1 : 0);
+		bool tall = reg(REG_LCDC) & LCDC_OBJ_SIZE;
+		int row = ly - (sprite.y - 16);
+		if(sprite.attrs & 0x40) {
+			row = (tall ? 15 : 7) - row;
+		}
+		uint8_t tile = tall ? (sprite.tile & 0xFE) : sprite.tile;
+		int addr = tile * 16 + row * 2;
+		lo = vram[addr];
+		hi = vram[addr + 1];
+		if(sprite.attrs & 0x20) {
+			lo = reverseBits(lo);
+			hi = reverseBits(hi);
+		}
+	}
+
+	void PpuBase::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_PPU);
+		if(out) {
+			out->mode = mode;
+			out->ly = ly;
+			out->dot = dot;
+			out->windowLine = windowLine;
+			out->windowYHit = windowYHit;
+			out->enabled = enabled;
+			out->statLine = statLine;
+			out->frameDone = frameDone;
+		}
+		palette.saveState(state);
+	}
+
+	bool PpuBase::loadState(const StateReader &state) {
+		State ppu;
+		if(!state.get(STATE_PPU, ppu) || !palette.loadState(state)) {
+			return false;
+		}
+		mode = ppu.mode;
+		ly = ppu.ly;
+		dot = ppu.dot;
+		windowLine = ppu.windowLine;
+		windowYHit = ppu.windowYHit;
+		enabled = ppu.enabled;
+		statLine = ppu.statLine;
+		frameDone = ppu.frameDone;
+		return true;
+	}
+
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "cgb-palette.h"
+#include "framebuffer.h"
+#include "memory-map.h"
+#include "scheduler.h"
+
+#define DOTS_PER_LINE 456
+#define LINES_PER_FRAME 154
+#define VISIBLE_LINES 144
+#define DOTS_PER_FRAME (DOTS_PER_LINE * LINES_PER_FRAME)
+#define OAM_SCAN_DOTS 80
+#define MODE3_MIN_DOTS 172
+#define MAX_LINE_SPRITES 10
+#define OAM_SPRITES 40
+
+namespace gbemulator {
+
+enum PpuMode {
+	MODE_HBLANK = 0,
+	MODE_VBLANK = 1,
+	MODE_OAM_SCAN = 2,
+	MODE_TRANSFER = 3
+};
+
+enum LcdcBit {
+	LCDC_BG_ENABLE = 0x01,
+	LCDC_OBJ_ENABLE = 0x02,
+	LCDC_OBJ_SIZE = 0x04,
+	LCDC_BG_MAP = 0x08,
+	LCDC_TILE_DATA = 0x10,
+	LCDC_WINDOW_ENABLE = 0x20,
+	LCDC_WINDOW_MAP = 0x40,
+	LCDC_ENABLE = 0x80
+};
+
+struct Sprite {
+	uint8_t y;
+	uint8_t x;
+	uint8_t tile;
+	uint8_t attrs;
+	uint8_t index;
+};
+
+// State and helpers shared by the scanline and pixel FIFO PPUs. Both read
+// VRAM/OAM through MemoryMap and publish their mode to it, so CPU-side
+// access rules do not depend on which implementation is compiled in.
+class PpuBase {
+public:
+	PpuBase(MemoryMap *memory, Framebuffer *framebuffer, Scheduler *scheduler);
+	// Returns true once per frame, when the PPU has entered VBlank.
+	bool takeFrame() {
+		bool ready = frameDone;
+		frameDone = false;
+		return ready;
+	}
+	bool isEnabled() const { return enabled; }
+	// Called on entry to Mode 0 on visible lines; drives HBlank HDMA.
+	void setHBlankHandler(std::function<void()> handler) { hblankHandler = handler; }
+	PpuMode getMode() const { return mode; }
+	uint8_t getLy() const { return ly; }
+	CgbPalette &getPalette() { return palette; }
+	// With rendering off the PPU keeps its timing, modes and interrupts but
+	// leaves the framebuffer alone; used for frames nobody will see.
+	void setRenderEnabled(bool on) { render = on; }
+	bool isRenderEnabled() const { return render; }
+	// Line and mode state plus palette RAM. Pending mode changes are
+	// scheduler events and are saved with the scheduler.
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+protected:
+	struct State {
+		PpuMode mode;
+		uint8_t ly;
+		int dot;
+		int windowLine;
+		bool windowYHit;
+		bool enabled;
+		bool statLine;
+		bool frameDone;
+	};
+
+	uint8_t reg(int r) const { return io->get(r); }
+	void setMode(PpuMode mode);
+	void setLy(uint8_t ly);
+	void updateStatLine();
+	void enterVBlank();
+	// Called at the start of each line's OAM scan.
+	void beginLine();
+	int scanOam(Sprite sprites[MAX_LINE_SPRITES]) const;
+	// Returns the low/high bitplanes of a background or window tile row and,
+	// on CGB, the tile's attributes (zero on DMG). Rows are already flipped
+	// so bit 7 is always the leftmost pixel.
+	void bgTileRow(bool window, int mapX, int mapY, uint8_t &lo, uint8_t &hi, uint8_t &attrs) const;
+	// Returns the low/high bitplanes of a sprite's row for the current line.
+	void spriteRow(const Sprite &sprite, uint8_t &lo, uint8_t &hi) const;
+	bool windowVisible() const {
+		return (reg(REG_LCDC) & LCDC_WINDOW_ENABLE) && windowYHit && reg(REG_WX) <= 166;
+	}
+	static int colorAt(uint8_t lo, uint8_t hi, int bit) {
+		return ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+	}
+	static uint8_t shade(uint8_t palette, int color) { return (palette >> (color * 2)) & 3; }
+	static uint8_t reverseBits(uint8_t b) {
+		b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+		b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+		return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	}
+
+	void writeLcdc(uint8_t val);
+
+	MemoryMap *memory;
+	RegisterMap *io;
+	Framebuffer *framebuffer;
+	Scheduler *scheduler;
+	CgbPalette palette;
+	PpuMode mode;
+	uint8_t ly;
+	int dot;
+	int windowLine;
+	bool windowYHit;
+	bool enabled;
+	bool statLine;
+	bool frameDone;
+	bool render;
+	std::function<void()> hblankHandler;
+};
+
+}
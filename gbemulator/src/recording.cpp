@@ -0,0 +1,311 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define HEADER_SIZE 14
+#define TRAILER_SIZE 12
+#define MAX_LITERAL 128
+#define MIN_RUN 3
+#define MAX_RUN (0x7F + MIN_RUN)
+
+namespace gbemulator {
+
+	static void put16(uint8_t *p, uint16_t v) {
+		p[0] = v;
+		p[1] = v >> 8;
+	}
+
+	static void put32(uint8_t *p, uint32_t v) {
+		put16(p, v);
+		put16(p + 2, v >> 16);
+	}
+
+	static void put64(uint8_t *p, uint64_t v) {
+		put32(p, v);
+		put32(p + 4, v >> 32);
+	}
+
+	static uint16_t get16(const uint8_t *p) {
+		return p[0] | (p[1] << 8);
+	}
+
+	static uint32_t get32(const uint8_t *p) {
+		return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+	}
+
+	static uint64_t get64(const uint8_t *p) {
+		return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+	}
+
+	static size_t packedSize(PixelFormat format) {
+		return format == INDEXED8 ? SCREEN_PIXELS / 4 : SCREEN_PIXELS * 2;
+	}
+
+	void packFrame(const Framebuffer &frame, std::vector<uint8_t> &out) {
+		out.resize(packedSize(frame.getFormat()));
+		if(frame.getFormat() == BGR555) {
+			memcpy(out.data(), frame.data(), out.size());
+			return;
+		}
+		const uint8_t *src = frame.indexed();
+		for(size_t i = 0; i < out.size(); i++) {
+			out[i] = (src[0] & 3) | ((src[1] & 3) << 2) | ((src[2] & 3) << 4) | ((src[3] & 3) << 6);
+			src += 4;
+		}
+	}
+
+	void unpackFrame(const std::vector<uint8_t> &packed, Framebuffer &out) {
+		if(out.getFormat() == BGR555) {
+			memcpy(out.colorLine(0), packed.data(), packed.size());
+			return;
+		}
+		uint8_t *dst = out.indexedLine(0);
+		for(uint8_t byte : packed) {
+			dst[0] = byte & 3;
+			dst[1] = (byte >> 2) & 3;
+			dst[2] = (byte >> 4) & 3;
+			dst[3] = byte >> 6;
+			dst += 4;
+		}
+	}
+
+	void encodeRuns(const uint8_t *src, size_t size, std::vector<uint8_t> &out) {
+		size_t i = 0;
+		while(i < size) {
+			size_t run = 1;
+			while(i + run < size && run < MAX_RUN && src[i + run] == src[i]) {
+				run++;
+			}
+			if(run >= MIN_RUN) {
+				out.push_back(0x80 + run - MIN_RUN);
+				out.push_back(src[i]);
+				i += run;
+				continue;
+			}
+			size_t start = i;
+			while(i < size && i - start < MAX_LITERAL) {
+				if(i + 2 < size && src[i] == src[i + 1] && src[i] == src[i + 2]) {
+					break;
+				}
+				i++;
+			}
+			out.push_back(i - start - 1);
+			out.insert(out.end(), src + start, src + i);
+		}
+	}
+
+	bool decodeRuns(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize) {
+		size_t in = 0;
+		size_t out = 0;
+		while(in < size) {
+			uint8_t control = src[in++];
+			if(control >= 0x80) {
+				size_t run = control - 0x80 + MIN_RUN;
+				if(in >= size || out + run > dstSize) {
+					return false;
+				}
+				memset(dst + out, src[in++], run);
+				out += run;
+			} else {
+				size_t count = control + 1;
+				if(in + count > size || out + count > dstSize) {
+					return false;
+				}
+				memcpy(dst + out, src + in, count);
+				in += count;
+				out += count;
+			}
+		}
+		return out == dstSize;
+	}
+
+	RecordingWriter::RecordingWriter(const std::string &path, PixelFormat format, int keyInterval) :
+			format(format), keyInterval(std::max(keyInterval, 1)), position(0) {
+		file = fopen(path.c_str(), "wb");
+		if(!file) {
+			return;
+		}
+		uint8_t header[HEADER_SIZE];
+		memcpy(header, "GBRC", 4);
+		put16(header + 4, RECORDING_VERSION);
+		header[6] = format;
+		header[7] = 0;
+		put16(header + 8, SCREEN_WIDTH);
+		put16(header + 10, SCREEN_HEIGHT);
+		put16(header + 12, this->keyInterval);
+		put(header, HEADER_SIZE);
+	}
+
+	RecordingWriter::~RecordingWriter() {
+		close();
+	}
+
+	void RecordingWriter::put(const void *data, size_t size) {
+		fwrite(data, 1, size, file);
+		position += size;
+	}
+
+	void RecordingWriter::addFrame(const Framebuffer &frame) {
+		if(!file || frame.getFormat() != format) {
+			return;
+		}
+		packFrame(frame, packed);
+		bool key = offsets.size() % keyInterval == 0;
+		if(!key) {
+			for(size_t i = 0; i < packed.size(); i++) {
+				previous[i] ^= packed[i];
+			}
+		}
+		encoded.clear();
+		encodeRuns(key ? packed.data() : previous.data(), packed.size(), encoded);
+		offsets.push_back(position);
+		uint8_t record[5];
+		record[0] = key ? RECORDING_KEYFRAME : RECORDING_DELTA;
+		put32(record + 1, encoded.size());
+		put(record, sizeof(record));
+		put(encoded.data(), encoded.size());
+		previous.swap(packed);
+	}
+
+	void RecordingWriter::close() {
+		if(!file) {
+			return;
+		}
+		uint64_t indexOffset = position;
+		std::vector<uint8_t> index(4 + offsets.size() * 8 + TRAILER_SIZE);
+		put32(index.data(), offsets.size());
+		for(size_t i = 0; i < offsets.size(); i++) {
+			put64(index.data() + 4 + i * 8, offsets[i]);
+		}
+		uint8_t *trailer = index.data() + index.size() - TRAILER_SIZE;
+		put64(trailer, indexOffset);
+		memcpy(trailer + 8, "GBRX", 4);
+		put(index.data(), index.size());
+		fclose(file);
+		file = nullptr;
+	}
+
+	RecordingReader::RecordingReader(const std::string &path) : format(INDEXED8), indexOffset(0), current(-1) {
+		file = fopen(path.c_str(), "rb");
+		uint8_t header[HEADER_SIZE];
+		uint8_t trailer[TRAILER_SIZE];
+		if(!file || fread(header, 1, HEADER_SIZE, file) != HEADER_SIZE || memcmp(header, "GBRC", 4) ||
+				get16(header + 4) != RECORDING_VERSION || (header[6] != INDEXED8 && header[6] != BGR555) ||
+				fseek(file, -TRAILER_SIZE, SEEK_END) || fread(trailer, 1, TRAILER_SIZE, file) != TRAILER_SIZE ||
+				memcmp(trailer + 8, "GBRX", 4)) {
+			close();
+			return;
+		}
+		format = static_cast<PixelFormat>(header[6]);
+		// Sizes read from the file are checked against it before anything
+		// is allocated for them.
+		uint64_t fileSize = ftell(file);
+		indexOffset = get64(trailer);
+		uint8_t count[4];
+		if(fileSize < HEADER_SIZE + 4 + TRAILER_SIZE || indexOffset < HEADER_SIZE || indexOffset > fileSize - TRAILER_SIZE - 4 ||
+				fseek(file, indexOffset, SEEK_SET) || fread(count, 1, 4, file) != 4 ||
+				get32(count) * 8ull + 4 + TRAILER_SIZE > fileSize - indexOffset) {
+			close();
+			return;
+		}
+		std::vector<uint8_t> index(get32(count) * 8ull);
+		if(fread(index.data(), 1, index.size(), file) != index.size()) {
+			close();
+			return;
+		}
+		// Records must follow each other, each with room for its header.
+		uint64_t next = HEADER_SIZE;
+		for(size_t i = 0; i < index.size(); i += 8) {
+			uint64_t offset = get64(index.data() + i);
+			if(offset < next || offset > indexOffset - 5) {
+				close();
+				return;
+			}
+			offsets.push_back(offset);
+			next = offset + 5;
+		}
+		types.resize(offsets.size());
+		for(size_t i = 0; i < offsets.size(); i++) {
+			int type;
+			if(fseek(file, offsets[i], SEEK_SET) || (type = fgetc(file)) == EOF ||
+					(type != RECORDING_KEYFRAME && type != RECORDING_DELTA) || (i == 0 && type != RECORDING_KEYFRAME)) {
+				close();
+				return;
+			}
+			types[i] = type;
+		}
+		frame.resize(packedSize(format));
+		delta.resize(frame.size());
+	}
+
+	RecordingReader::~RecordingReader() {
+		close();
+	}
+
+	void RecordingReader::close() {
+		if(file) {
+			fclose(file);
+			file = nullptr;
+		}
+		offsets.clear();
+		types.clear();
+	}
+
+	RecordingFrameType RecordingReader::getFrameType(int index) const {
+		return static_cast<RecordingFrameType>(types[index]);
+	}
+
+	bool RecordingReader::readFrame(int index, Framebuffer &out) {
+		if(!file || index < 0 || index >= getFrameCount()) {
+			return false;
+		}
+		int key = index;
+		while(types[key] != RECORDING_KEYFRAME && key > 0) {
+			key--;
+		}
+		if(index < current || current < key) {
+			current = key - 1;
+		}
+		while(current < index) {
+			if(!decodeNext()) {
+				current = -1;
+				return false;
+			}
+		}
+		out.setFormat(format);
+		unpackFrame(frame, out);
+		return true;
+	}
+
+	bool RecordingReader::decodeNext() {
+		uint8_t record[5];
+		fseek(file, offsets[current + 1], SEEK_SET);
+		if(fread(record, 1, sizeof(record), file) != sizeof(record)) {
+			return false;
+		}
+		uint64_t end = current + 2 < getFrameCount() ? offsets[current + 2] : indexOffset;
+		if(get32(record + 1) > end - offsets[current + 1] - sizeof(record)) {
+			return false;
+		}
+		payload.resize(get32(record + 1));
+		if(fread(payload.data(), 1, payload.size(), file) != payload.size()) {
+			return false;
+		}
+		if(record[0] == RECORDING_KEYFRAME) {
+			if(!decodeRuns(payload.data(), payload.size(), frame.data(), frame.size())) {
+				return false;
+			}
+		} else {
+			if(!decodeRuns(payload.data(), payload.size(), delta.data(), delta.size())) {
+				return false;
+			}
+			for(size_t i = 0; i < frame.size(); i++) {
+				frame[i] ^= delta[i];
+			}
+		}
+		current++;
+		return true;
+	}
+
+}
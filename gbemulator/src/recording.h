@@ -0,0 +1,96 @@
+#pragma once
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define RECORDING_VERSION 1
+#define RECORDING_KEY_INTERVAL 60
+
+namespace gbemulator {
+
+enum RecordingFrameType {
+	RECORDING_KEYFRAME = 0,
+	RECORDING_DELTA = 1
+};
+
+// Lossless frame recording. DMG frames are packed to 2 bits per pixel, CGB
+// frames kept as BGR555; each frame is stored XORed with the previous one
+// (or as-is for keyframes) and run-length coded, which leaves a few hundred
+// bytes for a typical frame. An index of frame offsets at the end of the
+// file allows seeking to any frame by decoding forward from the keyframe
+// before it.
+//
+// Layout, little-endian:
+//   "GBRC" u16 version, u8 pixel format, u8 pad, u16 width, u16 height,
+//     u16 key interval
+//   per frame: u8 type, u32 payload size, payload
+//   index: u32 frame count, u64 offset per frame
+//   trailer: u64 index offset, "GBRX"
+class RecordingWriter {
+public:
+	RecordingWriter(const std::string &path, PixelFormat format, int keyInterval = RECORDING_KEY_INTERVAL);
+	~RecordingWriter();
+	RecordingWriter(const RecordingWriter&) = delete;
+	RecordingWriter &operator=(const RecordingWriter&) = delete;
+	bool isOpen() const { return file; }
+	void addFrame(const Framebuffer &frame);
+	// Writes the index and trailer.
+	void close();
+	uint64_t getBytesWritten() const { return position; }
+
+private:
+	void put(const void *data, size_t size);
+
+	FILE *file;
+	PixelFormat format;
+	int keyInterval;
+	uint64_t position;
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t> previous;
+	std::vector<uint8_t> packed;
+	std::vector<uint8_t> encoded;
+};
+
+class RecordingReader {
+public:
+	RecordingReader(const std::string &path);
+	~RecordingReader();
+	RecordingReader(const RecordingReader&) = delete;
+	RecordingReader &operator=(const RecordingReader&) = delete;
+	bool isOpen() const { return file; }
+	PixelFormat getFormat() const { return format; }
+	int getFrameCount() const { return offsets.size(); }
+	RecordingFrameType getFrameType(int index) const;
+	// Sequential reads only decode one frame; seeking backwards or far
+	// ahead restarts from the nearest keyframe.
+	bool readFrame(int index, Framebuffer &out);
+
+private:
+	bool decodeNext();
+	void close();
+
+	FILE *file;
+	PixelFormat format;
+	uint64_t indexOffset;
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t> types;
+	int current;
+	std::vector<uint8_t> frame;
+	std::vector<uint8_t> delta;
+	std::vector<uint8_t> payload;
+};
+
+// Packs a frame to the recording's pixel layout and back.
+void packFrame(const Framebuffer &frame, std::vector<uint8_t> &out);
+void unpackFrame(const std::vector<uint8_t> &packed, Framebuffer &out);
+// PackBits-style coding: a control byte below 0x80 is followed by that many
+// plus one literal bytes; 0x80 and above repeats the next byte (c - 0x80 + 3)
+// times.
+void encodeRuns(const uint8_t *src, size_t size, std::vector<uint8_t> &out);
+bool decodeRuns(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize);
+
+}
@@ -1,15 +1,95 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+
+#define IO_REGISTERS 0x80
 
 namespace gbemulator {
 
+// Offsets from 0xFF00.
+enum IoRegister {
+	REG_P1    = 0x00,
+	REG_IF    = 0x0F,
+	REG_NR10  = 0x10,
+	REG_NR11  = 0x11,
+	REG_NR12  = 0x12,
+	REG_NR13  = 0x13,
+	REG_NR14  = 0x14,
+	REG_NR21  = 0x16,
+	REG_NR22  = 0x17,
+	REG_NR23  = 0x18,
+	REG_NR24  = 0x19,
+	REG_NR30  = 0x1A,
+	REG_NR31  = 0x1B,
+	REG_NR32  = 0x1C,
+	REG_NR33  = 0x1D,
+	REG_NR34  = 0x1E,
+	REG_NR41  = 0x20,
+	REG_NR42  = 0x21,
+	REG_NR43  = 0x22,
+	REG_NR44  = 0x23,
+	REG_NR50  = 0x24,
+	REG_NR51  = 0x25,
+	REG_NR52  = 0x26,
+	REG_WAVE  = 0x30,
+	REG_LCDC  = 0x40,
+	REG_STAT  = 0x41,
+	REG_SCY   = 0x42,
+	REG_SCX   = 0x43,
+	REG_LY    = 0x44,
+	REG_LYC   = 0x45,
+	REG_DMA   = 0x46,
+	REG_BGP   = 0x47,
+	REG_OBP0  = 0x48,
+	REG_OBP1  = 0x49,
+	REG_WY    = 0x4A,
+	REG_WX    = 0x4B,
+	REG_KEY1  = 0x4D,
+	REG_VBK   = 0x4F,
+	REG_HDMA1 = 0x51,
+	REG_HDMA2 = 0x52,
+	REG_HDMA3 = 0x53,
+	REG_HDMA4 = 0x54,
+	REG_HDMA5 = 0x55,
+	REG_BCPS  = 0x68,
+	REG_BCPD  = 0x69,
+	REG_OCPS  = 0x6A,
+	REG_OCPD  = 0x6B,
+	REG_SVBK  = 0x70,
+	REG_IE    = 0xFF
+};
+
+enum Interrupt {
+	INT_VBLANK = 0,
+	INT_STAT   = 1,
+	INT_TIMER  = 2,
+	INT_SERIAL = 3,
+	INT_JOYPAD = 4
+};
+
+// I/O registers at 0xFF00-0xFF7F. Components register write handlers for the
+// registers they own; everything else is stored as-is.
 class RegisterMap {
 public:
+	typedef std::function<void(uint8_t)> WriteHandler;
+
 	RegisterMap(uint8_t *addr) : addr(addr) {}
+	uint8_t get(int reg) const { return addr[reg]; }
+	void set(int reg, uint8_t val) { addr[reg] = val; }
+	void write(int reg, uint8_t val) {
+		if(handlers[reg]) {
+			handlers[reg](val);
+		} else {
+			addr[reg] = val;
+		}
+	}
+	void onWrite(int reg, WriteHandler handler) { handlers[reg] = handler; }
+	void requestInterrupt(Interrupt i) { addr[REG_IF] |= 1 << i; }
 
 private:
 	uint8_t *addr;
+	WriteHandler handlers[IO_REGISTERS];
 };
 
 }
@@ -0,0 +1,247 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
+// Passband edge as a fraction of the lower Nyquist frequency.
+#define CUTOFF 0.9
+
+namespace gbemulator {
+
+	// Dot products of both channels' history with two adjacent phases:
+	// out = {left.c0, left.c1, right.c0, right.c1}. n is a multiple of 8.
+	typedef void (*DotKernel)(const float *left, const float *right, const float *c0, const float *c1,
+			int n, float out[4]);
+
+	static void dotScalar(const float *left, const float *right, const float *c0, const float *c1,
+			int n, float out[4]) {
+		float s[4] = {0, 0, 0, 0};
+		for(int i = 0; i < n; i++) {
+			s[0] += left[i] * c0[i];
+			s[1] += left[i] * c1[i];
+			s[2] += right[i] * c0[i];
+			s[3] += right[i] * c1[i];
+		}
+		std::copy(s, s + 4, out);
+	}
+
+#if defined(__SSE2__)
+	static inline float sum4(__m128 v) {
+		__m128 hi = _mm_movehl_ps(v, v);
+		v = _mm_add_ps(v, hi);
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+		return _mm_cvtss_f32(v);
+	}
+
+	static void dotSse2(const float *left, const float *right, const float *c0, const float *c1,
+			int n, float out[4]) {
+		__m128 s0 = _mm_setzero_ps();
+		__m128 s1 = _mm_setzero_ps();
+		__m128 s2 = _mm_setzero_ps();
+		__m128 s3 = _mm_setzero_ps();
+		for(int i = 0; i < n; i += 4) {
+			__m128 l = _mm_loadu_ps(left + i);
+			__m128 r = _mm_loadu_ps(right + i);
+			__m128 a = _mm_loadu_ps(c0 + i);
+			__m128 b = _mm_loadu_ps(c1 + i);
+			s0 = _mm_add_ps(s0, _mm_mul_ps(l, a));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(l, b));
+			s2 = _mm_add_ps(s2, _mm_mul_ps(r, a));
+			s3 = _mm_add_ps(s3, _mm_mul_ps(r, b));
+		}
+		out[0] = sum4(s0);
+		out[1] = sum4(s1);
+		out[2] = sum4(s2);
+		out[3] = sum4(s3);
+	}
+#endif
+
+#if defined(HAVE_AVX2_KERNEL)
+	// Compiled for AVX2 regardless of the build flags; only called after a
+	// runtime CPU check.
+	__attribute__((target("avx2,fma")))
+	static inline float sum8(__m256 v) {
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+
+	__attribute__((target("avx2,fma")))
+	static void dotAvx2(const float *left, const float *right, const float *c0, const float *c1,
+			int n, float out[4]) {
+		__m256 s0 = _mm256_setzero_ps();
+		__m256 s1 = _mm256_setzero_ps();
+		__m256 s2 = _mm256_setzero_ps();
+		__m256 s3 = _mm256_setzero_ps();
+		for(int i = 0; i < n; i += 8) {
+			__m256 l = _mm256_loadu_ps(left + i);
+			__m256 r = _mm256_loadu_ps(right + i);
+			__m256 a = _mm256_loadu_ps(c0 + i);
+			__m256 b = _mm256_loadu_ps(c1 + i);
+			s0 = _mm256_fmadd_ps(l, a, s0);
+			s1 = _mm256_fmadd_ps(l, b, s1);
+			s2 = _mm256_fmadd_ps(r, a, s2);
+			s3 = _mm256_fmadd_ps(r, b, s3);
+		}
+		out[0] = sum8(s0);
+		out[1] = sum8(s1);
+		out[2] = sum8(s2);
+		out[3] = sum8(s3);
+	}
+#endif
+
+	static DotKernel dotKernel(ResamplerKernel kernel) {
+		switch(kernel) {
+#if defined(HAVE_AVX2_KERNEL)
+		case KERNEL_AVX2:
+			return dotAvx2;
+#endif
+#if defined(__SSE2__)
+		case KERNEL_SSE2:
+			return dotSse2;
+#endif
+		default:
+			return dotScalar;
+		}
+	}
+
+	Resampler::Resampler(double inputRate, double outputRate) : adjust(0), kernel(bestKernel()) {
+		setRates(inputRate, outputRate);
+	}
+
+	bool Resampler::isSupported(ResamplerKernel kernel) {
+		switch(kernel) {
+		case KERNEL_AVX2:
+#if defined(HAVE_AVX2_KERNEL)
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+			return false;
+#endif
+		case KERNEL_SSE2:
+#if defined(__SSE2__)
+			return true;
+#else
+			return false;
+#endif
+		default:
+			return true;
+		}
+	}
+
+	ResamplerKernel Resampler::bestKernel() {
+		if(isSupported(KERNEL_AVX2)) {
+			return KERNEL_AVX2;
+		}
+		return isSupported(KERNEL_SSE2) ? KERNEL_SSE2 : KERNEL_SCALAR;
+	}
+
+	void Resampler::setKernel(ResamplerKernel kernel) {
+		this->kernel = isSupported(kernel) ? kernel : bestKernel();
+	}
+
+	void Resampler::setRates(double inputRate, double outputRate) {
+		this->inputRate = inputRate;
+		this->outputRate = outputRate;
+		buildFilter();
+		setAdjust(adjust);
+		clear();
+	}
+
+	void Resampler::setAdjust(double adjust) {
+		this->adjust = adjust;
+		step = inputRate / (outputRate * (1 + adjust));
+	}
+
+	// Blackman-windowed sinc, one row per phase plus a closing row so the
+	// last phase can blend towards the next input sample.
+	void Resampler::buildFilter() {
+		const double pi = 3.14159265358979323846;
+		double ratio = std::min(1.0, outputRate / inputRate);
+		taps = static_cast<int>(std::ceil(RESAMPLER_BASE_TAPS / ratio / 8)) * 8;
+		double fc = 0.5 * ratio * CUTOFF;
+		int half = taps / 2;
+		coeffs.assign((RESAMPLER_PHASES + 1) * taps, 0.0f);
+		for(int p = 0; p <= RESAMPLER_PHASES; p++) {
+			double frac = static_cast<double>(p) / RESAMPLER_PHASES;
+			std::vector<double> row(taps);
+			double sum = 0;
+			for(int k = 0; k < taps; k++) {
+				double x = k - (half - 1) - frac;
+				double t = 2 * fc * x;
+				double sinc = t == 0 ? 1.0 : std::sin(pi * t) / (pi * t);
+				double w = std::abs(x) >= half ? 0.0 :
+						0.42 + 0.5 * std::cos(pi * x / half) + 0.08 * std::cos(2 * pi * x / half);
+				row[k] = sinc * w;
+				sum += row[k];
+			}
+			for(int k = 0; k < taps; k++) {
+				coeffs[p * taps + k] = static_cast<float>(row[k] / sum);
+			}
+		}
+	}
+
+	// The history starts with enough silence that the first output frame
+	// lines up with the first input frame.
+	void Resampler::clear() {
+		for(int c = 0; c < RESAMPLER_CHANNELS; c++) {
+			history[c].assign(taps / 2 - 1, 0.0f);
+		}
+		pos = taps / 2 - 1;
+	}
+
+	void Resampler::push(const int16_t *in, int frames) {
+		for(int c = 0; c < RESAMPLER_CHANNELS; c++) {
+			std::vector<float> &h = history[c];
+			size_t size = h.size();
+			h.resize(size + frames);
+			for(int i = 0; i < frames; i++) {
+				h[size + i] = in[i * RESAMPLER_CHANNELS + c];
+			}
+		}
+	}
+
+	int Resampler::pull(int16_t *out, int maxFrames) {
+		DotKernel dot = dotKernel(kernel);
+		const int half = taps / 2;
+		const int size = history[0].size();
+		int produced = 0;
+		while(produced < maxFrames) {
+			int index = static_cast<int>(pos);
+			if(index + half >= size) {
+				break;
+			}
+			double phase = (pos - index) * RESAMPLER_PHASES;
+			int p = static_cast<int>(phase);
+			float blend = static_cast<float>(phase - p);
+			int base = index - (half - 1);
+			float s[4];
+			dot(history[0].data() + base, history[1].data() + base, &coeffs[p * taps], &coeffs[(p + 1) * taps],
+					taps, s);
+			for(int c = 0; c < RESAMPLER_CHANNELS; c++) {
+				float v = s[c * 2] + (s[c * 2 + 1] - s[c * 2]) * blend;
+				v = std::max(-32768.0f, std::min(32767.0f, v));
+				out[produced * RESAMPLER_CHANNELS + c] = static_cast<int16_t>(std::lround(v));
+			}
+			produced++;
+			pos += step;
+		}
+		int drop = std::min(static_cast<int>(pos) - (half - 1), size);
+		if(drop > 0) {
+			for(int c = 0; c < RESAMPLER_CHANNELS; c++) {
+				history[c].erase(history[c].begin(), history[c].begin() + drop);
+			}
+			pos -= drop;
+		}
+		return produced;
+	}
+
+}
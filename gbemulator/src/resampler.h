@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define RESAMPLER_PHASES 128
+// Taps per phase when upsampling; scaled by the ratio when downsampling so
+// the transition band stays the same width at the output rate.
+#define RESAMPLER_BASE_TAPS 48
+#define RESAMPLER_CHANNELS 2
+
+namespace gbemulator {
+
+enum ResamplerKernel {
+	KERNEL_SCALAR = 0,
+	KERNEL_SSE2,
+	KERNEL_AVX2
+};
+
+// Polyphase FIR resampler for interleaved stereo int16 audio. Each output
+// sample is the blend of the two filter phases around its fractional input
+// position, so the ratio can be changed freely between calls; setAdjust()
+// nudges it by a few parts per thousand for audio/video sync without
+// rebuilding the filter.
+class Resampler {
+public:
+	Resampler(double inputRate, double outputRate);
+	// Rebuilds the filter and resets the stream.
+	void setRates(double inputRate, double outputRate);
+	// Scales the output rate by 1 + adjust.
+	void setAdjust(double adjust);
+	double getAdjust() const { return adjust; }
+	double getInputRate() const { return inputRate; }
+	double getOutputRate() const { return outputRate; }
+	int getTaps() const { return taps; }
+	// Unsupported kernels fall back to the best available one.
+	void setKernel(ResamplerKernel kernel);
+	ResamplerKernel getKernel() const { return kernel; }
+	static ResamplerKernel bestKernel();
+	static bool isSupported(ResamplerKernel kernel);
+
+	void push(const int16_t *in, int frames);
+	// Produces as many output frames as the buffered input allows.
+	int pull(int16_t *out, int maxFrames);
+	void clear();
+
+private:
+	void buildFilter();
+
+	double inputRate;
+	double outputRate;
+	double adjust;
+	double step;
+	double pos;
+	int taps;
+	ResamplerKernel kernel;
+	std::vector<float> coeffs;
+	std::vector<float> history[RESAMPLER_CHANNELS];
+};
+
+}
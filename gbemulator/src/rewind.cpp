@@ -0,0 +1,116 @@
+#include "rewind.h"
+
+#include "lz.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace gbemulator {
+
+	// dst = a ^ b, a word at a time.
+	static void xorBytes(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t size) {
+		size_t i = 0;
+		for(; i + 8 <= size; i += 8) {
+			uint64_t x, y;
+			memcpy(&x, a + i, 8);
+			memcpy(&y, b + i, 8);
+			x ^= y;
+			memcpy(dst + i, &x, 8);
+		}
+		for(; i < size; i++) {
+			dst[i] = a[i] ^ b[i];
+		}
+	}
+
+	static double microsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	Rewind::Rewind(size_t budget) : storage(budget), head(0), used(0), pushed(0), pushedBytes(0),
+			lastPushUs(0), lastStepUs(0) {}
+
+	void Rewind::clear() {
+		entries.clear();
+		head = 0;
+		used = 0;
+		state.clear();
+	}
+
+	// Entries are laid out in push order around the ring, so the oldest one
+	// always starts at or after the write position.
+	bool Rewind::reserve(size_t size) {
+		if(size > storage.size()) {
+			return false;
+		}
+		if(head + size > storage.size()) {
+			while(!entries.empty() && entries.front().offset >= head) {
+				used -= entries.front().size;
+				entries.pop_front();
+			}
+			head = 0;
+		}
+		while(!entries.empty() && entries.front().offset >= head && entries.front().offset < head + size) {
+			used -= entries.front().size;
+			entries.pop_front();
+		}
+		return true;
+	}
+
+	void Rewind::push(const uint8_t *next, size_t size) {
+		auto start = std::chrono::steady_clock::now();
+		if(size != state.size()) {
+			clear();
+			state.assign(next, next + size);
+			delta.resize(size);
+			packed.resize(lzBound(size));
+			return;
+		}
+		xorBytes(delta.data(), state.data(), next, size);
+		size_t packedSize = lzCompress(delta.data(), size, packed.data(), packed.size());
+		if(!reserve(packedSize)) {
+			// One delta larger than the whole budget: keep only this frame.
+			clear();
+			state.assign(next, next + size);
+			return;
+		}
+		memcpy(&storage[head], packed.data(), packedSize);
+		entries.push_back({head, packedSize});
+		head += packedSize;
+		used += packedSize;
+		memcpy(state.data(), next, size);
+		pushed++;
+		pushedBytes += packedSize;
+		lastPushUs = microsSince(start);
+	}
+
+	const uint8_t *Rewind::stepBack() {
+		if(entries.empty()) {
+			return nullptr;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Entry entry = entries.back();
+		entries.pop_back();
+		head = entry.offset;
+		used -= entry.size;
+		if(lzDecompress(&storage[entry.offset], entry.size, delta.data(), delta.size()) != state.size()) {
+			clear();
+			return nullptr;
+		}
+		xorBytes(state.data(), state.data(), delta.data(), state.size());
+		lastStepUs = microsSince(start);
+		return state.data();
+	}
+
+	RewindStats Rewind::getStats() const {
+		RewindStats stats;
+		stats.frames = entries.size();
+		stats.deltaBytes = used;
+		stats.budget = storage.size();
+		stats.memory = storage.size() + state.capacity() + delta.capacity() + packed.capacity();
+		stats.averageDeltaBytes = pushed ? static_cast<double>(pushedBytes) / pushed : 0;
+		stats.lastPushUs = lastPushUs;
+		stats.lastStepUs = lastStepUs;
+		return stats;
+	}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#define REWIND_DEFAULT_BUDGET (16 << 20)
+
+namespace gbemulator {
+
+struct RewindStats {
+	int frames;
+	// Compressed deltas held, against the ring's budget.
+	size_t deltaBytes;
+	size_t budget;
+	// Everything the rewinder allocates: the ring plus raw state buffers.
+	size_t memory;
+	double averageDeltaBytes;
+	double lastPushUs;
+	double lastStepUs;
+};
+
+// Rewind history over save states. The newest state is kept raw; every
+// older frame is stored as the XOR of its state with its successor's,
+// LZ-compressed into a fixed size byte ring. Consecutive states differ in
+// a few blocks, so deltas are mostly zero runs and compress to a few
+// hundred bytes. Stepping back decompresses and applies the newest delta;
+// when the ring is full the oldest frames are dropped.
+class Rewind {
+public:
+	Rewind(size_t budget = REWIND_DEFAULT_BUDGET);
+	// Records a frame. States must all be the same size; a size change
+	// (e.g. another cartridge) starts a new history.
+	void push(const uint8_t *state, size_t size);
+	// Returns the previous frame's state, now the newest, or null when no
+	// older frame is left. Valid until the next push or step.
+	const uint8_t *stepBack();
+	// The newest state, or null if nothing was pushed.
+	const uint8_t *current() const { return state.empty() ? nullptr : state.data(); }
+	size_t getStateSize() const { return state.size(); }
+	// Frames that can be stepped back.
+	int getFrames() const { return entries.size(); }
+	void clear();
+	RewindStats getStats() const;
+
+private:
+	struct Entry {
+		size_t offset;
+		size_t size;
+	};
+
+	// Drops the oldest entries until size bytes fit at the write position.
+	bool reserve(size_t size);
+
+	std::vector<uint8_t> storage;
+	std::deque<Entry> entries;
+	size_t head;
+	size_t used;
+	std::vector<uint8_t> state;
+	std::vector<uint8_t> delta;
+	std::vector<uint8_t> packed;
+	uint64_t pushed;
+	uint64_t pushedBytes;
+	double lastPushUs;
+	double lastStepUs;
+};
+
+}
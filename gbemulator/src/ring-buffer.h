@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+namespace gbemulator {
+
+// What a consumer does when fewer elements are ready than it asked for.
+enum RingPolicy {
+	// Take what is there and pad with T(), counting the shortfall as an
+	// underflow. For real-time playback.
+	RING_DROP,
+	// Wait until the request can be filled or the buffer is closed. For
+	// consumers such as file writers that must see every sample.
+	RING_BLOCK
+};
+
+// Lock-free single-producer single-consumer queue. The producer never
+// waits: elements that do not fit are dropped and counted as overflows.
+// Each side's index and counter sit on their own cache line so the two
+// threads only share a line when one reads the other's index.
+template<class T>
+class RingBuffer {
+public:
+	// The capacity is rounded up to a power of two.
+	RingBuffer(size_t capacity) : overflows(0), underflows(0), closed(false) {
+		size_t size = 1;
+		while(size < capacity) {
+			size <<= 1;
+		}
+		buffer.resize(size);
+		mask = size - 1;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer &operator=(const RingBuffer&) = delete;
+
+	// Producer side. Returns the number of elements queued.
+	size_t write(const T *data, size_t count) {
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t space = buffer.size() - (h - tail.load(std::memory_order_acquire));
+		if(count > space) {
+			overflows.fetch_add(count - space, std::memory_order_relaxed);
+			count = space;
+		}
+		for(size_t i = 0; i < count; i++) {
+			buffer[(h + i) & mask] = data[i];
+		}
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer side. Always fills count elements of out under RING_DROP;
+	// returns the number that came from the producer.
+	size_t read(T *out, size_t count, RingPolicy policy = RING_DROP) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t ready = head.load(std::memory_order_acquire) - t;
+		if(policy == RING_BLOCK) {
+			while(ready < count && !closed.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+				ready = head.load(std::memory_order_acquire) - t;
+			}
+		}
+		size_t got = ready < count ? ready : count;
+		for(size_t i = 0; i < got; i++) {
+			out[i] = buffer[(t + i) & mask];
+		}
+		tail.store(t + got, std::memory_order_release);
+		if(policy == RING_DROP && got < count) {
+			underflows.fetch_add(count - got, std::memory_order_relaxed);
+			for(size_t i = got; i < count; i++) {
+				out[i] = T();
+			}
+		}
+		return got;
+	}
+
+	size_t available() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+	size_t capacity() const { return buffer.size(); }
+	uint64_t getOverflows() const { return overflows.load(std::memory_order_relaxed); }
+	uint64_t getUnderflows() const { return underflows.load(std::memory_order_relaxed); }
+	// Releases a blocked consumer, e.g. when emulation stops.
+	void close() { closed.store(true, std::memory_order_release); }
+	bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+private:
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	std::atomic<uint64_t> overflows;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	std::atomic<uint64_t> underflows;
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> closed;
+	std::vector<T> buffer;
+	size_t mask;
+};
+
+typedef RingBuffer<int16_t> AudioRing;
+
+}
@@ -0,0 +1,63 @@
+#include "save-state.h"
+
+#define ALIGN_UP(X) (((X) + STATE_ALIGN - 1) & ~static_cast<size_t>(STATE_ALIGN - 1))
+
+namespace gbemulator {
+
+	StateWriter::StateWriter(uint8_t *buffer, size_t capacity, uint32_t skip) : buffer(buffer), capacity(capacity),
+			used(ALIGN_UP(sizeof(StateHeader))), skip(skip), overflow(false) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "GBST", 4);
+		header.version = STATE_VERSION;
+		header.sections = STATE_SECTIONS;
+	}
+
+	// Alignment gaps are zeroed so equal states are equal byte for byte.
+	void *StateWriter::section(StateSectionId id, size_t size) {
+		if(skip & (1u << id)) {
+			return nullptr;
+		}
+		size_t offset = used;
+		used = ALIGN_UP(offset + size);
+		header.section[id].offset = offset;
+		header.section[id].size = size;
+		if(!buffer || used > capacity) {
+			overflow = buffer;
+			return nullptr;
+		}
+		memset(buffer + offset + size, 0, used - offset - size);
+		return buffer + offset;
+	}
+
+	size_t StateWriter::finish() {
+		header.size = used;
+		if(buffer && !overflow && used <= capacity) {
+			memcpy(buffer, &header, sizeof(header));
+			memset(buffer + sizeof(header), 0, ALIGN_UP(sizeof(header)) - sizeof(header));
+			return used;
+		}
+		return buffer ? 0 : used;
+	}
+
+	StateReader::StateReader(const uint8_t *buffer, size_t size) : buffer(buffer),
+			header(reinterpret_cast<const StateHeader*>(buffer)), valid(false) {
+		if(size < sizeof(StateHeader) || memcmp(header->magic, "GBST", 4) || header->version != STATE_VERSION ||
+				header->sections != STATE_SECTIONS || header->size > size) {
+			return;
+		}
+		for(int i = 0; i < STATE_SECTIONS; i++) {
+			if(header->section[i].offset + static_cast<uint64_t>(header->section[i].size) > header->size) {
+				return;
+			}
+		}
+		valid = true;
+	}
+
+	const void *StateReader::section(StateSectionId id, size_t size) const {
+		if(!valid || header->section[id].size != size || header->section[id].offset == 0) {
+			return nullptr;
+		}
+		return buffer + header->section[id].offset;
+	}
+
+}
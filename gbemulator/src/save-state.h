@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define STATE_VERSION 2
+#define STATE_ALIGN 64
+
+namespace gbemulator {
+
+enum StateSectionId {
+	STATE_CPU = 0,
+	STATE_MEMORY,
+	STATE_HIGH_MEMORY,
+	STATE_MEMORY_FLAGS,
+	STATE_VRAM,
+	STATE_WRAM,
+	STATE_CARTRIDGE,
+	STATE_CARTRIDGE_RAM,
+	STATE_SCHEDULER,
+	STATE_PPU,
+	STATE_PPU_PIPELINE,
+	STATE_PALETTE,
+	STATE_DMA,
+	STATE_HDMA,
+	STATE_APU,
+	STATE_JOYPAD,
+	STATE_SECTIONS
+};
+
+// Sections holding RAM images rather than component state.
+#define STATE_RAM_SECTIONS ((1u << STATE_MEMORY) | (1u << STATE_HIGH_MEMORY) | (1u << STATE_VRAM) | \
+	(1u << STATE_WRAM) | (1u << STATE_CARTRIDGE_RAM))
+
+struct StateSection {
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct StateHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t size;
+	uint32_t sections;
+	StateSection section[STATE_SECTIONS];
+};
+
+// Save state layout: a header with a directory of sections, then each
+// section's bytes at a 64-byte aligned offset. Sections are raw memory
+// images (RAM regions, plain structs) so saving and loading are memcpy
+// calls and a mapped file can be read in place. Struct layouts follow the
+// build, so states move between builds of the same version on the same ABI
+// only; a size mismatch rejects the state.
+class StateWriter {
+public:
+	// A null buffer only measures the size a state needs. Sections in skip
+	// (a mask of 1 << StateSectionId) are left out, e.g. RAM when hashing.
+	StateWriter(uint8_t *buffer, size_t capacity, uint32_t skip = 0);
+	// Reserves a section and returns where to write it, or null when
+	// measuring, skipped or out of space.
+	void *section(StateSectionId id, size_t size);
+	// A struct section, zeroed first so its padding bytes are the same in
+	// every state.
+	template<class T> T *section(StateSectionId id) {
+		void *dst = section(id, sizeof(T));
+		if(dst) {
+			memset(dst, 0, sizeof(T));
+		}
+		return static_cast<T*>(dst);
+	}
+	void put(StateSectionId id, const void *data, size_t size) {
+		void *dst = section(id, size);
+		if(dst) {
+			memcpy(dst, data, size);
+		}
+	}
+	// Finishes the header; returns the state's size, or 0 if it did not fit.
+	size_t finish();
+
+private:
+	uint8_t *buffer;
+	size_t capacity;
+	size_t used;
+	uint32_t skip;
+	bool overflow;
+	StateHeader header;
+};
+
+class StateReader {
+public:
+	StateReader(const uint8_t *buffer, size_t size);
+	bool isValid() const { return valid; }
+	size_t getSize() const { return valid ? header->size : 0; }
+	// Returns the section's bytes, or null if it is missing or its size
+	// differs from what this build expects.
+	const void *section(StateSectionId id, size_t size) const;
+	bool get(StateSectionId id, void *data, size_t size) const {
+		const void *src = section(id, size);
+		if(src) {
+			memcpy(data, src, size);
+		}
+		return src;
+	}
+	template<class T> bool get(StateSectionId id, T &value) const { return get(id, &value, sizeof(T)); }
+	// True for sections the writer was told to skip.
+	bool isSkipped(StateSectionId id) const { return valid && header->section[id].offset == 0; }
+
+private:
+	const uint8_t *buffer;
+	const StateHeader *header;
+	bool valid;
+};
+
+}
@@ -0,0 +1,193 @@
+#include "scanline-ppu.h"
+
+#include <algorithm>
+
+namespace gbemulator {
+
+	ScanlinePpu::ScanlinePpu(MemoryMap *memory, Framebuffer *framebuffer, Scheduler *scheduler)
+			: PpuBase(memory, framebuffer, scheduler) {
+		scheduler->setHandler(EVENT_PPU, [this](uint64_t due) { onEvent(due); });
+		io->onWrite(REG_LCDC, [this](uint8_t val) {
+			bool wasEnabled = enabled;
+			writeLcdc(val);
+			if(enabled && !wasEnabled) {
+				this->scheduler->scheduleIn(EVENT_PPU, OAM_SCAN_DOTS);
+			} else if(!enabled) {
+				this->scheduler->cancel(EVENT_PPU);
+			}
+		});
+		scheduler->scheduleIn(EVENT_PPU, OAM_SCAN_DOTS);
+	}
+
+	void ScanlinePpu::onEvent(uint64_t due) {
+		switch(mode) {
+			case MODE_OAM_SCAN: {
+				Sprite sprites[MAX_LINE_SPRITES];
+				int count = (reg(REG_LCDC) & LCDC_OBJ_ENABLE) ? scanOam(sprites) : 0;
+				int length = mode3Length(sprites, count);
+				setMode(MODE_TRANSFER);
+				if(render) {
+					renderLine(sprites, count);
+				}
+				// Kept outside renderLine so skipped lines leave the same state.
+				if(windowVisible() && reg(REG_WX) - 7 < SCREEN_WIDTH) {
+					windowLine++;
+				}
+				scheduler->schedule(EVENT_PPU, due + length);
+				dot = OAM_SCAN_DOTS + length;
+				break;
+			}
+			case MODE_TRANSFER:
+				setMode(MODE_HBLANK);
+				scheduler->schedule(EVENT_PPU, due + DOTS_PER_LINE - dot);
+				break;
+			case MODE_HBLANK:
+				setLy(ly + 1);
+				if(ly == VISIBLE_LINES) {
+					enterVBlank();
+					scheduler->schedule(EVENT_PPU, due + DOTS_PER_LINE);
+				} else {
+					beginLine();
+					scheduler->schedule(EVENT_PPU, due + OAM_SCAN_DOTS);
+				}
+				break;
+			case MODE_VBLANK:
+				if(ly == LINES_PER_FRAME - 1) {
+					setLy(0);
+					beginLine();
+					scheduler->schedule(EVENT_PPU, due + OAM_SCAN_DOTS);
+				} else {
+					setLy(ly + 1);
+					scheduler->schedule(EVENT_PPU, due + DOTS_PER_LINE);
+				}
+				break;
+		}
+	}
+
+	int ScanlinePpu::mode3Length(const Sprite *sprites, int count) const {
+		int length = MODE3_MIN_DOTS + (reg(REG_SCX) & 7);
+		int windowX = windowVisible() ? reg(REG_WX) - 7 : SCREEN_WIDTH;
+		if(windowX < SCREEN_WIDTH) {
+			length += 6;
+		}
+		// Each sprite costs 6 dots, plus a wait for the background fetcher
+		// the first time a sprite lands on a given tile.
+		bool tileSeen[64] = {};
+		for(int i = 0; i < count; i++) {
+			int x = sprites[i].x;
+			if(x >= SCREEN_WIDTH + 8) {
+				continue;
+			}
+			int left = x - 8;
+			int offset, tile;
+			if(left >= windowX) {
+				offset = (left - windowX) & 7;
+				tile = 32 + (left - windowX) / 8;
+			} else {
+				offset = (left + reg(REG_SCX)) & 7;
+				tile = (left + (reg(REG_SCX) & 7) + 8) / 8;
+			}
+			if(!tileSeen[tile]) {
+				tileSeen[tile] = true;
+				length += offset < 5 ? 5 - offset : 0;
+			}
+			length += 6;
+		}
+		return length;
+	}
+
+	void ScanlinePpu::renderLine(const Sprite *lineSprites, int count) {
+		uint8_t lcdc = reg(REG_LCDC);
+		bool cgb = memory->isCgb();
+		uint8_t bgColor[SCREEN_WIDTH] = {};
+		uint8_t bgAttrs[SCREEN_WIDTH] = {};
+		// DMG shades, or CGB palette cache indices.
+		uint8_t pixels[SCREEN_WIDTH];
+
+		// On CGB, LCDC bit 0 only removes background priority.
+		if(cgb || (lcdc & LCDC_BG_ENABLE)) {
+			int y = (ly + reg(REG_SCY)) & 0xFF;
+			int scx = reg(REG_SCX);
+			int windowX = windowVisible() ? reg(REG_WX) - 7 : SCREEN_WIDTH;
+			uint8_t lo = 0, hi = 0, attrs = 0;
+			for(int x = 0; x < windowX && x < SCREEN_WIDTH; x++) {
+				int mapX = (x + scx) & 0xFF;
+				if(x == 0 || (mapX & 7) == 0) {
+					bgTileRow(false, mapX, y, lo, hi, attrs);
+				}
+				bgColor[x] = colorAt(lo, hi, 7 - (mapX & 7));
+				bgAttrs[x] = attrs;
+			}
+			if(windowX < SCREEN_WIDTH) {
+				for(int x = windowX < 0 ? 0 : windowX; x < SCREEN_WIDTH; x++) {
+					int mapX = x - windowX;
+					if(x == 0 || (mapX & 7) == 0) {
+						bgTileRow(true, mapX, windowLine, lo, hi, attrs);
+					}
+					bgColor[x] = colorAt(lo, hi, 7 - (mapX & 7));
+					bgAttrs[x] = attrs;
+				}
+			}
+		}
+		uint8_t bgp = reg(REG_BGP);
+		for(int x = 0; x < SCREEN_WIDTH; x++) {
+			pixels[x] = cgb ? (bgAttrs[x] & 7) * 4 + bgColor[x] : shade(bgp, bgColor[x]);
+		}
+
+		Sprite sprites[MAX_LINE_SPRITES];
+		std::copy(lineSprites, lineSprites + count, sprites);
+		// On DMG lower X wins, then lower OAM index; on CGB only OAM order
+		// counts. The first opaque sprite pixel claims its position even when
+		// it ends up hidden behind the background.
+		for(int i = 1; i < count && !cgb; i++) {
+			Sprite s = sprites[i];
+			int j = i;
+			while(j > 0 && sprites[j - 1].x > s.x) {
+				sprites[j] = sprites[j - 1];
+				j--;
+			}
+			sprites[j] = s;
+		}
+		bool bgPriority = !cgb || (lcdc & LCDC_BG_ENABLE);
+		bool claimed[SCREEN_WIDTH] = {};
+		for(int i = 0; i < count; i++) {
+			const Sprite &sprite = sprites[i];
+			uint8_t lo, hi;
+			spriteRow(sprite, lo, hi);
+			uint8_t obp = reg((sprite.attrs & 0x10) ? REG_OBP1 : REG_OBP0);
+			for(int p = 0; p < 8; p++) {
+				int x = sprite.x - 8 + p;
+				if(x < 0 || x >= SCREEN_WIDTH || claimed[x]) {
+					continue;
+				}
+				int color = colorAt(lo, hi, 7 - p);
+				if(color == 0) {
+					continue;
+				}
+				claimed[x] = true;
+				bool behind = (sprite.attrs & 0x80) || (bgAttrs[x] & 0x80);
+				if(bgPriority && behind && bgColor[x] != 0) {
+					continue;
+				}
+				pixels[x] = cgb ? OBJ_PALETTE_BASE + (sprite.attrs & 7) * 4 + color : shade(obp, color);
+			}
+		}
+
+		if(cgb) {
+			uint16_t *out = framebuffer->colorLine(ly);
+			for(int x = 0; x < SCREEN_WIDTH; x++) {
+				out[x] = palette.color(pixels[x]);
+			}
+			if(framebuffer->hasHostColors()) {
+				const uint32_t *colors = palette.getHostColors();
+				uint32_t *host = framebuffer->hostLine(ly);
+				for(int x = 0; x < SCREEN_WIDTH; x++) {
+					host[x] = colors[pixels[x]];
+				}
+			}
+		} else {
+			std::copy(pixels, pixels + SCREEN_WIDTH, framebuffer->indexedLine(ly));
+		}
+	}
+
+}
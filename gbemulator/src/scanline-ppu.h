@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ppu.h"
+
+namespace gbemulator {
+
+// Renders each line in one pass at the start of Mode 3. Fast, but register
+// writes made during Mode 3 only take effect on the next line. Mode changes
+// are scheduler events; Mode 3 length is computed per line rather than
+// stepped, so STAT timing still follows SCX, the window and sprites.
+class ScanlinePpu : public PpuBase {
+public:
+	ScanlinePpu(MemoryMap *memory, Framebuffer *framebuffer, Scheduler *scheduler);
+	void tick(int) {}
+	// Mode 3 length in dots for the current line.
+	int mode3Length(const Sprite *sprites, int count) const;
+
+private:
+	void onEvent(uint64_t due);
+	void renderLine(const Sprite *sprites, int count);
+};
+
+}
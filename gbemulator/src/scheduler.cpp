@@ -0,0 +1,69 @@
+#include "scheduler.h"
+
+#include <cstring>
+
+namespace gbemulator {
+
+	Scheduler::Scheduler() : timestamp(0), nextTime(NEVER), nextEvent(0), speedShift(0) {
+		for(int i = 0; i < EVENT_COUNT; i++) {
+			events[i] = NEVER;
+		}
+	}
+
+	void Scheduler::schedule(EventType type, uint64_t when) {
+		events[type] = when;
+		if(when < nextTime) {
+			nextTime = when;
+			nextEvent = type;
+		} else if(type == nextEvent) {
+			findNext();
+		}
+	}
+
+	void Scheduler::cancel(EventType type) {
+		events[type] = NEVER;
+		if(type == nextEvent) {
+			findNext();
+		}
+	}
+
+	void Scheduler::dispatch() {
+		int type = nextEvent;
+		uint64_t due = events[type];
+		events[type] = NEVER;
+		findNext();
+		handlers[type](due);
+	}
+
+	void Scheduler::findNext() {
+		nextTime = NEVER;
+		for(int i = 0; i < EVENT_COUNT; i++) {
+			if(events[i] < nextTime) {
+				nextTime = events[i];
+				nextEvent = i;
+			}
+		}
+	}
+
+	void Scheduler::saveState(StateWriter &state) const {
+		State *out = state.section<State>(STATE_SCHEDULER);
+		if(out) {
+			out->timestamp = timestamp;
+			out->speedShift = speedShift;
+			memcpy(out->events, events, sizeof(events));
+		}
+	}
+
+	bool Scheduler::loadState(const StateReader &state) {
+		const State *in = static_cast<const State*>(state.section(STATE_SCHEDULER, sizeof(State)));
+		if(!in) {
+			return false;
+		}
+		timestamp = in->timestamp;
+		speedShift = in->speedShift;
+		memcpy(events, in->events, sizeof(events));
+		findNext();
+		return true;
+	}
+
+}
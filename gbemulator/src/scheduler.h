@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "save-state.h"
+
+#define NEVER UINT64_MAX
+
+namespace gbemulator {
+
+enum EventType {
+	EVENT_PPU = 0,
+	EVENT_OAM_DMA,
+	EVENT_COUNT
+};
+
+// Timestamped events. Timestamps count single-speed T-cycles (PPU dots), so
+// PPU and APU events never need to know the CPU speed; in CGB double-speed
+// mode advance() halves the CPU cycles it is given instead. Each event type
+// has a single slot, so scheduling an event that is already pending moves it.
+class Scheduler {
+public:
+	// Handlers receive the timestamp the event was due at, which may be
+	// slightly in the past, so they can reschedule without drift.
+	typedef std::function<void(uint64_t)> Handler;
+
+	Scheduler();
+	uint64_t now() const { return timestamp; }
+	void setHandler(EventType type, Handler handler) { handlers[type] = handler; }
+	void schedule(EventType type, uint64_t when);
+	void scheduleIn(EventType type, uint64_t cycles) { schedule(type, timestamp + cycles); }
+	void cancel(EventType type);
+	bool isScheduled(EventType type) const { return events[type] != NEVER; }
+	uint64_t when(EventType type) const { return events[type]; }
+	void setDoubleSpeed(bool on) { speedShift = on ? 1 : 0; }
+	bool isDoubleSpeed() const { return speedShift; }
+	// Converts a duration in CPU cycles to scheduler time.
+	uint64_t fromCpuCycles(uint64_t cycles) const { return cycles >> speedShift; }
+	// Advances by a number of CPU cycles.
+	void advance(int cycles) {
+		timestamp += cycles >> speedShift;
+		while(nextTime <= timestamp) {
+			dispatch();
+		}
+	}
+	// Handlers are not state; the owning components register them once.
+	void saveState(StateWriter &state) const;
+	bool loadState(const StateReader &state);
+
+private:
+	struct State {
+		uint64_t timestamp;
+		int speedShift;
+		uint64_t events[EVENT_COUNT];
+	};
+
+	void dispatch();
+	void findNext();
+
+	uint64_t timestamp;
+	uint64_t nextTime;
+	int nextEvent;
+	int speedShift;
+	uint64_t events[EVENT_COUNT];
+	Handler handlers[EVENT_COUNT];
+};
+
+}
@@ -0,0 +1,136 @@
+#include "state-hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PRIME32 0x9E3779B1u
+#define PRIME1 0x9E3779B185EBCA87ull
+#define PRIME2 0xC2B2AE3D27D4EB4Full
+#define PRIME3 0x165667B19E3779F9ull
+#define LANES 8
+#define STRIPE (LANES * 8)
+// Lanes are scrambled every 1 KB so long inputs keep mixing.
+#define SCRAMBLE_STRIPES 16
+
+namespace gbemulator {
+
+	alignas(16) static const uint64_t KEYS[LANES] = {
+		0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull,
+		0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull, 0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull
+	};
+
+	static const uint64_t START[LANES] = {
+		PRIME32, PRIME1, PRIME2, PRIME3, 0x85EBCA77u, 0x27D4EB2F165667C5ull, PRIME1 ^ PRIME3, 0xC2B2AE3Du
+	};
+
+	// Each lane gains the product of its key-mixed halves and its
+	// neighbour's raw input.
+	static void accumulate(uint64_t acc[LANES], const uint8_t *p, size_t stripes) {
+		size_t s = 0;
+#if defined(__SSE2__)
+		__m128i a[LANES / 2];
+		__m128i keys[LANES / 2];
+		for(int i = 0; i < LANES / 2; i++) {
+			a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i * 2));
+			keys[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(KEYS + i * 2));
+		}
+		for(; s < stripes; s++) {
+			for(int i = 0; i < LANES / 2; i++) {
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + s * STRIPE + i * 16));
+				__m128i k = _mm_xor_si128(d, keys[i]);
+				__m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+				__m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+				a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+			}
+		}
+		for(int i = 0; i < LANES / 2; i++) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i * 2), a[i]);
+		}
+#endif
+		for(; s < stripes; s++) {
+			for(int i = 0; i < LANES; i++) {
+				uint64_t d;
+				memcpy(&d, p + s * STRIPE + i * 8, 8);
+				uint64_t k = d ^ KEYS[i];
+				acc[i ^ 1] += d;
+				acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+			}
+		}
+	}
+
+	static void scramble(uint64_t acc[LANES]) {
+		for(int i = 0; i < LANES; i++) {
+			acc[i] = (acc[i] ^ (acc[i] >> 47) ^ KEYS[LANES - 1 - i]) * PRIME32;
+		}
+	}
+
+	static inline uint64_t fold(uint64_t a, uint64_t b) {
+		unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+		return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+	}
+
+	uint64_t hashBytes(const void *data, size_t size, uint64_t seed) {
+		const uint8_t *p = static_cast<const uint8_t*>(data);
+		uint64_t acc[LANES];
+		memcpy(acc, START, sizeof(acc));
+		size_t stripes = size / STRIPE;
+		for(size_t s = 0; s < stripes; s += SCRAMBLE_STRIPES) {
+			size_t count = std::min(stripes - s, static_cast<size_t>(SCRAMBLE_STRIPES));
+			accumulate(acc, p + s * STRIPE, count);
+			if(count == SCRAMBLE_STRIPES) {
+				scramble(acc);
+			}
+		}
+		// The tail is zero padded; the length below tells paddings apart.
+		if(size % STRIPE) {
+			uint8_t last[STRIPE] = {};
+			memcpy(last, p + stripes * STRIPE, size % STRIPE);
+			accumulate(acc, last, 1);
+		}
+		uint64_t h = size * PRIME1 + seed;
+		for(int i = 0; i < LANES; i += 2) {
+			h += fold(acc[i] ^ KEYS[i], acc[i + 1] ^ (KEYS[i + 1] + seed));
+		}
+		h ^= h >> 37;
+		h *= PRIME2;
+		h ^= h >> 32;
+		return h;
+	}
+
+	StateHasher::StateHasher() : blockHashes(), blocks(-1), rehashed(0), hashes() {}
+
+	const StateHashes &StateHasher::update(MemoryMap *memory, const uint8_t *components, size_t size) {
+		static const int firstBlock[HASH_CART_RAM + 2] = {
+			DIRTY_VRAM_BLOCK, DIRTY_WRAM_BLOCK, DIRTY_FLAT_BLOCK, DIRTY_CART_BLOCK, DIRTY_BLOCKS
+		};
+		uint64_t dirty[DIRTY_WORDS];
+		memory->takeHashDirty(dirty);
+		int count = memory->blockCount();
+		bool all = count != blocks;
+		blocks = count;
+		rehashed = 0;
+		for(int region = HASH_VRAM; region <= HASH_CART_RAM; region++) {
+			int end = std::min(firstBlock[region + 1], count);
+			bool changed = all;
+			for(int block = firstBlock[region]; block < end; block++) {
+				if(all || (dirty[block >> 6] >> (block & 63) & 1)) {
+					blockHashes[block] = hashBytes(memory->blockData(block), DIRTY_BLOCK_SIZE);
+					rehashed++;
+					changed = true;
+				}
+			}
+			if(changed) {
+				int start = std::min(firstBlock[region], end);
+				hashes.regions[region] = hashBytes(blockHashes + start, (end - start) * sizeof(uint64_t), region);
+			}
+		}
+		hashes.regions[HASH_COMPONENTS] = hashBytes(components, size, HASH_COMPONENTS);
+		hashes.total = hashBytes(hashes.regions, sizeof(hashes.regions));
+		return hashes;
+	}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "memory-map.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gbemulator {
+
+// Fast non-cryptographic 64-bit hash, for comparing emulator states. Eight
+// 64-bit lanes take 64 bytes per step, two at a time with SSE2; both paths
+// give the same result on little-endian hosts.
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+enum HashRegion {
+	HASH_VRAM = 0,
+	HASH_WRAM,
+	// The flat 64 KB map: OAM, I/O, HRAM, and the ROM and cartridge RAM
+	// areas without a cartridge.
+	HASH_MEMORY,
+	HASH_CART_RAM,
+	// Everything outside RAM: registers, banks, PPU, APU, DMA, timing.
+	HASH_COMPONENTS,
+	HASH_REGIONS
+};
+
+struct StateHashes {
+	uint64_t total;
+	uint64_t regions[HASH_REGIONS];
+};
+
+// Hashes a state per region, keeping a hash of each 256 byte RAM block so
+// only blocks written since the previous update are read again. A region's
+// hash is the hash of its block hashes. Component state is small and is
+// hashed whole each time.
+class StateHasher {
+public:
+	StateHasher();
+	// components is a save state written without STATE_RAM_SECTIONS. The
+	// first update, or one after the cartridge RAM size changed, reads every
+	// block.
+	const StateHashes &update(MemoryMap *memory, const uint8_t *components, size_t size);
+	const StateHashes &getHashes() const { return hashes; }
+	// Blocks read by the last update.
+	int getRehashed() const { return rehashed; }
+
+private:
+	uint64_t blockHashes[DIRTY_BLOCKS];
+	int blocks;
+	int rehashed;
+	StateHashes hashes;
+};
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "gameboy.h"
+#include "pixel-convert.h"
+#include "work-pool.h"
+
+#include <memory>
+#include <vector>
+
+namespace gbemulator {
+
+// A batch of emulators stepped together, as environments for reinforcement
+// learning. Each step runs every instance for a number of frames holding
+// its action, spread over a work-stealing pool, and writes observations
+// into caller-owned arrays: a downscaled grayscale frame and chosen memory
+// bytes per instance, laid out instance after instance. All buffers are
+// made up front, so stepping allocates nothing.
+template<class Gameboy>
+class VecEmulator {
+public:
+	// scale shrinks observed frames by that factor in both directions; it
+	// must divide 160 and 144.
+	VecEmulator(int count, int threads = 0, int scale = 2) : pool(threads), scale(scale),
+			gray(static_cast<size_t>(count) * SCREEN_PIXELS), actions(nullptr), repeat(0), frames(nullptr), ram(nullptr) {
+		for(int i = 0; i < count; i++) {
+			instances.emplace_back(new Gameboy());
+		}
+		stepTask = [this](int i) { stepInstance(i); };
+	}
+	int size() const { return instances.size(); }
+	Gameboy &get(int i) { return *instances[i]; }
+	int getFrameWidth() const { return SCREEN_WIDTH / scale; }
+	int getFrameHeight() const { return SCREEN_HEIGHT / scale; }
+	size_t frameObservationSize() const { return getFrameWidth() * getFrameHeight(); }
+	// Addresses read into each RAM observation, in order, e.g. a game's
+	// score and player position. Read directly, ignoring PPU locks.
+	void setRamObservation(const std::vector<uint16_t> &addresses) { ramAddresses = addresses; }
+	size_t ramObservationSize() const { return ramAddresses.size(); }
+	// Every instance saves the state reset() returns it to.
+	void setCheckpoint() {
+		for(std::unique_ptr<Gameboy> &instance : instances) {
+			instance->setCheckpoint();
+		}
+	}
+	// Resets the instances whose done flag is set to their checkpoints.
+	void reset(const uint8_t *done) {
+		for(int i = 0; i < size(); i++) {
+			if(done[i]) {
+				instances[i]->resetToCheckpoint();
+			}
+		}
+	}
+	// Runs instance i for repeat frames holding actions[i] (JoypadButton
+	// bits), then writes its frame to frames + i * frameObservationSize()
+	// and its RAM bytes to ram + i * ramObservationSize(). Either output
+	// may be null.
+	void step(const uint8_t *actions, int repeat, uint8_t *frames, uint8_t *ram) {
+		this->actions = actions;
+		this->repeat = repeat;
+		this->frames = frames;
+		this->ram = ram;
+		pool.run(size(), stepTask);
+	}
+
+private:
+	void stepInstance(int i) {
+		Gameboy &gameboy = *instances[i];
+		gameboy.getJoypad().setButtons(actions[i]);
+		for(int f = 0; f < repeat; f++) {
+			gameboy.runFrame();
+		}
+		if(frames) {
+			uint8_t *full = &gray[static_cast<size_t>(i) * SCREEN_PIXELS];
+			gameboy.getFramebuffer().toGray8(full);
+			downscaleGray8(full, SCREEN_WIDTH, SCREEN_HEIGHT, scale, frames + i * frameObservationSize());
+		}
+		if(ram) {
+			const MemoryMap *memory = gameboy.getMemory();
+			for(size_t b = 0; b < ramAddresses.size(); b++) {
+				ram[i * ramAddresses.size() + b] = *memory->pointer(ramAddresses[b]);
+			}
+		}
+	}
+
+	WorkPool pool;
+	WorkPool::Task stepTask;
+	std::vector<std::unique_ptr<Gameboy>> instances;
+	int scale;
+	std::vector<uint8_t> gray;
+	std::vector<uint16_t> ramAddresses;
+	const uint8_t *actions;
+	int repeat;
+	uint8_t *frames;
+	uint8_t *ram;
+};
+
+}
@@ -0,0 +1,172 @@
+#include "video-capture.h"
+
+#include "apu.h"
+#include "ppu.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define POLL_MS 2
+
+namespace gbemulator {
+
+	VideoCapture::VideoCapture(const std::string &path, VideoFileFormat format, bool direct) : format(format),
+			direct(false), open(false), slots(VIDEO_QUEUE_FRAMES), freeSlots(VIDEO_QUEUE_FRAMES),
+			readySlots(VIDEO_QUEUE_FRAMES), stopping(false), framesWritten(0), dropped(0), staging(nullptr),
+			staged(0), rgba(SCREEN_PIXELS), planes(SCREEN_PIXELS * 3) {
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+		if(direct) {
+			fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+			this->direct = fd >= 0;
+		}
+#endif
+		if(!this->direct) {
+			fd = ::open(path.c_str(), flags, 0644);
+		}
+		if(fd < 0 || posix_memalign(reinterpret_cast<void**>(&staging), VIDEO_WRITE_ALIGN, VIDEO_WRITE_BUFFER)) {
+			return;
+		}
+		for(int i = 0; i < VIDEO_QUEUE_FRAMES; i++) {
+			freeSlots.write(&i, 1);
+		}
+		if(format == VIDEO_Y4M) {
+			char header[128];
+			int size = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+					SCREEN_WIDTH, SCREEN_HEIGHT, APU_CLOCK_RATE, DOTS_PER_FRAME);
+			append(header, size);
+		}
+		open = true;
+		writer = std::thread([this]() { run(); });
+	}
+
+	VideoCapture::~VideoCapture() {
+		close();
+		free(staging);
+	}
+
+	bool VideoCapture::submit(const Framebuffer &frame) {
+		int slot;
+		if(!open || freeSlots.available() == 0) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		freeSlots.read(&slot, 1);
+		slots[slot] = frame;
+		readySlots.write(&slot, 1);
+		return true;
+	}
+
+	void VideoCapture::run() {
+		for(;;) {
+			bool closing = stopping.load(std::memory_order_acquire);
+			if(readySlots.available() == 0) {
+				if(closing) {
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+				continue;
+			}
+			int slot;
+			readySlots.read(&slot, 1);
+			encode(slots[slot]);
+			freeSlots.write(&slot, 1);
+			framesWritten.fetch_add(1, std::memory_order_relaxed);
+		}
+		flushBuffer(true);
+	}
+
+	// Integer BT.601 studio-swing conversion; chroma from 2x2 averages.
+	void VideoCapture::encode(const Framebuffer &frame) {
+		frame.toHostRGBA8888(rgba.data());
+		if(format == VIDEO_RGB24) {
+			for(int i = 0; i < SCREEN_PIXELS; i++) {
+				planes[i * 3] = rgba[i];
+				planes[i * 3 + 1] = rgba[i] >> 8;
+				planes[i * 3 + 2] = rgba[i] >> 16;
+			}
+			append(planes.data(), SCREEN_PIXELS * 3);
+			return;
+		}
+		uint8_t *y = planes.data();
+		uint8_t *u = y + SCREEN_PIXELS;
+		uint8_t *v = u + SCREEN_PIXELS / 4;
+		for(int i = 0; i < SCREEN_PIXELS; i++) {
+			int r = rgba[i] & 0xFF;
+			int g = (rgba[i] >> 8) & 0xFF;
+			int b = (rgba[i] >> 16) & 0xFF;
+			y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		}
+		for(int cy = 0; cy < SCREEN_HEIGHT / 2; cy++) {
+			for(int cx = 0; cx < SCREEN_WIDTH / 2; cx++) {
+				int r = 0;
+				int g = 0;
+				int b = 0;
+				for(int j = 0; j < 4; j++) {
+					uint32_t c = rgba[(cy * 2 + (j >> 1)) * SCREEN_WIDTH + cx * 2 + (j & 1)];
+					r += c & 0xFF;
+					g += (c >> 8) & 0xFF;
+					b += (c >> 16) & 0xFF;
+				}
+				r = (r + 2) >> 2;
+				g = (g + 2) >> 2;
+				b = (b + 2) >> 2;
+				int i = cy * (SCREEN_WIDTH / 2) + cx;
+				u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+				v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+			}
+		}
+		append("FRAME\n", 6);
+		append(planes.data(), SCREEN_PIXELS * 3 / 2);
+	}
+
+	void VideoCapture::append(const void *data, size_t size) {
+		const uint8_t *bytes = static_cast<const uint8_t*>(data);
+		while(size > 0) {
+			size_t n = std::min(size, static_cast<size_t>(VIDEO_WRITE_BUFFER) - staged);
+			memcpy(staging + staged, bytes, n);
+			staged += n;
+			bytes += n;
+			size -= n;
+			if(staged == VIDEO_WRITE_BUFFER) {
+				flushBuffer(false);
+			}
+		}
+	}
+
+	// Full buffers go out as one aligned write. O_DIRECT cannot write the
+	// unaligned tail, so it is dropped from the descriptor for the last one.
+	void VideoCapture::flushBuffer(bool final) {
+		if(final && direct && staged % VIDEO_WRITE_ALIGN) {
+#ifdef O_DIRECT
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+		}
+		size_t done = 0;
+		while(done < staged) {
+			ssize_t n = write(fd, staging + done, staged - done);
+			if(n <= 0) {
+				break;
+			}
+			done += n;
+		}
+		staged = 0;
+	}
+
+	void VideoCapture::close() {
+		if(writer.joinable()) {
+			stopping.store(true, std::memory_order_release);
+			writer.join();
+		}
+		if(fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+		open = false;
+	}
+
+}
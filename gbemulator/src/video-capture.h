@@ -0,0 +1,71 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "ring-buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VIDEO_QUEUE_FRAMES 16
+#define VIDEO_WRITE_ALIGN 4096
+// Staging buffer flushed to disk in one write, a multiple of the alignment.
+#define VIDEO_WRITE_BUFFER (1 << 20)
+
+namespace gbemulator {
+
+enum VideoFileFormat {
+	// YUV 4:2:0, BT.601 limited range, at the exact 4194304/70224 Hz rate.
+	VIDEO_Y4M,
+	// Headerless 8-bit R, G, B triples, 160x144 per frame.
+	VIDEO_RGB24
+};
+
+// Records completed frames from a writer thread. The emulation thread only
+// copies the native framebuffer into a free slot of a bounded queue; color
+// conversion and disk writes happen on the writer, which batches output in
+// an aligned staging buffer. Frames arriving while every slot is in use are
+// dropped and counted rather than stalling emulation.
+class VideoCapture {
+public:
+	// direct opens the file with O_DIRECT where supported, bypassing the
+	// page cache for long recordings.
+	VideoCapture(const std::string &path, VideoFileFormat format, bool direct = false);
+	~VideoCapture();
+	VideoCapture(const VideoCapture&) = delete;
+	VideoCapture &operator=(const VideoCapture&) = delete;
+
+	bool isOpen() const { return open; }
+	// Returns false if the frame was dropped.
+	bool submit(const Framebuffer &frame);
+	// Writes the queued frames and closes the file.
+	void close();
+	uint64_t getFramesWritten() const { return framesWritten.load(std::memory_order_relaxed); }
+	uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	void run();
+	void encode(const Framebuffer &frame);
+	void append(const void *data, size_t size);
+	void flushBuffer(bool final);
+
+	VideoFileFormat format;
+	int fd;
+	bool direct;
+	bool open;
+	std::vector<Framebuffer> slots;
+	RingBuffer<int> freeSlots;
+	RingBuffer<int> readySlots;
+	std::atomic<bool> stopping;
+	std::atomic<uint64_t> framesWritten;
+	std::atomic<uint64_t> dropped;
+	uint8_t *staging;
+	size_t staged;
+	std::vector<uint32_t> rgba;
+	std::vector<uint8_t> planes;
+	std::thread writer;
+};
+
+}
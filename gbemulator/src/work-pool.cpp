@@ -0,0 +1,89 @@
+#include "work-pool.h"
+
+#include <algorithm>
+
+namespace gbemulator {
+
+	WorkPool::WorkPool(int threads) : threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+			ranges(new Range[this->threads]), task(nullptr), generation(0), busy(0), quit(false) {
+		for(int i = 1; i < this->threads; i++) {
+			workers.emplace_back([this, i]() {
+				int seen = 0;
+				while(true) {
+					{
+						std::unique_lock<std::mutex> guard(lock);
+						start.wait(guard, [&]() { return quit || generation != seen; });
+						if(quit) {
+							return;
+						}
+						seen = generation;
+					}
+					work(i);
+					std::lock_guard<std::mutex> guard(lock);
+					if(--busy == 0) {
+						done.notify_one();
+					}
+				}
+			});
+		}
+	}
+
+	WorkPool::~WorkPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		start.notify_all();
+		for(std::thread &worker : workers) {
+			worker.join();
+		}
+	}
+
+	void WorkPool::run(int count, const Task &task) {
+		for(int i = 0; i < threads; i++) {
+			std::lock_guard<std::mutex> guard(ranges[i].lock);
+			ranges[i].next = static_cast<long>(count) * i / threads;
+			ranges[i].end = static_cast<long>(count) * (i + 1) / threads;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			this->task = &task;
+			busy = threads - 1;
+			generation++;
+		}
+		start.notify_all();
+		work(0);
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this]() { return busy == 0; });
+		this->task = nullptr;
+	}
+
+	void WorkPool::work(int self) {
+		int index;
+		while(take(self, index)) {
+			(*task)(index);
+		}
+	}
+
+	// Own range from the front, then the others' from the back.
+	bool WorkPool::take(int self, int &index) {
+		{
+			Range &own = ranges[self];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if(own.next < own.end) {
+				index = own.next++;
+				return true;
+			}
+		}
+		for(int i = 1; i < threads; i++) {
+			Range &other = ranges[(self + i) % threads];
+			std::lock_guard<std::mutex> guard(other.lock);
+			if(other.next < other.end) {
+				index = --other.end;
+				return true;
+			}
+		}
+		return false;
+	}
+
+}
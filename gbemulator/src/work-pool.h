@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gbemulator {
+
+// Threads that run a batch of indexed tasks. Each thread is dealt a
+// contiguous range of indices and works through it from the front; a
+// thread that runs out takes indices from the back of another's range, so
+// uneven tasks (an instance in a busier scene) do not leave threads idle.
+// The calling thread works as one of them.
+class WorkPool {
+public:
+	typedef std::function<void(int)> Task;
+
+	// 0 threads means one per hardware thread.
+	WorkPool(int threads = 0);
+	~WorkPool();
+	WorkPool(const WorkPool&) = delete;
+	WorkPool &operator=(const WorkPool&) = delete;
+
+	// Runs task(i) for every i in [0, count) and returns when all are done.
+	void run(int count, const Task &task);
+	int getThreads() const { return threads; }
+
+private:
+	struct Range {
+		std::mutex lock;
+		int next;
+		int end;
+	};
+
+	void work(int self);
+	bool take(int self, int &index);
+
+	int threads;
+	std::unique_ptr<Range[]> ranges;
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable start;
+	std::condition_variable done;
+	const Task *task;
+	int generation;
+	int busy;
+	bool quit;
+};
+
+}
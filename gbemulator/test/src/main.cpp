@@ -1,9 +1,36 @@
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "catch.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <apu.h>
+#include <audio-capture.h>
+#include <cartridge.h>
+#include <cgb-palette.h>
 #include <cpu-registers.h>
+#include <dma.h>
+#include <framebuffer.h>
+#include <gameboy.h>
 #include <instruction-set.h>
+#include <joypad.h>
+#include <lz.h>
 #include <memory-map.h>
+#include <movie.h>
+#include <pacer.h>
+#include <recording.h>
+#include <resampler.h>
+#include <rewind.h>
+#include <vec-emulator.h>
+#include <video-capture.h>
+#include <work-pool.h>
+#include <ring-buffer.h>
 
 using namespace gbemulator;
 
@@ -15,3 +42,1475 @@ TEST_CASE("NOP", "[InstructionSet]") {
 	instructions.exec(0x00);
 	REQUIRE(registers.registers16.PC == registerCpy.registers16.PC);
 }
+
+TEST_CASE("Indexed frame conversion", "[Framebuffer]") {
+	Framebuffer fb(INDEXED8);
+	for(int y = 0; y < SCREEN_HEIGHT; y++) {
+		for(int x = 0; x < SCREEN_WIDTH; x++) {
+			fb.indexedLine(y)[x] = (x + y) & 3;
+		}
+	}
+	REQUIRE(fb.size() == SCREEN_PIXELS);
+	uint32_t rgba[SCREEN_PIXELS];
+	uint16_t rgb565[SCREEN_PIXELS];
+	uint8_t gray[SCREEN_PIXELS];
+	fb.toRGBA8888(rgba);
+	fb.toRGB565(rgb565);
+	fb.toGray8(gray);
+	for(int i = 0; i < SCREEN_PIXELS; i++) {
+		int shade = fb.indexed()[i];
+		REQUIRE(rgba[i] == Framebuffer::DMG_RGBA8888[shade]);
+		REQUIRE(rgb565[i] == Framebuffer::DMG_RGB565[shade]);
+		REQUIRE(gray[i] == Framebuffer::DMG_GRAY8[shade]);
+	}
+}
+
+TEST_CASE("BGR555 frame conversion", "[Framebuffer]") {
+	Framebuffer fb(BGR555);
+	for(int y = 0; y < SCREEN_HEIGHT; y++) {
+		for(int x = 0; x < SCREEN_WIDTH; x++) {
+			fb.colorLine(y)[x] = (y * SCREEN_WIDTH + x) & 0x7FFF;
+		}
+	}
+	REQUIRE(fb.size() == SCREEN_PIXELS * 2);
+	uint32_t rgba[SCREEN_PIXELS];
+	uint16_t rgb565[SCREEN_PIXELS];
+	uint8_t gray[SCREEN_PIXELS];
+	fb.toRGBA8888(rgba);
+	fb.toRGB565(rgb565);
+	fb.toGray8(gray);
+	for(int i = 0; i < SCREEN_PIXELS; i++) {
+		uint16_t c = fb.color()[i];
+		uint32_t r = c & 0x1F, g = (c >> 5) & 0x1F, b = (c >> 10) & 0x1F;
+		uint32_t r8 = (r << 3) | (r >> 2), g8 = (g << 3) | (g >> 2), b8 = (b << 3) | (b >> 2);
+		REQUIRE(rgba[i] == (r8 | (g8 << 8) | (b8 << 16) | 0xFF000000u));
+		REQUIRE(rgb565[i] == ((r << 11) | (((g << 1) | (g >> 4)) << 5) | b));
+		REQUIRE(gray[i] == ((r8 * 77 + g8 * 150 + b8 * 29) >> 8));
+	}
+}
+
+static void loadTestScene(MemoryMap *memory) {
+	memory->write8(0xFF40, 0x00);
+	for(int i = 0; i < 16; i += 2) {
+		memory->write8(0x8010 + i, 0xF0);
+		memory->write8(0x8010 + i + 1, 0x3C);
+		memory->write8(0x8020 + i, 0xFF);
+		memory->write8(0x8020 + i + 1, 0x00);
+	}
+	for(int i = 0; i < 0x400; i++) {
+		memory->write8(0x9800 + i, (i % 3) == 0 ? 1 : 0);
+		memory->write8(0x9C00 + i, 2);
+	}
+	// One sprite in front of the background, one behind it.
+	uint8_t oam[8] = { 40, 30, 1, 0x20, 60, 70, 2, 0x90 };
+	for(int i = 0; i < 8; i++) {
+		memory->write8(0xFE00 + i, oam[i]);
+	}
+	memory->write8(0xFF47, 0xE4);
+	memory->write8(0xFF48, 0xD2);
+	memory->write8(0xFF49, 0x1B);
+	memory->write8(0xFF43, 5);
+	memory->write8(0xFF42, 3);
+	memory->write8(0xFF4A, 100);
+	memory->write8(0xFF4B, 87);
+	memory->write8(0xFF40, 0xF3);
+}
+
+TEST_CASE("Scanline and FIFO PPUs render the same static frame", "[Ppu]") {
+	FastGameboy fast;
+	AccurateGameboy accurate;
+	loadTestScene(fast.getMemory());
+	loadTestScene(accurate.getMemory());
+	for(int frame = 0; frame < 2; frame++) {
+		fast.runFrame();
+		accurate.runFrame();
+	}
+	const uint8_t *a = fast.getFramebuffer().indexed();
+	const uint8_t *b = accurate.getFramebuffer().indexed();
+	REQUIRE(std::equal(a, a + SCREEN_PIXELS, b));
+	// Window rows use tile 2, which is solid color 1.
+	REQUIRE(a[120 * SCREEN_WIDTH + 100] == 1);
+}
+
+static int mode3Length(FifoPpu &ppu) {
+	while(ppu.getMode() != MODE_TRANSFER) {
+		ppu.tick(1);
+	}
+	int dots = 0;
+	while(ppu.getMode() == MODE_TRANSFER) {
+		ppu.tick(1);
+		dots++;
+	}
+	return dots;
+}
+
+TEST_CASE("FIFO PPU Mode 3 length", "[Ppu]") {
+	MemoryMap memory;
+	Framebuffer framebuffer;
+	Scheduler scheduler;
+	FifoPpu ppu(&memory, &framebuffer, &scheduler);
+	REQUIRE(mode3Length(ppu) == MODE3_MIN_DOTS);
+	memory.write8(0xFF43, 3);
+	REQUIRE(mode3Length(ppu) == MODE3_MIN_DOTS + 3);
+}
+
+TEST_CASE("FIFO PPU applies mid-scanline palette writes", "[Ppu]") {
+	MemoryMap memory;
+	Framebuffer framebuffer;
+	Scheduler scheduler;
+	FifoPpu ppu(&memory, &framebuffer, &scheduler);
+	memory.write8(0xFF47, 0x00);
+	while(ppu.getMode() != MODE_TRANSFER) {
+		ppu.tick(1);
+	}
+	ppu.tick(12 + 80);
+	memory.write8(0xFF47, 0xFF);
+	while(ppu.getMode() == MODE_TRANSFER) {
+		ppu.tick(1);
+	}
+	const uint8_t *line = framebuffer.indexedLine(0);
+	REQUIRE(line[0] == 0);
+	REQUIRE(line[SCREEN_WIDTH - 1] == 3);
+}
+
+static int mode3Length(ScanlinePpu &ppu, Scheduler &scheduler) {
+	while(ppu.getMode() != MODE_TRANSFER) {
+		scheduler.advance(1);
+	}
+	int dots = 0;
+	while(ppu.getMode() == MODE_TRANSFER) {
+		scheduler.advance(1);
+		dots++;
+	}
+	return dots;
+}
+
+TEST_CASE("Scanline PPU Mode 3 length", "[Ppu]") {
+	MemoryMap memory;
+	Framebuffer framebuffer;
+	Scheduler scheduler;
+	ScanlinePpu ppu(&memory, &framebuffer, &scheduler);
+	REQUIRE(mode3Length(ppu, scheduler) == MODE3_MIN_DOTS);
+	memory.write8(0xFF43, 3);
+	REQUIRE(mode3Length(ppu, scheduler) == MODE3_MIN_DOTS + 3);
+	memory.write8(0xFF43, 0);
+	memory.write8(0xFF4A, 0);
+	memory.write8(0xFF4B, 50);
+	memory.write8(0xFF40, 0x00);
+	memory.write8(0xFF40, 0xB1);
+	REQUIRE(mode3Length(ppu, scheduler) == MODE3_MIN_DOTS + 6);
+
+	memory.write8(0xFF40, 0x00);
+	memory.write8(0xFE00, 16);
+	memory.write8(0xFE01, 8);
+	memory.write8(0xFE04, 16);
+	memory.write8(0xFE05, 12);
+	memory.write8(0xFF40, 0x93);
+	// Both sprites share the first tile: 5 dots of fetcher wait, then 6 each.
+	REQUIRE(mode3Length(ppu, scheduler) == MODE3_MIN_DOTS + 5 + 12);
+}
+
+TEST_CASE("Scanline PPU raises HBlank STAT interrupt after Mode 3", "[Ppu]") {
+	MemoryMap memory;
+	Framebuffer framebuffer;
+	Scheduler scheduler;
+	ScanlinePpu ppu(&memory, &framebuffer, &scheduler);
+	memory.write8(0xFF41, 0x08);
+	memory.write8(0xFF43, 2);
+	memory.write8(0xFF0F, 0);
+	scheduler.advance(OAM_SCAN_DOTS + MODE3_MIN_DOTS + 1);
+	REQUIRE((memory.read8(0xFF0F) & 0x02) == 0);
+	scheduler.advance(1);
+	REQUIRE((memory.read8(0xFF0F) & 0x02) != 0);
+}
+
+TEST_CASE("OAM DMA copies the source page and locks OAM until done", "[OamDma]") {
+	MemoryMap memory;
+	Scheduler scheduler;
+	OamDma dma(&memory, &scheduler);
+	for(int i = 0; i < OAM_SIZE; i++) {
+		memory.write8(0xC100 + i, i + 1);
+	}
+	memory.write8(0xFF80, 0x42);
+	memory.write8(0xFF46, 0xC1);
+	REQUIRE(dma.isActive());
+	REQUIRE(memory.read8(0xFE00) == 0xFF);
+	REQUIRE(memory.read8(0xC100) == 1);
+	scheduler.advance(OAM_DMA_CYCLES - 1);
+	REQUIRE(dma.isActive());
+	scheduler.advance(1);
+	REQUIRE(!dma.isActive());
+	for(int i = 0; i < OAM_SIZE; i++) {
+		REQUIRE(memory.read8(0xFE00 + i) == i + 1);
+	}
+
+	dma.setRestrictBus(true);
+	memory.write8(0xFF46, 0xE1);
+	REQUIRE(memory.read8(0xC100) == 0xFF);
+	REQUIRE(memory.read8(0xFF80) == 0x42);
+	scheduler.advance(OAM_DMA_CYCLES);
+	REQUIRE(memory.read8(0xC100) == 1);
+}
+
+TEST_CASE("CGB VRAM and WRAM banks swap pages", "[MemoryMap]") {
+	MemoryMap memory;
+	memory.write8(0xD000, 0x11);
+	memory.write8(0xFF70, 3);
+	REQUIRE(memory.read8(0xD000) == 0x11);
+	memory.setCgbMode(true);
+	memory.write8(0xFF70, 3);
+	REQUIRE(memory.read8(0xFF70) == 0xFB);
+	REQUIRE(memory.read8(0xD000) == 0x00);
+	memory.write8(0xD000, 0x33);
+	memory.write8(0xFF70, 0);
+	REQUIRE(memory.read8(0xD000) == 0x11);
+	REQUIRE(memory.read8(0xE000) == memory.read8(0xC000));
+	REQUIRE(memory.read8(0xF000) == 0x11);
+	memory.write8(0xFDFF, 0x22);
+	REQUIRE(memory.read8(0xDDFF) == 0x22);
+	memory.write8(0xFF70, 3);
+	REQUIRE(memory.read8(0xF000) == 0x33);
+	REQUIRE(memory.read8(0xFDFF) == 0x00);
+
+	memory.write8(0x8000, 0xA0);
+	memory.write8(0xFF4F, 1);
+	REQUIRE(memory.read8(0x8000) == 0x00);
+	memory.write8(0x8000, 0xA1);
+	REQUIRE(memory.vram(0)[0] == 0xA0);
+	REQUIRE(memory.vram(1)[0] == 0xA1);
+}
+
+TEST_CASE("General purpose HDMA copies immediately and stalls the CPU", "[Hdma]") {
+	MemoryMap memory;
+	memory.setCgbMode(true);
+	int stalled = 0;
+	Hdma hdma(&memory, [&stalled](int cycles) { stalled += cycles; });
+	for(int i = 0; i < 64; i++) {
+		memory.write8(0xC200 + i, i);
+	}
+	memory.write8(0xFF51, 0xC2);
+	memory.write8(0xFF52, 0x00);
+	memory.write8(0xFF53, 0x01);
+	memory.write8(0xFF54, 0x00);
+	memory.write8(0xFF55, 0x03);
+	REQUIRE(memory.read8(0xFF55) == 0xFF);
+	// 8 M-cycles of 4 CPU cycles per block.
+	REQUIRE(stalled == 4 * 8 * 4);
+	for(int i = 0; i < 64; i++) {
+		REQUIRE(memory.read8(0x8100 + i) == i);
+	}
+	// The same time in double speed is twice the CPU cycles.
+	memory.write8(0xFF4D, 1);
+	REQUIRE(memory.switchSpeed());
+	stalled = 0;
+	memory.write8(0xFF55, 0x00);
+	REQUIRE(stalled == 8 * 4 * 2);
+}
+
+TEST_CASE("HBlank HDMA copies one block per line", "[Hdma]") {
+	FastGameboy gb;
+	gb.setCgbMode(true);
+	MemoryMap *memory = gb.getMemory();
+	memory->write8(0xFF40, 0x00);
+	for(int i = 0; i < 48; i++) {
+		memory->write8(0xC300 + i, 0x80 + i);
+	}
+	memory->write8(0xFF51, 0xC3);
+	memory->write8(0xFF52, 0x00);
+	memory->write8(0xFF53, 0x00);
+	memory->write8(0xFF54, 0x40);
+	memory->write8(0xFF55, 0x82);
+	REQUIRE(gb.getHdma().isActive());
+	memory->write8(0xFF40, 0x91);
+	Scheduler &scheduler = gb.getScheduler();
+	scheduler.advance(DOTS_PER_LINE);
+	REQUIRE(memory->read8(0xFF55) == 0x01);
+	scheduler.advance(2 * DOTS_PER_LINE);
+	REQUIRE(!gb.getHdma().isActive());
+	for(int i = 0; i < 48; i++) {
+		REQUIRE(memory->read8(0x8040 + i) == 0x80 + i);
+	}
+}
+
+TEST_CASE("STOP performs an armed CGB speed switch", "[Cpu]") {
+	FastGameboy gb;
+	gb.setCgbMode(true);
+	MemoryMap *memory = gb.getMemory();
+	memory->write8(0x0100, 0x10);
+	memory->write8(0x0101, 0x00);
+	memory->write8(0x0102, 0x10);
+	memory->write8(0x0103, 0x00);
+	memory->write8(0xFF4D, 0x01);
+	REQUIRE(memory->read8(0xFF4D) == 0x7F);
+	gb.step();
+	REQUIRE(memory->read8(0xFF4D) == 0xFE);
+	REQUIRE(gb.getScheduler().isDoubleSpeed());
+	REQUIRE(gb.getCpu().getRegisters().registers16.PC == 0x0102);
+	// Without KEY1 armed, STOP does not switch back.
+	gb.step();
+	REQUIRE(gb.getScheduler().isDoubleSpeed());
+
+	// A scanline now takes twice as many CPU cycles.
+	uint8_t ly = memory->read8(0xFF44);
+	while(memory->read8(0xFF44) == ly) {
+		gb.step();
+	}
+	ly = memory->read8(0xFF44);
+	int cycles = 0;
+	while(memory->read8(0xFF44) == ly) {
+		cycles += gb.step();
+	}
+	REQUIRE(cycles == 2 * DOTS_PER_LINE);
+}
+
+TEST_CASE("CGB palette writes refresh the color cache", "[CgbPalette]") {
+	MemoryMap memory;
+	CgbPalette palette(memory.getRegisters());
+	// Background palette 1, color 2, with auto-increment.
+	memory.write8(0xFF68, 0x80 | 0x0C);
+	memory.write8(0xFF69, 0x1F);
+	memory.write8(0xFF69, 0x00);
+	REQUIRE(memory.read8(0xFF68) == (0xC0 | 0x0E));
+	REQUIRE(palette.color(6) == 0x001F);
+	REQUIRE(palette.hostColor(6) == 0xFF0000FF);
+	memory.write8(0xFF6A, 0x02);
+	memory.write8(0xFF6B, 0xE0);
+	REQUIRE(memory.read8(0xFF6A) == 0x42);
+	memory.write8(0xFF6A, 0x03);
+	memory.write8(0xFF6B, 0x03);
+	REQUIRE(palette.color(OBJ_PALETTE_BASE + 1) == 0x03E0);
+
+	palette.setProfile(COLOR_CGB_LCD);
+	REQUIRE(palette.hostColor(6) == colorLut(COLOR_CGB_LCD)[0x001F]);
+	REQUIRE(colorLut(COLOR_CGB_LCD)[0x7FFF] == 0xFFFFFFFF);
+	REQUIRE(colorLut(COLOR_CGB_GAMMA)[0x0000] == 0xFF000000);
+}
+
+static void loadCgbScene(MemoryMap *memory) {
+	loadTestScene(memory);
+	memory->write8(0xFF40, 0x00);
+	// Palette 2 for every other map column, flipped tiles from bank 1.
+	memory->write8(0xFF4F, 1);
+	for(int i = 0; i < 16; i++) {
+		memory->write8(0x8010 + i, 0x81 + i);
+	}
+	for(int i = 0; i < 0x400; i++) {
+		memory->write8(0x9800 + i, (i & 1) ? 0x2A : 0x00);
+	}
+	memory->write8(0xFF4F, 0);
+	memory->write8(0xFE03, 0x0B);
+	memory->write8(0xFF68, 0x80);
+	memory->write8(0xFF6A, 0x80);
+	for(int i = 0; i < 64; i++) {
+		memory->write8(0xFF69, i * 5);
+		memory->write8(0xFF6B, 0x7F - i);
+	}
+	memory->write8(0xFF40, 0xF3);
+}
+
+TEST_CASE("Scanline and FIFO PPUs render the same CGB frame", "[Ppu]") {
+	FastGameboy fast;
+	AccurateGameboy accurate;
+	fast.setCgbMode(true);
+	accurate.setCgbMode(true);
+	loadCgbScene(fast.getMemory());
+	loadCgbScene(accurate.getMemory());
+	for(int frame = 0; frame < 2; frame++) {
+		fast.runFrame();
+		accurate.runFrame();
+	}
+	const uint16_t *a = fast.getFramebuffer().color();
+	const uint16_t *b = accurate.getFramebuffer().color();
+	REQUIRE(std::equal(a, a + SCREEN_PIXELS, b));
+	// Attribute palette 2 is in use on the odd map columns.
+	CgbPalette &palette = fast.getPpu().getPalette();
+	int palette2 = 0;
+	for(int c = 0; c < 4; c++) {
+		palette2 += std::count(a, a + SCREEN_PIXELS, palette.color(2 * 4 + c));
+	}
+	REQUIRE(palette2 > 0);
+}
+
+TEST_CASE("CGB frames are drawn in corrected host colors", "[Ppu]") {
+	FastGameboy fast;
+	AccurateGameboy accurate;
+	fast.setCgbMode(true);
+	accurate.setCgbMode(true);
+	fast.setColorProfile(COLOR_CGB_GAMMA);
+	accurate.setColorProfile(COLOR_CGB_GAMMA);
+	loadCgbScene(fast.getMemory());
+	loadCgbScene(accurate.getMemory());
+	for(int frame = 0; frame < 2; frame++) {
+		fast.runFrame();
+		accurate.runFrame();
+	}
+	std::vector<uint32_t> a(SCREEN_PIXELS);
+	std::vector<uint32_t> b(SCREEN_PIXELS);
+	fast.getFramebuffer().toHostRGBA8888(a.data());
+	accurate.getFramebuffer().toHostRGBA8888(b.data());
+	REQUIRE(a == b);
+	const uint32_t *lut = colorLut(COLOR_CGB_GAMMA);
+	const uint16_t *colors = fast.getFramebuffer().color();
+	for(int i = 0; i < SCREEN_PIXELS; i++) {
+		REQUIRE(a[i] == lut[colors[i]]);
+	}
+	// Without host colors, frames are plain 5 to 8 bit expansions.
+	FastGameboy plain;
+	plain.setCgbMode(true);
+	loadCgbScene(plain.getMemory());
+	plain.runFrame();
+	plain.runFrame();
+	plain.getFramebuffer().toHostRGBA8888(b.data());
+	REQUIRE(b[0] == colorLut(COLOR_RAW)[plain.getFramebuffer().color()[0]]);
+}
+
+// Counts left-channel swings between +threshold and -threshold, so ringing
+// around zero is not counted.
+static int zeroCrossings(const int16_t *samples, int frames, int threshold = 2000) {
+	int crossings = 0;
+	int sign = 0;
+	for(int i = 0; i < frames; i++) {
+		int s = samples[i * 2];
+		int next = s > threshold ? 1 : s < -threshold ? -1 : sign;
+		if(sign && next != sign) {
+			crossings++;
+		}
+		sign = next;
+	}
+	return crossings;
+}
+
+TEST_CASE("APU pulse channel produces a band-limited square wave", "[Apu]") {
+	MemoryMap memory;
+	Scheduler scheduler;
+	Apu apu(&memory, &scheduler);
+	// 50% duty at 131072 / (2048 - 1920) = 1024 Hz, full volume, no envelope.
+	memory.write8(0xFF16, 0x80);
+	memory.write8(0xFF17, 0xF0);
+	memory.write8(0xFF18, 1920 & 0xFF);
+	memory.write8(0xFF19, 0x80 | (1920 >> 8));
+	REQUIRE(memory.read8(0xFF26) == 0xF2);
+	scheduler.advance(APU_CLOCK_RATE / 10);
+	int16_t samples[APU_SAMPLE_RATE / 5];
+	int frames = apu.readSamples(samples, APU_SAMPLE_RATE / 10);
+	REQUIRE(frames >= APU_SAMPLE_RATE / 10 - BLIP_TAPS);
+	// Two edges per period; allow for the high-pass filter settling.
+	int crossings = zeroCrossings(samples, frames);
+	REQUIRE(crossings >= 196);
+	REQUIRE(crossings <= 205);
+
+	// Powering off silences everything.
+	memory.write8(0xFF26, 0x00);
+	REQUIRE(memory.read8(0xFF26) == 0x70);
+	REQUIRE(apu.getAmplitude(CHANNEL_PULSE2) == 0);
+	scheduler.advance(APU_CLOCK_RATE / 10);
+	apu.readSamples(samples, APU_SAMPLE_RATE / 10);
+	frames = apu.readSamples(samples, APU_SAMPLE_RATE / 10);
+	REQUIRE(frames == 0);
+}
+
+TEST_CASE("APU length counter stops a channel", "[Apu]") {
+	MemoryMap memory;
+	Scheduler scheduler;
+	Apu apu(&memory, &scheduler);
+	// Length 63 leaves one 256 Hz length clock.
+	memory.write8(0xFF21, 0xF0);
+	memory.write8(0xFF20, 63);
+	memory.write8(0xFF23, 0xC0);
+	REQUIRE(memory.read8(0xFF26) == 0xF8);
+	scheduler.advance(FRAME_SEQUENCER_PERIOD * 2);
+	apu.endFrame();
+	REQUIRE(memory.read8(0xFF26) == 0xF0);
+	REQUIRE(apu.getAmplitude(CHANNEL_NOISE) == 0);
+}
+
+TEST_CASE("Ring buffer counts overflows and underflows", "[RingBuffer]") {
+	RingBuffer<int> ring(6);
+	REQUIRE(ring.capacity() == 8);
+	int values[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	REQUIRE(ring.write(values, 10) == 8);
+	REQUIRE(ring.getOverflows() == 2);
+	int out[12];
+	REQUIRE(ring.read(out, 12) == 8);
+	REQUIRE(out[7] == 8);
+	REQUIRE(out[8] == 0);
+	REQUIRE(ring.getUnderflows() == 4);
+}
+
+TEST_CASE("Ring buffer hands samples to a blocking consumer thread", "[RingBuffer]") {
+	AudioRing ring(256);
+	const int total = 100000;
+	std::vector<int16_t> received;
+	std::thread consumer([&]() {
+		int16_t chunk[100];
+		while(ring.read(chunk, 100, RING_BLOCK) > 0) {
+			received.insert(received.end(), chunk, chunk + 100);
+		}
+	});
+	for(int i = 0; i < total;) {
+		int16_t v = i;
+		if(ring.write(&v, 1) == 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		i++;
+	}
+	while(ring.available()) {
+		std::this_thread::yield();
+	}
+	ring.close();
+	consumer.join();
+	REQUIRE(received.size() == total);
+	for(int i = 0; i < total; i++) {
+		REQUIRE(received[i] == static_cast<int16_t>(i));
+	}
+}
+
+TEST_CASE("Gameboy frames push APU output into the ring", "[Apu]") {
+	FastGameboy gameboy;
+	AudioRing ring(1 << 14);
+	gameboy.getApu().setOutput(&ring);
+	gameboy.runFrame();
+	// Two samples per frame at 48 kHz, less the kernel's latency.
+	size_t expected = gameboy.getScheduler().now() * APU_SAMPLE_RATE / APU_CLOCK_RATE * 2;
+	REQUIRE(ring.available() + BLIP_TAPS * 2 >= expected);
+	REQUIRE(ring.available() <= expected + 2);
+	REQUIRE(ring.getOverflows() == 0);
+}
+
+// Resamples a stereo tone and returns the worst error against the ideal
+// tone at the output rate, in dB relative to its amplitude.
+static double resampledToneError(Resampler &resampler, double freq, double amplitude) {
+	const double pi = 3.14159265358979323846;
+	const int frames = static_cast<int>(resampler.getInputRate() / 4);
+	std::vector<int16_t> in(frames * 2);
+	for(int i = 0; i < frames; i++) {
+		in[i * 2] = in[i * 2 + 1] = static_cast<int16_t>(amplitude * std::sin(2 * pi * freq * i / resampler.getInputRate()));
+	}
+	resampler.push(in.data(), frames);
+	std::vector<int16_t> out(frames * 2);
+	int produced = resampler.pull(out.data(), frames);
+	double worst = 0;
+	// Skip the start-up transient from the silent history.
+	for(int j = resampler.getTaps(); j < produced; j++) {
+		double ideal = amplitude * std::sin(2 * pi * freq * j / resampler.getOutputRate());
+		worst = std::max(worst, std::abs(out[j * 2] - ideal));
+		REQUIRE(out[j * 2] == out[j * 2 + 1]);
+	}
+	return 20 * std::log10(std::max(worst, 1e-9) / amplitude);
+}
+
+TEST_CASE("Resampler kernels reproduce a tone at the host rate", "[Resampler]") {
+	for(int k = KERNEL_SCALAR; k <= KERNEL_AVX2; k++) {
+		if(!Resampler::isSupported(static_cast<ResamplerKernel>(k))) {
+			continue;
+		}
+		Resampler resampler(65536, 48000);
+		resampler.setKernel(static_cast<ResamplerKernel>(k));
+		REQUIRE(resampler.getKernel() == k);
+		REQUIRE(resampledToneError(resampler, 1000, 16000) < -60);
+	}
+}
+
+TEST_CASE("Resampler rejects tones above the output Nyquist rate", "[Resampler]") {
+	Resampler resampler(96000, 48000);
+	REQUIRE(resampler.getTaps() == 2 * RESAMPLER_BASE_TAPS);
+	const int frames = 24000;
+	std::vector<int16_t> in(frames * 2);
+	for(int i = 0; i < frames; i++) {
+		in[i * 2] = in[i * 2 + 1] = static_cast<int16_t>(16000 * std::sin(2 * 3.14159265358979 * 30000 * i / 96000));
+	}
+	resampler.push(in.data(), frames);
+	std::vector<int16_t> out(frames * 2);
+	int produced = resampler.pull(out.data(), frames);
+	int peak = 0;
+	for(int j = resampler.getTaps(); j < produced; j++) {
+		peak = std::max(peak, std::abs(static_cast<int>(out[j * 2])));
+	}
+	// At least 50 dB down.
+	REQUIRE(peak < 16000 / 316);
+}
+
+TEST_CASE("Resampler ratio can be nudged while streaming", "[Resampler]") {
+	Resampler resampler(48000, 48000);
+	std::vector<int16_t> in(48000 * 2, 1000);
+	std::vector<int16_t> out(60000 * 2);
+	resampler.push(in.data(), 24000);
+	resampler.pull(out.data(), 60000);
+	resampler.push(in.data(), 24000);
+	int normal = resampler.pull(out.data(), 60000);
+	REQUIRE(normal == 24000);
+	resampler.setAdjust(0.005);
+	resampler.push(in.data(), 24000);
+	int faster = resampler.pull(out.data(), 60000);
+	REQUIRE(std::abs(faster - normal * 1.005) < 2);
+	// DC passes at unity gain once the filter is primed.
+	REQUIRE(out[faster - 1] == 1000);
+}
+
+TEST_CASE("APU noise channel follows the LFSR sequences", "[Apu]") {
+	MemoryMap memory;
+	Scheduler scheduler;
+	Apu apu(&memory, &scheduler);
+	// Divisor 8 << 8: one LFSR step every 2048 dots.
+	const int period = 2048;
+	memory.write8(0xFF21, 0xF0);
+	memory.write8(0xFF22, 0x80);
+	memory.write8(0xFF23, 0x80);
+	uint16_t lfsr = 0x7FFF;
+	bool narrow = false;
+	// Sample just after each step.
+	scheduler.advance(1);
+	for(int step = 0; step < 600; step++) {
+		if(step == 300) {
+			// Switch to the 7-bit sequence mid-stream.
+			memory.write8(0xFF22, 0x88);
+			narrow = true;
+		}
+		scheduler.advance(period);
+		apu.endFrame();
+		int bit = (lfsr ^ (lfsr >> 1)) & 1;
+		lfsr = (lfsr >> 1) | (bit << 14);
+		if(narrow) {
+			lfsr = (lfsr & ~0x40) | (bit << 6);
+		}
+		REQUIRE(apu.getAmplitude(CHANNEL_NOISE) == ((~lfsr & 1) ? 15 : 0));
+	}
+	// Shift 14 stops the LFSR once the step already due under the old
+	// period is taken, wherever in the sequence that falls.
+	for(int steps = 0; steps < 40; steps++) {
+		memory.write8(0xFF22, 0x80);
+		memory.write8(0xFF23, 0x80);
+		scheduler.advance(period * steps + 1);
+		memory.write8(0xFF22, 0xE0);
+		lfsr = 0x7FFF;
+		for(int i = 0; i <= steps; i++) {
+			lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> 1)) & 1) << 14);
+		}
+		for(int frame = 0; frame < 3; frame++) {
+			scheduler.advance(DOTS_PER_FRAME);
+			apu.endFrame();
+			REQUIRE(apu.getAmplitude(CHANNEL_NOISE) == ((~lfsr & 1) ? 15 : 0));
+		}
+	}
+}
+
+TEST_CASE("APU noise state does not depend on the host sample rate", "[Apu]") {
+	std::unique_ptr<FastGameboy> rates[3] = {
+		std::unique_ptr<FastGameboy>(new FastGameboy()),
+		std::unique_ptr<FastGameboy>(new FastGameboy()),
+		std::unique_ptr<FastGameboy>(new FastGameboy())
+	};
+	rates[1]->getApu().setSampleRate(12000);
+	rates[2]->getApu().setSampleRate(8000);
+	for(std::unique_ptr<FastGameboy> &gameboy : rates) {
+		MemoryMap *memory = gameboy->getMemory();
+		memory->write8(0xFF26, 0x80);
+		memory->write8(0xFF25, 0x88);
+		memory->write8(0xFF24, 0x77);
+		// The fastest noise clock, far above every output rate.
+		memory->write8(0xFF21, 0xF0);
+		memory->write8(0xFF22, 0x00);
+		memory->write8(0xFF23, 0x80);
+	}
+	// Ending the audio frame syncs the APU, as a frontend reading samples does.
+	for(int frame = 0; frame < 10; frame++) {
+		for(std::unique_ptr<FastGameboy> &gameboy : rates) {
+			gameboy->runFrame();
+			gameboy->getApu().endFrame();
+		}
+		REQUIRE(rates[0]->stateHash() == rates[1]->stateHash());
+		REQUIRE(rates[0]->stateHash() == rates[2]->stateHash());
+	}
+}
+
+TEST_CASE("Pacer holds the audio latency inside its window", "[Pacer]") {
+	AudioRing ring(1 << 14);
+	Resampler resampler(65536, 48000);
+	Pacer pacer(&ring, &resampler, 20, 40);
+	const double frameRate = static_cast<double>(APU_CLOCK_RATE) / DOTS_PER_FRAME;
+	// The host's audio clock runs 0.3% fast relative to the emulated one.
+	const double drain = 48000 * 1.003 / frameRate;
+	std::vector<int16_t> in(4096 * 2, 0);
+	std::vector<int16_t> out(4096 * 2);
+	double produced = 0;
+	double consumed = 0;
+	bool playing = false;
+	for(int frame = 0; frame < 3000; frame++) {
+		int frames = static_cast<int>(65536 * (frame + 1) / frameRate - produced);
+		produced += frames;
+		resampler.push(in.data(), frames);
+		int count = resampler.pull(out.data(), 4096);
+		ring.write(out.data(), count * 2);
+		pacer.update();
+		if(frame == 1000) {
+			pacer.resetMetrics();
+		}
+		playing = playing || pacer.getFillMs() >= 20;
+		if(playing) {
+			consumed += drain;
+			int take = static_cast<int>(consumed);
+			consumed -= take;
+			ring.read(out.data(), take * 2);
+		}
+	}
+	PacerMetrics metrics = pacer.getMetrics();
+	REQUIRE(metrics.frames == 1999);
+	REQUIRE(metrics.minFillMs >= 20);
+	REQUIRE(metrics.maxFillMs <= 40);
+	REQUIRE(metrics.adjust > 0.002);
+	REQUIRE(metrics.adjust < PACER_MAX_ADJUST);
+	REQUIRE(metrics.overflows == 0);
+}
+
+static std::vector<uint8_t> readFile(const char *path) {
+	std::vector<uint8_t> data;
+	FILE *file = fopen(path, "rb");
+	if(file) {
+		int c;
+		while((c = fgetc(file)) != EOF) {
+			data.push_back(c);
+		}
+		fclose(file);
+	}
+	return data;
+}
+
+TEST_CASE("Audio capture writes WAV files with patched headers and stems", "[AudioCapture]") {
+	MemoryMap memory;
+	Scheduler scheduler;
+	Apu apu(&memory, &scheduler);
+	AudioCapture capture("capture-test.wav", AUDIO_WAV, APU_SAMPLE_RATE, true);
+	REQUIRE(capture.isOpen());
+	apu.setCapture(&capture);
+	memory.write8(0xFF16, 0x80);
+	memory.write8(0xFF17, 0xF0);
+	memory.write8(0xFF18, 0x00);
+	memory.write8(0xFF19, 0x87);
+	std::vector<int16_t> mix;
+	int16_t samples[1024 * 2];
+	for(int frame = 0; frame < 30; frame++) {
+		scheduler.advance(DOTS_PER_FRAME);
+		int count;
+		while((count = apu.readSamples(samples, 1024)) > 0) {
+			mix.insert(mix.end(), samples, samples + count * 2);
+		}
+	}
+	capture.close();
+	REQUIRE(capture.getDropped() == 0);
+
+	std::vector<uint8_t> wav = readFile("capture-test.wav");
+	REQUIRE(wav.size() == 44 + mix.size() * 2);
+	REQUIRE(std::equal(wav.begin(), wav.begin() + 4, "RIFF"));
+	uint32_t dataBytes = wav[40] | (wav[41] << 8) | (wav[42] << 16) | (wav[43] << 24);
+	REQUIRE(dataBytes == mix.size() * 2);
+	REQUIRE(memcmp(wav.data() + 44, mix.data(), dataBytes) == 0);
+
+	std::vector<uint8_t> pulse = readFile("capture-test.pulse2.wav");
+	std::vector<uint8_t> noise = readFile("capture-test.noise.wav");
+	REQUIRE(pulse.size() == 44 + mix.size());
+	REQUIRE(noise.size() == pulse.size());
+	REQUIRE(pulse[22] == 1);
+	REQUIRE(std::any_of(pulse.begin() + 44, pulse.end(), [](uint8_t b) { return b != 0; }));
+	REQUIRE(std::all_of(noise.begin() + 44, noise.end(), [](uint8_t b) { return b == 0; }));
+	for(const char *name : {"", ".pulse1", ".pulse2", ".wave", ".noise"}) {
+		remove((std::string("capture-test") + name + ".wav").c_str());
+	}
+}
+
+TEST_CASE("Video capture writes Y4M frames from the writer thread", "[VideoCapture]") {
+	FastGameboy gameboy;
+	loadTestScene(gameboy.getMemory());
+	VideoCapture capture("capture-test.y4m", VIDEO_Y4M);
+	REQUIRE(capture.isOpen());
+	gameboy.setVideoCapture(&capture);
+	for(int frame = 0; frame < 5; frame++) {
+		gameboy.runFrame();
+	}
+	capture.close();
+	REQUIRE(capture.getFramesWritten() + capture.getDropped() == 5);
+	REQUIRE(capture.getDropped() == 0);
+
+	std::vector<uint8_t> y4m = readFile("capture-test.y4m");
+	std::string header = "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 C420jpeg\n";
+	size_t frameSize = 6 + SCREEN_PIXELS * 3 / 2;
+	REQUIRE(y4m.size() == header.size() + 5 * frameSize);
+	REQUIRE(std::equal(header.begin(), header.end(), y4m.begin()));
+	// Luma of the last frame matches the framebuffer's shades.
+	const uint8_t *luma = y4m.data() + header.size() + 4 * frameSize + 6;
+	const uint8_t shades[4] = {235, 162, 89, 16};
+	const uint8_t *pixels = gameboy.getFramebuffer().indexed();
+	for(int i = 0; i < SCREEN_PIXELS; i++) {
+		REQUIRE(luma[i] == shades[pixels[i]]);
+	}
+	remove("capture-test.y4m");
+}
+
+TEST_CASE("Recordings round-trip frames and seek through keyframes", "[Recording]") {
+	FastGameboy gameboy;
+	loadTestScene(gameboy.getMemory());
+	std::vector<Framebuffer> frames;
+	{
+		RecordingWriter writer("capture-test.gbr", INDEXED8, 8);
+		REQUIRE(writer.isOpen());
+		for(int i = 0; i < 20; i++) {
+			// A sprite walks across an otherwise static screen.
+			gameboy.getMemory()->write8(0xFE01, 30 + i);
+			gameboy.runFrame();
+			writer.addFrame(gameboy.getFramebuffer());
+			frames.push_back(gameboy.getFramebuffer());
+		}
+		writer.close();
+		// Three keyframes and small deltas: far below the 20 * 5760 bytes of
+		// even the packed frames.
+		REQUIRE(writer.getBytesWritten() < 20 * SCREEN_PIXELS / 16);
+	}
+	RecordingReader reader("capture-test.gbr");
+	REQUIRE(reader.isOpen());
+	REQUIRE(reader.getFrameCount() == 20);
+	REQUIRE(reader.getFrameType(8) == RECORDING_KEYFRAME);
+	REQUIRE(reader.getFrameType(9) == RECORDING_DELTA);
+	Framebuffer frame;
+	for(int i : {0, 1, 2, 13, 5, 19, 16, 17, 7}) {
+		REQUIRE(reader.readFrame(i, frame));
+		REQUIRE(std::equal(frame.indexed(), frame.indexed() + SCREEN_PIXELS, frames[i].indexed()));
+	}
+	REQUIRE(!reader.readFrame(20, frame));
+
+	// A zero key interval makes every frame a keyframe.
+	{
+		RecordingWriter writer("capture-test.gbr", INDEXED8, 0);
+		writer.addFrame(frames[0]);
+		writer.addFrame(frames[1]);
+	}
+	{
+		RecordingReader keyframes("capture-test.gbr");
+		REQUIRE(keyframes.getFrameCount() == 2);
+		REQUIRE(keyframes.getFrameType(1) == RECORDING_KEYFRAME);
+	}
+	REQUIRE(readFile("capture-test.gbr")[12] == 1);
+	// Unknown pixel formats, frame counts and payload sizes past the end of
+	// the file, and a first frame that is not a keyframe are rejected
+	// without allocating for them.
+	auto patch = [](long offset, int whence, uint8_t byte) {
+		FILE *file = fopen("capture-test.gbr", "r+b");
+		fseek(file, offset, whence);
+		fputc(byte, file);
+		fclose(file);
+	};
+	patch(6, SEEK_SET, 7);
+	REQUIRE(!RecordingReader("capture-test.gbr").isOpen());
+	patch(6, SEEK_SET, INDEXED8);
+	REQUIRE(RecordingReader("capture-test.gbr").isOpen());
+	patch(-(12 + 2 * 8 + 2), SEEK_END, 0x10);
+	REQUIRE(!RecordingReader("capture-test.gbr").isOpen());
+	patch(-(12 + 2 * 8 + 1), SEEK_END, 0xFF);
+	REQUIRE(!RecordingReader("capture-test.gbr").isOpen());
+	patch(-(12 + 2 * 8 + 2), SEEK_END, 0x00);
+	patch(-(12 + 2 * 8 + 1), SEEK_END, 0x00);
+	// The first record's payload size is at bytes 15-18.
+	patch(18, SEEK_SET, 0xFF);
+	{
+		RecordingReader corrupt("capture-test.gbr");
+		REQUIRE(corrupt.isOpen());
+		REQUIRE(!corrupt.readFrame(0, frame));
+	}
+	patch(14, SEEK_SET, RECORDING_DELTA);
+	REQUIRE(!RecordingReader("capture-test.gbr").isOpen());
+	remove("capture-test.gbr");
+}
+
+// Runs frames with a sprite walking across the screen and returns them.
+template<class Gameboy>
+static std::vector<Framebuffer> runWalkingSprite(Gameboy &gameboy, int frames) {
+	std::vector<Framebuffer> out;
+	for(int i = 0; i < frames; i++) {
+		gameboy.getMemory()->write8(0xFE01, 40 + i * 3);
+		gameboy.runFrame();
+		out.push_back(gameboy.getFramebuffer());
+	}
+	return out;
+}
+
+TEST_CASE("Save states restore the emulator mid-frame", "[SaveState]") {
+	AccurateGameboy gameboy;
+	loadTestScene(gameboy.getMemory());
+	MemoryMap *memory = gameboy.getMemory();
+	memory->write8(0xFF26, 0x80);
+	memory->write8(0xFF25, 0x11);
+	memory->write8(0xFF24, 0x77);
+	memory->write8(0xFF12, 0xF0);
+	memory->write8(0xFF13, 0x00);
+	memory->write8(0xFF14, 0x87);
+	gameboy.runFrame();
+	for(int i = 0; i < 500; i++) {
+		gameboy.step();
+	}
+	std::vector<uint8_t> state(gameboy.stateSize());
+	REQUIRE(gameboy.saveState(state.data(), state.size()) == state.size());
+	REQUIRE(gameboy.saveState(state.data(), state.size() - 1) == 0);
+	uint64_t savedAt = gameboy.getScheduler().now();
+
+	std::vector<Framebuffer> first = runWalkingSprite(gameboy, 4);
+	uint64_t firstEnd = gameboy.getScheduler().now();
+	uint16_t firstPc = gameboy.getCpu().getRegisters().registers16.PC;
+	int firstAmplitude = gameboy.getApu().getAmplitude(CHANNEL_PULSE1);
+
+	REQUIRE(gameboy.loadState(state.data(), state.size()));
+	REQUIRE(gameboy.getScheduler().now() == savedAt);
+	std::vector<Framebuffer> second = runWalkingSprite(gameboy, 4);
+	REQUIRE(gameboy.getScheduler().now() == firstEnd);
+	REQUIRE(gameboy.getCpu().getRegisters().registers16.PC == firstPc);
+	REQUIRE(gameboy.getApu().getAmplitude(CHANNEL_PULSE1) == firstAmplitude);
+	for(int i = 0; i < 4; i++) {
+		REQUIRE(std::equal(first[i].indexed(), first[i].indexed() + SCREEN_PIXELS, second[i].indexed()));
+	}
+
+	state[4] = STATE_VERSION + 1;
+	REQUIRE(!gameboy.loadState(state.data(), state.size()));
+	REQUIRE(gameboy.getScheduler().now() == firstEnd);
+
+	// The host output rate and bus restriction are not emulated state.
+	std::unique_ptr<FastGameboy> a(new FastGameboy());
+	std::unique_ptr<FastGameboy> b(new FastGameboy());
+	b->getApu().setSampleRate(APU_SAMPLE_RATE / 4);
+	b->getDma().setRestrictBus(true);
+	REQUIRE(a->stateHash() == b->stateHash());
+	std::vector<uint8_t> hostState(a->stateSize());
+	a->saveState(hostState.data(), hostState.size());
+	REQUIRE(b->loadState(hostState.data(), hostState.size()));
+	b->getMemory()->write8(0xC100, 1);
+	b->getMemory()->write8(0xFF46, 0xC1);
+	REQUIRE(b->getMemory()->read8(0xC100) == 0xFF);
+	// Also during a transfer, whose lock each side takes from its own setting.
+	a->getMemory()->write8(0xC100, 1);
+	a->getMemory()->write8(0xFF46, 0xC1);
+	REQUIRE(a->getMemory()->read8(0xC100) == 1);
+	REQUIRE(a->stateHash() == b->stateHash());
+	a->saveState(hostState.data(), hostState.size());
+	REQUIRE(b->loadState(hostState.data(), hostState.size()));
+	REQUIRE(b->getMemory()->read8(0xC100) == 0xFF);
+	b->saveState(hostState.data(), hostState.size());
+	REQUIRE(a->loadState(hostState.data(), hostState.size()));
+	REQUIRE(a->getMemory()->read8(0xC100) == 1);
+}
+
+TEST_CASE("Cartridge bank switches remap pages and are saved", "[Cartridge]") {
+	// 8 ROM banks of MBC1 with 8 KB RAM; each bank starts with its number.
+	std::vector<uint8_t> rom(8 * ROM_BANK_SIZE);
+	for(int bank = 0; bank < 8; bank++) {
+		rom[bank * ROM_BANK_SIZE] = bank;
+	}
+	rom[CART_TYPE] = 0x03;
+	rom[CART_RAM_SIZE] = 0x02;
+	FastGameboy gameboy;
+	REQUIRE(gameboy.loadRom(rom.data(), rom.size()));
+	REQUIRE(gameboy.getCartridge().getType() == MBC_1);
+	MemoryMap *memory = gameboy.getMemory();
+	REQUIRE(memory->read8(0x0000) == 0);
+	REQUIRE(memory->read8(0x4000) == 1);
+	memory->write8(0x2000, 3);
+	REQUIRE(memory->read8(0x4000) == 3);
+	memory->write8(0x2000, 0);
+	REQUIRE(memory->read8(0x4000) == 1);
+	// ROM is read-only and RAM is closed until enabled.
+	memory->write8(0x4000, 0);
+	REQUIRE(memory->read8(0x4000) == 1);
+	memory->write8(0xA000, 0x42);
+	REQUIRE(memory->read8(0xA000) == 0xFF);
+	memory->write8(0x0000, 0x0A);
+	memory->write8(0xA000, 0x42);
+	REQUIRE(memory->read8(0xA000) == 0x42);
+
+	memory->write8(0x2000, 5);
+	std::vector<uint8_t> state(gameboy.stateSize());
+	REQUIRE(gameboy.saveState(state.data(), state.size()) == state.size());
+	memory->write8(0xA000, 0x17);
+	memory->write8(0x2000, 2);
+	memory->write8(0x0000, 0x00);
+	REQUIRE(gameboy.loadState(state.data(), state.size()));
+	REQUIRE(memory->read8(0x4000) == 5);
+	REQUIRE(memory->read8(0xA000) == 0x42);
+
+	// A state made without the cartridge does not fit this one.
+	FastGameboy plain;
+	std::vector<uint8_t> plainState(plain.stateSize());
+	plain.saveState(plainState.data(), plainState.size());
+	REQUIRE(!gameboy.loadState(plainState.data(), plainState.size()));
+}
+
+TEST_CASE("Gameboy instance state is one aligned block", "[Gameboy]") {
+	std::unique_ptr<FastGameboy> gameboy(new FastGameboy());
+	const uint8_t *begin = reinterpret_cast<const uint8_t*>(gameboy.get());
+	const uint8_t *end = begin + sizeof(FastGameboy);
+	REQUIRE(reinterpret_cast<uintptr_t>(begin) % 64 == 0);
+	// CPU registers lead; RAM regions follow on their own cache lines.
+	const uint8_t *registers = reinterpret_cast<const uint8_t*>(&gameboy->getCpu().getRegisters());
+	REQUIRE(registers - begin < 64);
+	MemoryMap *memory = gameboy->getMemory();
+	const uint8_t *regions[] = {memory->vram(0), memory->vram(1), memory->oam(), memory->pointer(0xC000)};
+	for(const uint8_t *region : regions) {
+		REQUIRE(region > registers);
+		REQUIRE(region < end);
+	}
+	REQUIRE(reinterpret_cast<uintptr_t>(memory->vram(0)) % 64 == 0);
+	REQUIRE(reinterpret_cast<uintptr_t>(memory->pointer(0xC000)) % 64 == 0);
+}
+
+TEST_CASE("Dirty blocks give incremental memory snapshots", "[MemoryMap]") {
+	MemoryMap memory;
+	MemoryDelta base;
+	memory.markAllDirty();
+	REQUIRE(memory.snapshotDirty(base) == DIRTY_CART_BLOCK);
+	REQUIRE(memory.dirtyBlocks() == 0);
+
+	memory.write8(0xC010, 1);
+	memory.write8(0xC020, 2);
+	memory.write8(0xD100, 3);
+	memory.write8(0x9800, 4);
+	memory.write8(0xFE00, 5);
+	MemoryDelta delta;
+	// Four written blocks plus the I/O block.
+	REQUIRE(memory.snapshotDirty(delta) == 5);
+	REQUIRE(std::count(delta.blocks.begin(), delta.blocks.end(), DIRTY_WRAM_BLOCK) == 1);
+	REQUIRE(std::count(delta.blocks.begin(), delta.blocks.end(), DIRTY_WRAM_BLOCK + 17) == 1);
+
+	memory.write8(0xC010, 9);
+	memory.write8(0x9800, 9);
+	REQUIRE(memory.dirtyBlocks() == 2);
+	memory.applyDelta(delta);
+	REQUIRE(memory.read8(0xC010) == 1);
+	REQUIRE(memory.read8(0x9800) == 4);
+	memory.applyDelta(base);
+	REQUIRE(memory.read8(0xC010) == 0);
+	REQUIRE(memory.read8(0xFE00) == 0);
+
+	// The CPU sits on a HALT, so only the test's own writes count.
+	FastGameboy gameboy;
+	loadTestScene(gameboy.getMemory());
+	gameboy.getMemory()->write8(0x0100, 0x76);
+	gameboy.runFrame();
+	REQUIRE(gameboy.getMemory()->getFrameDirty().vram > 0);
+	gameboy.getMemory()->write8(0xFE01, 50);
+	gameboy.runFrame();
+	const DirtyCounts &counts = gameboy.getMemory()->getFrameDirty();
+	REQUIRE(counts.vram == 0);
+	REQUIRE(counts.memory == 1);
+	REQUIRE(counts.total == 1);
+}
+
+TEST_CASE("LZ coder round-trips runs, repeats and noise", "[Lz]") {
+	std::vector<uint8_t> input(70000);
+	uint32_t seed = 1;
+	for(size_t i = 0; i < input.size(); i++) {
+		seed = seed * 1103515245 + 12345;
+		if(i < 20000) {
+			input[i] = 0;
+		} else if(i < 40000) {
+			input[i] = "state delta "[i % 12];
+		} else {
+			input[i] = seed >> 24;
+		}
+	}
+	std::vector<uint8_t> packed(lzBound(input.size()));
+	size_t size = lzCompress(input.data(), input.size(), packed.data(), packed.size());
+	REQUIRE(size > 0);
+	// The noise is incompressible; the rest almost vanishes.
+	REQUIRE(size < 30000 + 1000);
+	std::vector<uint8_t> output(input.size());
+	REQUIRE(lzDecompress(packed.data(), size, output.data(), output.size()) == input.size());
+	REQUIRE(output == input);
+	REQUIRE(lzDecompress(packed.data(), size, output.data(), output.size() - 1) == 0);
+	REQUIRE(lzCompress(input.data(), 5, packed.data(), packed.size()) == 6);
+	REQUIRE(lzDecompress(packed.data(), 6, output.data(), output.size()) == 5);
+}
+
+TEST_CASE("Rewind steps back through compressed frame deltas", "[Rewind]") {
+	FastGameboy gameboy;
+	loadTestScene(gameboy.getMemory());
+	std::vector<uint8_t> state(gameboy.stateSize());
+	std::vector<std::vector<uint8_t>> history;
+	Rewind rewind;
+	for(int i = 0; i < 30; i++) {
+		gameboy.getMemory()->write8(0xFE01, 30 + i);
+		gameboy.getMemory()->write8(0xC000 + i * 64, i);
+		gameboy.runFrame();
+		gameboy.saveState(state.data(), state.size());
+		rewind.push(state.data(), state.size());
+		history.push_back(state);
+	}
+	RewindStats stats = rewind.getStats();
+	REQUIRE(stats.frames == 29);
+	REQUIRE(stats.averageDeltaBytes < state.size() / 20);
+	for(int i = 28; i >= 20; i--) {
+		const uint8_t *previous = rewind.stepBack();
+		REQUIRE(previous);
+		REQUIRE(std::equal(previous, previous + state.size(), history[i].data()));
+	}
+	REQUIRE(gameboy.loadState(rewind.current(), rewind.getStateSize()));
+	REQUIRE(gameboy.getMemory()->read8(0xFE01) == 30 + 20);
+	REQUIRE(gameboy.getMemory()->read8(0xC000 + 21 * 64) == 0);
+
+	// A budget of a few deltas keeps only the newest frames.
+	Rewind small(static_cast<size_t>(stats.averageDeltaBytes * 5));
+	for(const std::vector<uint8_t> &frame : history) {
+		small.push(frame.data(), frame.size());
+	}
+	REQUIRE(small.getFrames() >= 3);
+	REQUIRE(small.getFrames() < 6);
+	int steps = 0;
+	while(const uint8_t *previous = small.stepBack()) {
+		steps++;
+		REQUIRE(std::equal(previous, previous + state.size(), history[29 - steps].data()));
+	}
+	REQUIRE(steps >= 3);
+}
+
+TEST_CASE("Joypad exposes the selected row and interrupts on presses", "[Joypad]") {
+	MemoryMap memory;
+	Joypad joypad(&memory);
+	REQUIRE(memory.read8(0xFF00) == 0xCF);
+	memory.write8(0xFF00, 0x20);
+	joypad.setButtons(BUTTON_RIGHT | BUTTON_A);
+	REQUIRE(memory.read8(0xFF00) == 0xEE);
+	REQUIRE((memory.read8(0xFF0F) & (1 << INT_JOYPAD)));
+	memory.write8(0xFF0F, 0);
+	memory.write8(0xFF00, 0x10);
+	REQUIRE(memory.read8(0xFF00) == 0xDE);
+	// A new press on the selected row interrupts; one on the other row does not.
+	joypad.setButtons(BUTTON_RIGHT | BUTTON_A | BUTTON_B);
+	REQUIRE(memory.read8(0xFF00) == 0xDC);
+	REQUIRE((memory.read8(0xFF0F) & (1 << INT_JOYPAD)));
+	memory.write8(0xFF0F, 0);
+	joypad.setButtons(BUTTON_RIGHT | BUTTON_A | BUTTON_B | BUTTON_DOWN);
+	REQUIRE(memory.read8(0xFF00) == 0xDC);
+	REQUIRE(!(memory.read8(0xFF0F) & (1 << INT_JOYPAD)));
+}
+
+// Scrolls SCX for as long as A is held.
+static void loadScrollOnA(MemoryMap *memory) {
+	loadTestScene(memory);
+	const uint8_t program[] = {
+		0xF0, 0x00,       // LDH A,(P1)
+		0x0F,             // RRCA
+		0x38, 0xFB,       // JR C,-5
+		0xF0, 0x43,       // LDH A,(SCX)
+		0x3C,             // INC A
+		0xE0, 0x43,       // LDH (SCX),A
+		0x18, 0xF4        // JR -12
+	};
+	for(size_t i = 0; i < sizeof(program); i++) {
+		memory->write8(0x0100 + i, program[i]);
+	}
+	memory->write8(0xFF00, 0x10);
+}
+
+TEST_CASE("Run-ahead presents the frame the input will produce", "[Gameboy]") {
+	std::unique_ptr<FastGameboy> plain(new FastGameboy());
+	std::unique_ptr<FastGameboy> ahead(new FastGameboy());
+	loadScrollOnA(plain->getMemory());
+	loadScrollOnA(ahead->getMemory());
+	ahead->setRunAhead(2);
+	std::vector<Framebuffer> plainFrames;
+	std::vector<Framebuffer> aheadFrames;
+	for(int i = 0; i < 14; i++) {
+		uint8_t buttons = i >= 5 ? BUTTON_A : 0;
+		plain->getJoypad().setButtons(buttons);
+		plain->runFrame();
+		plainFrames.push_back(plain->getFramebuffer());
+		if(i < 12) {
+			ahead->getJoypad().setButtons(buttons);
+			ahead->runFrame();
+			aheadFrames.push_back(ahead->getFramebuffer());
+			// The rolled back frames leave the real state where it was, and
+			// only the blocks the real frame wrote count as dirty.
+			REQUIRE(ahead->getScheduler().now() == plain->getScheduler().now());
+			REQUIRE(ahead->getMemory()->read8(0xFF43) == plain->getMemory()->read8(0xFF43));
+			REQUIRE(ahead->stateHash() == plain->stateHash());
+			MemoryDelta delta;
+			int snapshot = ahead->getMemory()->snapshotDirty(delta);
+			if(i > 0) {
+				REQUIRE(ahead->getHasher().getRehashed() < 8);
+				REQUIRE(snapshot < 8);
+			}
+		}
+	}
+	REQUIRE(plain->getMemory()->read8(0xFF43) != 3);
+	REQUIRE(!std::equal(plainFrames[8].indexed(), plainFrames[8].indexed() + SCREEN_PIXELS, plainFrames[10].indexed()));
+	for(int i = 5; i < 12; i++) {
+		REQUIRE(std::equal(aheadFrames[i].indexed(), aheadFrames[i].indexed() + SCREEN_PIXELS, plainFrames[i + 2].indexed()));
+	}
+}
+
+// Window from line 10 at the left edge, for both PPUs.
+template<class Gameboy>
+static uint64_t windowStateHash(bool render) {
+	std::unique_ptr<Gameboy> gameboy(new Gameboy());
+	loadTestScene(gameboy->getMemory());
+	gameboy->getMemory()->write8(0xFF4A, 10);
+	gameboy->getMemory()->write8(0xFF4B, 7);
+	gameboy->getPpu().setRenderEnabled(render);
+	for(int i = 0; i < 3; i++) {
+		gameboy->runFrame();
+	}
+	return gameboy->stateHash();
+}
+
+TEST_CASE("Skipping rendering leaves the same state with the window on", "[Gameboy]") {
+	REQUIRE(windowStateHash<FastGameboy>(true) == windowStateHash<FastGameboy>(false));
+	REQUIRE(windowStateHash<AccurateGameboy>(true) == windowStateHash<AccurateGameboy>(false));
+}
+
+static uint8_t movieInput(int frame) {
+	return ((frame * 7) % 5) < 2 ? BUTTON_A : BUTTON_B;
+}
+
+TEST_CASE("Movies from a save state replay identical frames", "[Movie]") {
+	std::unique_ptr<FastGameboy> recorder(new FastGameboy());
+	loadScrollOnA(recorder->getMemory());
+	for(int i = 0; i < 3; i++) {
+		recorder->runFrame();
+	}
+	std::vector<uint8_t> state(recorder->stateSize());
+	recorder->saveState(state.data(), state.size());
+	std::vector<Framebuffer> frames;
+	{
+		MovieWriter movie("movie-test.gbm", state.data(), state.size());
+		REQUIRE(movie.isOpen());
+		for(int i = 0; i < 40; i++) {
+			recordMovieFrame(*recorder, movie, movieInput(i));
+			frames.push_back(recorder->getFramebuffer());
+		}
+	}
+	MovieReader movie("movie-test.gbm");
+	REQUIRE(movie.isOpen());
+	REQUIRE(movie.getFrameCount() == 40);
+	REQUIRE(movie.hasState());
+	REQUIRE(movie.hasHashes());
+	std::unique_ptr<FastGameboy> player(new FastGameboy());
+	int matched = 0;
+	REQUIRE(playMovie(*player, movie, [&](int frame) {
+		const Framebuffer &fb = player->getFramebuffer();
+		matched += std::equal(fb.indexed(), fb.indexed() + SCREEN_PIXELS, frames[frame].indexed());
+	}) == -1);
+	REQUIRE(matched == 40);
+	REQUIRE(player->getMemory()->read8(0xFF43) == recorder->getMemory()->read8(0xFF43));
+	REQUIRE(player->stateHash() == recorder->stateHash());
+	remove("movie-test.gbm");
+}
+
+TEST_CASE("Movie playback from power-on reports the first desynced frame", "[Movie]") {
+	// Selects both button rows, then scrolls while A (or Right) is held.
+	std::vector<uint8_t> rom(2 * ROM_BANK_SIZE);
+	const uint8_t program[] = {0xE0, 0x00, 0xF0, 0x00, 0x0F, 0x38, 0xFB, 0xF0, 0x43, 0x3C, 0xE0, 0x43, 0x18, 0xF4};
+	std::copy(program, program + sizeof(program), rom.begin() + 0x100);
+	{
+		std::unique_ptr<FastGameboy> recorder(new FastGameboy());
+		REQUIRE(recorder->loadRom(rom.data(), rom.size()));
+		MovieWriter movie("movie-test.gbm");
+		MovieWriter tampered("movie-tampered.gbm");
+		for(int i = 0; i < 30; i++) {
+			recordMovieFrame(*recorder, movie, movieInput(i));
+			tampered.addFrame(i == 12 ? movieInput(i) ^ BUTTON_A : movieInput(i), recorder->stateHash());
+		}
+	}
+	MovieReader movie("movie-test.gbm");
+	REQUIRE(movie.isOpen());
+	REQUIRE(!movie.hasState());
+	std::unique_ptr<FastGameboy> player(new FastGameboy());
+	player->loadRom(rom.data(), rom.size());
+	REQUIRE(playMovie(*player, movie) == -1);
+	REQUIRE(player->getMemory()->read8(0xFF43) != 0);
+
+	MovieReader tampered("movie-tampered.gbm");
+	std::unique_ptr<FastGameboy> desynced(new FastGameboy());
+	desynced->loadRom(rom.data(), rom.size());
+	REQUIRE(playMovie(*desynced, tampered) == 12);
+
+	// Headless playback skips rendering; the window must not change state.
+	auto showWindow = [](FastGameboy &gameboy) {
+		gameboy.getMemory()->write8(0xFF4A, 10);
+		gameboy.getMemory()->write8(0xFF4B, 7);
+		gameboy.getMemory()->write8(0xFF40, 0xF3);
+	};
+	{
+		std::unique_ptr<FastGameboy> recorder(new FastGameboy());
+		recorder->loadRom(rom.data(), rom.size());
+		showWindow(*recorder);
+		MovieWriter windowed("movie-window.gbm");
+		for(int i = 0; i < 30; i++) {
+			recordMovieFrame(*recorder, windowed, movieInput(i));
+		}
+	}
+	MovieReader windowed("movie-window.gbm");
+	std::unique_ptr<FastGameboy> headless(new FastGameboy());
+	headless->loadRom(rom.data(), rom.size());
+	showWindow(*headless);
+	REQUIRE(playMovie(*headless, windowed) == -1);
+	remove("movie-test.gbm");
+	remove("movie-tampered.gbm");
+	remove("movie-window.gbm");
+}
+
+TEST_CASE("State hashes reuse unchanged blocks and localize divergence", "[StateHash]") {
+	std::vector<uint8_t> bytes(1500);
+	for(size_t i = 0; i < bytes.size(); i++) {
+		bytes[i] = i * 7;
+	}
+	uint64_t hash = hashBytes(bytes.data(), bytes.size());
+	REQUIRE(hashBytes(bytes.data(), bytes.size() - 1) != hash);
+	REQUIRE(hashBytes(bytes.data(), bytes.size(), 1) != hash);
+	bytes[1499] ^= 1;
+	REQUIRE(hashBytes(bytes.data(), bytes.size()) != hash);
+
+	std::unique_ptr<FastGameboy> a(new FastGameboy());
+	loadScrollOnA(a->getMemory());
+	a->getJoypad().setButtons(BUTTON_A);
+	a->stateHash();
+	REQUIRE(a->getHasher().getRehashed() == a->getMemory()->blockCount());
+	for(int i = 0; i < 5; i++) {
+		a->runFrame();
+		a->stateHash();
+		REQUIRE(a->getHasher().getRehashed() < 8);
+	}
+
+	// A restored copy hashes every block afresh and must agree.
+	std::vector<uint8_t> state(a->stateSize());
+	a->saveState(state.data(), state.size());
+	std::unique_ptr<FastGameboy> b(new FastGameboy());
+	REQUIRE(b->loadState(state.data(), state.size()));
+	StateHashes expected = a->stateHashes();
+	StateHashes restored = b->stateHashes();
+	REQUIRE(restored.total == expected.total);
+
+	b->getMemory()->write8(0xC123, b->getMemory()->read8(0xC123) + 1);
+	StateHashes diverged = b->stateHashes();
+	REQUIRE(diverged.total != expected.total);
+	for(int region = 0; region < HASH_REGIONS; region++) {
+		REQUIRE((diverged.regions[region] != expected.regions[region]) == (region == HASH_WRAM));
+	}
+}
+
+TEST_CASE("Forked instances share the ROM and continue independently", "[Gameboy]") {
+	std::vector<uint8_t> rom(2 * ROM_BANK_SIZE);
+	const uint8_t program[] = {0xE0, 0x00, 0xF0, 0x00, 0x0F, 0x38, 0xFB, 0xF0, 0x43, 0x3C, 0xE0, 0x43, 0x18, 0xF4};
+	std::copy(program, program + sizeof(program), rom.begin() + 0x100);
+	rom[CART_TYPE] = 0x03;
+	rom[CART_RAM_SIZE] = 0x02;
+	std::unique_ptr<FastGameboy> parent(new FastGameboy());
+	REQUIRE(parent->loadRom(rom.data(), rom.size()));
+	parent->getJoypad().setButtons(BUTTON_A);
+	for(int i = 0; i < 5; i++) {
+		parent->runFrame();
+	}
+	std::unique_ptr<FastGameboy> children[3];
+	FastGameboy *pointers[3];
+	for(int i = 0; i < 3; i++) {
+		children[i].reset(new FastGameboy());
+		pointers[i] = children[i].get();
+	}
+	REQUIRE(parent->fork(pointers, 3));
+	for(int i = 0; i < 3; i++) {
+		REQUIRE(children[i]->getCartridge().getRom() == rom.data());
+		REQUIRE(children[i]->stateHash() == parent->stateHash());
+	}
+
+	uint8_t scroll = parent->getMemory()->read8(0xFF43);
+	children[1]->getJoypad().setButtons(0);
+	for(int i = 0; i < 10; i++) {
+		parent->runFrame();
+		for(int j = 0; j < 3; j++) {
+			children[j]->runFrame();
+		}
+	}
+	REQUIRE(children[0]->stateHash() == parent->stateHash());
+	REQUIRE(children[2]->stateHash() == parent->stateHash());
+	REQUIRE(children[1]->stateHash() != parent->stateHash());
+	REQUIRE(parent->getMemory()->read8(0xFF43) != scroll);
+	REQUIRE(abs(children[1]->getMemory()->read8(0xFF43) - scroll) <= 1);
+
+	// Forking again reuses the children in place.
+	REQUIRE(parent->fork(*children[1]));
+	REQUIRE(children[1]->stateHash() == parent->stateHash());
+	std::unique_ptr<FastGameboy> plain(new FastGameboy());
+	REQUIRE(!plain->fork(*children[0]));
+}
+
+TEST_CASE("Resetting to a checkpoint restores written blocks and components", "[Gameboy]") {
+	std::unique_ptr<FastGameboy> gameboy(new FastGameboy());
+	REQUIRE(!gameboy->resetToCheckpoint());
+	loadScrollOnA(gameboy->getMemory());
+	for(int i = 0; i < 3; i++) {
+		gameboy->runFrame();
+	}
+	gameboy->setCheckpoint();
+	uint64_t start = gameboy->stateHash();
+	uint64_t end = 0;
+	for(int episode = 0; episode < 3; episode++) {
+		for(int i = 0; i < 20; i++) {
+			gameboy->getJoypad().setButtons(i & 4 ? BUTTON_A : 0);
+			gameboy->getMemory()->write8(0xC000 + i * 0x100, i + 1);
+			gameboy->runFrame();
+		}
+		REQUIRE(gameboy->stateHash() != start);
+		if(episode) {
+			REQUIRE(gameboy->stateHash() == end);
+		}
+		end = gameboy->stateHash();
+		REQUIRE(gameboy->resetToCheckpoint());
+		REQUIRE(gameboy->stateHash() == start);
+		REQUIRE(gameboy->getMemory()->read8(0xC000) == 0);
+	}
+}
+
+TEST_CASE("Work pool runs every index once across threads", "[WorkPool]") {
+	WorkPool pool(3);
+	std::vector<std::atomic<int>> counts(1000);
+	for(int round = 0; round < 5; round++) {
+		pool.run(counts.size(), [&](int i) { counts[i]++; });
+	}
+	for(std::atomic<int> &count : counts) {
+		REQUIRE(count == 5);
+	}
+	pool.run(0, [](int) {});
+}
+
+TEST_CASE("Vector emulator steps instances in parallel into flat observations", "[VecEmulator]") {
+	const int count = 4;
+	VecEmulator<FastGameboy> envs(count, 2, 2);
+	envs.setRamObservation({0xFF43, 0xFF44});
+	REQUIRE(envs.frameObservationSize() == 80 * 72);
+	for(int i = 0; i < count; i++) {
+		loadScrollOnA(envs.get(i).getMemory());
+	}
+	std::unique_ptr<FastGameboy> reference(new FastGameboy());
+	loadScrollOnA(reference->getMemory());
+	envs.setCheckpoint();
+	uint8_t scroll = envs.get(0).getMemory()->read8(0xFF43);
+
+	uint8_t actions[count] = {BUTTON_A, 0, BUTTON_A, 0};
+	std::vector<uint8_t> frames(count * envs.frameObservationSize());
+	std::vector<uint8_t> ram(count * envs.ramObservationSize());
+	for(int step = 0; step < 3; step++) {
+		envs.step(actions, 4, frames.data(), ram.data());
+	}
+	for(int i = 0; i < count; i++) {
+		REQUIRE((ram[i * 2] != scroll) == (actions[i] != 0));
+	}
+
+	reference->getJoypad().setButtons(BUTTON_A);
+	for(int i = 0; i < 12; i++) {
+		reference->runFrame();
+	}
+	std::vector<uint8_t> gray(SCREEN_PIXELS);
+	std::vector<uint8_t> expected(envs.frameObservationSize());
+	reference->getFramebuffer().toGray8(gray.data());
+	downscaleGray8(gray.data(), SCREEN_WIDTH, SCREEN_HEIGHT, 2, expected.data());
+	REQUIRE(std::equal(expected.begin(), expected.end(), frames.begin() + 2 * envs.frameObservationSize()));
+	REQUIRE(ram[4] == reference->getMemory()->read8(0xFF43));
+
+	uint8_t done[count] = {1, 0, 0, 0};
+	envs.reset(done);
+	REQUIRE(envs.get(0).getMemory()->read8(0xFF43) == scroll);
+	REQUIRE(envs.get(2).getMemory()->read8(0xFF43) == ram[4]);
+}
@@ -0,0 +1,146 @@
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <framebuffer.h>
+#include <recording.h>
+
+using namespace gbemulator;
+
+// Exports frames of a recording as PNG or raw RGB24 files.
+//
+//   recording-export <recording> <output prefix> [png|raw] [first] [count]
+//
+// Frames are written to <prefix>NNNNNN.png or <prefix>NNNNNN.rgb.
+
+static uint32_t crcTable[256];
+
+static void initCrc() {
+	for(uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for(int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		crcTable[n] = c;
+	}
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++) {
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void putBE32(std::vector<uint8_t> &out, uint32_t v) {
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static void writeChunk(FILE *file, const char *type, const std::vector<uint8_t> &data) {
+	std::vector<uint8_t> chunk;
+	putBE32(chunk, data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	std::vector<uint8_t> crc;
+	putBE32(crc, crc32(chunk.data() + 4, chunk.size() - 4));
+	chunk.insert(chunk.end(), crc.begin(), crc.end());
+	fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// The image data goes into stored (uncompressed) deflate blocks, which
+// keeps the tool free of a zlib dependency.
+static bool writePng(const char *path, const uint8_t *rgb) {
+	FILE *file = fopen(path, "wb");
+	if(!file) {
+		return false;
+	}
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	fwrite(signature, 1, sizeof(signature), file);
+	std::vector<uint8_t> ihdr;
+	putBE32(ihdr, SCREEN_WIDTH);
+	putBE32(ihdr, SCREEN_HEIGHT);
+	ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+	writeChunk(file, "IHDR", ihdr);
+
+	std::vector<uint8_t> raw;
+	for(int y = 0; y < SCREEN_HEIGHT; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb + y * SCREEN_WIDTH * 3, rgb + (y + 1) * SCREEN_WIDTH * 3);
+	}
+	std::vector<uint8_t> zlib = {0x78, 0x01};
+	for(size_t pos = 0; pos < raw.size(); pos += 0xFFFF) {
+		size_t size = std::min(raw.size() - pos, static_cast<size_t>(0xFFFF));
+		zlib.push_back(pos + size == raw.size());
+		zlib.push_back(size);
+		zlib.push_back(size >> 8);
+		zlib.push_back(~size);
+		zlib.push_back(~size >> 8);
+		zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + size);
+	}
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for(uint8_t byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	putBE32(zlib, (b << 16) | a);
+	writeChunk(file, "IDAT", zlib);
+	writeChunk(file, "IEND", {});
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc < 3) {
+		fprintf(stderr, "usage: %s <recording> <output prefix> [png|raw] [first] [count]\n", argv[0]);
+		return 1;
+	}
+	RecordingReader reader(argv[1]);
+	if(!reader.isOpen()) {
+		fprintf(stderr, "%s: not a recording\n", argv[1]);
+		return 1;
+	}
+	bool png = argc < 4 || strcmp(argv[3], "raw") != 0;
+	int first = argc > 4 ? atoi(argv[4]) : 0;
+	int count = argc > 5 ? atoi(argv[5]) : reader.getFrameCount() - first;
+	initCrc();
+	Framebuffer frame;
+	std::vector<uint32_t> rgba(SCREEN_PIXELS);
+	std::vector<uint8_t> rgb(SCREEN_PIXELS * 3);
+	for(int i = first; i < first + count && i < reader.getFrameCount(); i++) {
+		if(!reader.readFrame(i, frame)) {
+			fprintf(stderr, "%s: frame %d is corrupt\n", argv[1], i);
+			return 1;
+		}
+		frame.toRGBA8888(rgba.data());
+		for(int p = 0; p < SCREEN_PIXELS; p++) {
+			rgb[p * 3] = rgba[p];
+			rgb[p * 3 + 1] = rgba[p] >> 8;
+			rgb[p * 3 + 2] = rgba[p] >> 16;
+		}
+		char path[4096];
+		snprintf(path, sizeof(path), "%s%06d.%s", argv[2], i, png ? "png" : "rgb");
+		if(png) {
+			if(!writePng(path, rgb.data())) {
+				fprintf(stderr, "%s: cannot write\n", path);
+				return 1;
+			}
+		} else {
+			FILE *file = fopen(path, "wb");
+			if(!file) {
+				fprintf(stderr, "%s: cannot write\n", path);
+				return 1;
+			}
+			fwrite(rgb.data(), 1, rgb.size(), file);
+			fclose(file);
+		}
+	}
+	return 0;
+}